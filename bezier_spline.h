@@ -15,6 +15,7 @@ namespace pivid {
 struct BezierSegment {
     Interval t;
     double begin_v = 0.0, p1_v = 0.0, p2_v = 0.0, end_v = 0.0;
+    bool operator==(BezierSegment const&) const = default;
 };
 
 // Piecewise-cubic Bezier function in x parameterized on t.
@@ -24,6 +25,7 @@ struct BezierSpline {
 
     std::optional<double> value(double t) const;
     IntervalSet range(Interval t) const;
+    bool operator==(BezierSpline const&) const = default;
 };
 
 // Returns a segment that has the same value everywhere on the interval.
@@ -0,0 +1,148 @@
+#include "capture_recorder.h"
+
+#include <pthread.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "logging_policy.h"
+#include "media_decoder.h"
+
+namespace pivid {
+
+namespace {
+
+auto const& recorder_logger() {
+    static const auto logger = make_logger("recorder");
+    return logger;
+}
+
+class CaptureRecorderDef : public CaptureRecorder {
+  public:
+    virtual ~CaptureRecorderDef() final {
+        std::unique_lock lock{mutex};
+        if (thread.joinable()) {
+            DEBUG(logger, "Stopping capture recorder...");
+            shutdown = true;
+            lock.unlock();
+            wakeup->set();
+            thread.join();
+            lock.lock();
+        }
+
+        logger->info(
+            "Recorded {} captures ({} dropped) in {}",
+            written_count, dropped_count, options.dir
+        );
+    }
+
+    virtual void record(DisplayCapture capture) final {
+        std::unique_lock const lock{mutex};
+        if (queue.size() >= options.max_queue) {
+            ++dropped_count;
+            DEBUG(
+                logger, "Dropped {} capture {} (encoder behind)",
+                capture.connector, abbrev_realtime(capture.flip_time)
+            );
+            return;
+        }
+
+        queue.push_back(std::move(capture));
+        wakeup->set();
+    }
+
+    void start(
+        std::shared_ptr<UnixSystem> sys, CaptureRecorderOptions const& options
+    ) {
+        CHECK_ARG(!options.dir.empty(), "No capture recorder directory");
+        logger->info("Recording captures to {}", options.dir);
+        this->sys = std::move(sys);
+        this->options = options;
+        wakeup = this->sys->make_flag();
+        thread = std::thread(&CaptureRecorderDef::encoder_thread, this);
+    }
+
+  private:
+    void encoder_thread() {
+        pthread_setname_np(pthread_self(), "pivid:record");
+        DEBUG(logger, "Capture encoder thread running...");
+
+        std::unique_lock lock{mutex};
+        while (!shutdown || !queue.empty()) {
+            if (queue.empty()) {
+                lock.unlock();
+                wakeup->sleep();
+                lock.lock();
+                continue;
+            }
+
+            auto capture = std::move(queue.front());
+            queue.pop_front();
+            int const index = next_index[capture.connector]++;
+            lock.unlock();
+
+            auto const path = fmt::format(
+                "{}/{}.{:06d}.tiff", options.dir, capture.connector, index
+            );
+
+            try {
+                // Writeback output is opaque, so premultiplication is moot
+                auto image = capture.image->content();
+                if (image.fourcc == fourcc("rgbA"))
+                    image.fourcc = fourcc("RGBA");
+                auto const tiff = debug_tiff(image);
+                capture.image.reset();  // Let the display reuse the buffer
+
+                int const flags = O_WRONLY | O_CREAT | O_TRUNC;
+                auto const fd = sys->open(path, flags, 0644).ex(path);
+                size_t done = 0;
+                while (done < tiff.size()) {
+                    auto const len = tiff.size() - done;
+                    done += fd->write(tiff.data() + done, len).ex(path);
+                }
+
+                DEBUG(
+                    logger, "Wrote {} ({})",
+                    path, abbrev_realtime(capture.flip_time)
+                );
+                lock.lock();
+                ++written_count;
+            } catch (std::exception const& e) {
+                logger->error("Capture {}: {}", path, e.what());
+                lock.lock();
+                ++dropped_count;
+            }
+        }
+
+        DEBUG(logger, "Capture encoder thread ending...");
+    }
+
+    // Constant from start to ~
+    std::shared_ptr<log::logger> const logger = recorder_logger();
+    std::shared_ptr<UnixSystem> sys;
+    CaptureRecorderOptions options;
+    std::thread thread;
+    std::unique_ptr<SyncFlag> wakeup;
+
+    // Guarded by mutex
+    std::mutex mutex;
+    bool shutdown = false;
+    std::deque<DisplayCapture> queue;
+    std::map<std::string, int> next_index;
+    int written_count = 0;
+    int dropped_count = 0;
+};
+
+}  // anonymous namespace
+
+std::unique_ptr<CaptureRecorder> start_capture_recorder(
+    std::shared_ptr<UnixSystem> sys, CaptureRecorderOptions const& options
+) {
+    auto recorder = std::make_unique<CaptureRecorderDef>();
+    recorder->start(std::move(sys), options);
+    return recorder;
+}
+
+}  // namespace pivid
@@ -0,0 +1,38 @@
+// Background encoding of writeback captures to disk, for recording shows.
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "display_output.h"
+#include "unix_system.h"
+
+namespace pivid {
+
+// Tuning parameters for start_capture_recorder().
+struct CaptureRecorderOptions {
+    std::string dir;       // Output directory (must exist)
+    size_t max_queue = 2;  // Captures waiting to be encoded before dropping
+};
+
+// Encodes DisplayCapture images as TIFF files on a background thread,
+// named like "Writeback-1.000042.tiff" (numbered per connector).
+// Usable as DisplayDriverOptions::capture_sink via record().
+// *Internally synchronized* for multithreaded access.
+class CaptureRecorder {
+  public:
+    virtual ~CaptureRecorder() = default;
+
+    // Queues a capture and returns immediately. Drops the capture (so the
+    // display can reuse its buffer) if the encoder is too far behind.
+    virtual void record(DisplayCapture) = 0;
+};
+
+// Creates a recorder and starts its encoder thread. On destruction,
+// captures already queued are written before the thread exits.
+std::unique_ptr<CaptureRecorder> start_capture_recorder(
+    std::shared_ptr<UnixSystem> sys, CaptureRecorderOptions const&
+);
+
+}  // namespace pivid
@@ -0,0 +1,137 @@
+#include "display_cost.h"
+
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+
+#include <nlohmann/json.hpp>
+
+#include "display_output.h"
+#include "logging_policy.h"
+
+using json = nlohmann::json;
+
+namespace pivid {
+
+DisplayCostModel default_cost_model(std::string const& driver) {
+    DisplayCostModel model = {};
+    model.driver = driver;
+    if (driver == "vc4") {
+        // Raspberry Pi 4B; other vc4 boards should be calibrated.
+        // https://github.com/raspberrypi/linux/blob/rpi-5.15.y/drivers/gpu/drm/vc4/vc4_kms.c#:~:text=vc4_load_tracker_atomic_check
+        // Empirically, the Pi4 can do ~150% the Pi3, despite 2x clock??
+        model.compositor_hz = 340 * 1000000.0;
+
+        // https://forums.raspberrypi.com/viewtopic.php?t=271121
+        // Empirically, Pi4 has ~2x Pi3's bandwidth, and indeed 2x1.5GB=3.0GB
+        // seems to be around where HVS underruns start creeping in.
+        model.memory_bandwidth = 3072 * 1048576.0;
+
+        // https://github.com/raspberrypi/linux/blob/rpi-5.15.y/drivers/gpu/drm/vc4/vc4_hvs.c#:~:text=60k%20words
+        model.line_buffer_size = 60 * 1024;
+    }
+    return model;
+}
+
+DisplayCost estimate_cost(
+    DisplayCostModel const& model, DisplayFrame const& frame
+) {
+    // These calculations follow the vc4 (Raspberry Pi HVS) load tracker
+    DisplayCost out = {};
+    for (auto const& layer : visible_layers(frame)) {
+        auto const& image = layer.image->content();
+        auto const image_pix = image.size.x * image.size.y;
+        if (image_pix <= 0) continue;
+
+        int image_bytes = 0;
+        for (auto const& chan : image.channels) image_bytes += chan.size;
+        auto const pix_bytes = (image_bytes + image_pix - 1) / image_pix;
+
+        // https://github.com/raspberrypi/linux/blob/rpi-5.15.y/drivers/gpu/drm/vc4/vc4_plane.c#:~:text=vc4_plane_calc_load
+        if (layer.to_size.y <= 0) continue;
+        out.memory_bandwidth +=
+            std::ceil(layer.from_size.x) * std::ceil(layer.from_size.y)
+            * std::ceil(layer.from_size.y / layer.to_size.y) * pix_bytes;
+
+        bool scaled_uv = false;
+        switch (image.fourcc) {
+            case fourcc("I420"):
+            case fourcc("NV12"):
+            case fourcc("NV21"):
+            case fourcc("Y42B"):
+                scaled_uv = true;
+        }
+
+        bool const scaled =
+            scaled_uv || layer.from_size != layer.to_size.as<double>();
+        out.compositor_bandwidth += layer.to_size.x * layer.to_size.y *
+            (scaled ? model.scaled_cycles : model.unscaled_cycles);
+
+        // https://github.com/raspberrypi/linux/blob/rpi-5.15.y/drivers/gpu/drm/vc4/vc4_plane.c#:~:text=vc4_lbm_size
+        // https://github.com/raspberrypi/linux/blob/rpi-5.15.y/drivers/gpu/drm/vc4/vc4_plane.c#:~:text=vc4_get_scaling_mode
+        if (scaled_uv || layer.from_size.y != layer.to_size.y) {
+            int const line_pix =   // Dest if TPZ, source otherwise
+                3 * layer.to_size.x < 2 * layer.from_size.x
+                    ? layer.to_size.x : std::ceil(layer.from_size.x);
+
+            int const lbm_pix =  // 2x if TPZ, 4x otherwise
+                 (!scaled_uv && 3 * layer.to_size.y < 2 * layer.from_size.y)
+                    ? line_pix * 2 : line_pix * 4;
+
+            // Align to 128 bytes (32 pixels, 8 "words")
+            out.line_buffer_memory += (lbm_pix + 31) / 32 * 32;
+        }
+    }
+
+    auto const load = [](double demand, double capacity) {
+        return capacity > 0 ? demand / capacity : 0.0;
+    };
+
+    double const hz = frame.mode.actual_hz();
+    out.compositor_bandwidth =
+        load(out.compositor_bandwidth * hz, model.compositor_hz);
+    out.memory_bandwidth =
+        load(out.memory_bandwidth * hz, model.memory_bandwidth);
+
+    // The *2 is because both the old & new config must be allocated.
+    out.line_buffer_memory =
+        load(out.line_buffer_memory * 2, model.line_buffer_size);
+    return out;
+}
+
+DisplayCostModel parse_cost_model(std::string_view text) {
+    try {
+        DisplayCostModel m = {};
+        auto const j = json::parse(text);
+        CHECK_ARG(j.is_object(), "Bad JSON cost model: {}", j.dump());
+        m.driver = j.value("driver", m.driver);
+        m.compositor_hz = j.value("compositor_hz", m.compositor_hz);
+        m.scaled_cycles = j.value("scaled_cycles", m.scaled_cycles);
+        m.unscaled_cycles = j.value("unscaled_cycles", m.unscaled_cycles);
+        m.memory_bandwidth = j.value("memory_bandwidth", m.memory_bandwidth);
+        m.line_buffer_size = j.value("line_buffer_size", m.line_buffer_size);
+        CHECK_ARG(
+            m.compositor_hz >= 0 && m.scaled_cycles >= 0 &&
+            m.unscaled_cycles >= 0 && m.memory_bandwidth >= 0 &&
+            m.line_buffer_size >= 0,
+            "Bad cost model values: {}", j.dump()
+        );
+        return m;
+    } catch (json::exception const& e) {
+        std::throw_with_nested(std::invalid_argument(e.what()));
+    }
+}
+
+std::string cost_model_json(DisplayCostModel const& m) {
+    json const j = {
+        {"driver", m.driver},
+        {"compositor_hz", m.compositor_hz},
+        {"scaled_cycles", m.scaled_cycles},
+        {"unscaled_cycles", m.unscaled_cycles},
+        {"memory_bandwidth", m.memory_bandwidth},
+        {"line_buffer_size", m.line_buffer_size},
+    };
+    return j.dump(2);
+}
+
+}  // namespace pivid
@@ -0,0 +1,43 @@
+// Model of display hardware load, used to predict whether a frame can be
+// shown without underruns (see DisplayDriver::predict_cost()).
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace pivid {
+
+struct DisplayFrame;
+
+// Estimate of display load factors, where 1.0 is max capacity.
+struct DisplayCost {
+    double memory_bandwidth = 0.0;
+    double compositor_bandwidth = 0.0;
+    double line_buffer_memory = 0.0;
+};
+
+// Hardware capacities for estimate_cost(), which vary by board.
+// Zero capacity means unlimited (the load is not modeled).
+// Measured by the pivid_calibrate_cost tool.
+struct DisplayCostModel {
+    std::string driver;             // DRM driver name, like "vc4"
+    double compositor_hz = 0.0;     // Compositor clock rate
+    double scaled_cycles = 0.5;     // Compositor clocks per scaled pixel
+    double unscaled_cycles = 0.25;  // Compositor clocks per unscaled pixel
+    double memory_bandwidth = 0.0;  // Plane fetch bytes per second
+    double line_buffer_size = 0.0;  // Scaler line buffer (vc4 LBM words)
+};
+
+// Returns built-in capacities for a DRM driver (from DisplayDriverListing).
+// Unknown drivers get an unlimited model.
+DisplayCostModel default_cost_model(std::string const& driver);
+
+// Estimates the load of showing a frame, per the model.
+DisplayCost estimate_cost(DisplayCostModel const&, DisplayFrame const&);
+
+// Converts cost models to and from JSON text (as used by calibration files).
+DisplayCostModel parse_cost_model(std::string_view);
+std::string cost_model_json(DisplayCostModel const&);
+
+}  // namespace pivid
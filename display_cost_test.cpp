@@ -0,0 +1,115 @@
+#include "display_cost.h"
+
+#include <stdexcept>
+
+#include <doctest/doctest.h>
+
+#include "display_output.h"
+
+using Approx = doctest::Approx;
+
+namespace pivid {
+
+namespace {
+
+class FakeImage : public LoadedImage {
+  public:
+    FakeImage(uint32_t fourcc, XY<int> size) {
+        im.fourcc = fourcc;
+        im.size = size;
+        im.channels.resize(1);
+        im.channels[0].size = size.x * size.y * 4;
+        im.channels[0].stride = size.x * 4;
+    }
+    virtual uint32_t drm_id() const final { return 1; }
+    virtual ImageBuffer const& content() const final { return im; }
+
+  private:
+    ImageBuffer im;
+};
+
+DisplayFrame make_frame(XY<int> from_size) {
+    DisplayFrame frame = {};
+    frame.mode.size = frame.mode.scan_size = {1000, 1000};
+    frame.mode.pixel_khz = 60000;
+    frame.mode.nominal_hz = 60;
+
+    DisplayLayer layer = {};
+    layer.image = std::make_shared<FakeImage>(fourcc("rgbA"), from_size);
+    layer.from_size = from_size.as<double>();
+    layer.to_size = frame.mode.size;
+    frame.layers.push_back(layer);
+    return frame;
+}
+
+}  // anonymous namespace
+
+TEST_CASE("default_cost_model") {
+    auto const vc4 = default_cost_model("vc4");
+    CHECK(vc4.driver == "vc4");
+    CHECK(vc4.compositor_hz == 340e6);
+    CHECK(vc4.memory_bandwidth == 3072 * 1048576.0);
+    CHECK(vc4.line_buffer_size == 60 * 1024);
+
+    auto const other = default_cost_model("i915");
+    CHECK(other.driver == "i915");
+    CHECK(other.compositor_hz == 0);
+    CHECK(other.memory_bandwidth == 0);
+    CHECK(other.line_buffer_size == 0);
+}
+
+TEST_CASE("estimate_cost") {
+    DisplayCostModel unit = {};
+    unit.compositor_hz = unit.memory_bandwidth = unit.line_buffer_size = 1;
+
+    SUBCASE("Unscaled") {
+        auto const frame = make_frame({1000, 1000});
+        auto const raw = estimate_cost(unit, frame);
+        CHECK(raw.memory_bandwidth == Approx(1000 * 1000 * 4 * 60));
+        CHECK(raw.compositor_bandwidth == Approx(1000 * 1000 * 0.25 * 60));
+        CHECK(raw.line_buffer_memory == 0);
+
+        auto const vc4 = estimate_cost(default_cost_model("vc4"), frame);
+        CHECK(vc4.memory_bandwidth == Approx(2.4e8 / (3072 * 1048576.0)));
+        CHECK(vc4.compositor_bandwidth == Approx(1.5e7 / 340e6));
+
+        auto const none = estimate_cost(DisplayCostModel{}, frame);
+        CHECK(none.memory_bandwidth == 0);
+        CHECK(none.compositor_bandwidth == 0);
+        CHECK(none.line_buffer_memory == 0);
+    }
+
+    SUBCASE("Downscaled") {
+        auto const raw = estimate_cost(unit, make_frame({2000, 2000}));
+        CHECK(raw.memory_bandwidth == Approx(2000 * 2000 * 2 * 4 * 60.0));
+        CHECK(raw.compositor_bandwidth == Approx(1000 * 1000 * 0.5 * 60));
+        CHECK(raw.line_buffer_memory == 2016 * 2);  // TPZ, 32-pixel aligned
+    }
+}
+
+TEST_CASE("parse_cost_model") {
+    auto model = default_cost_model("vc4");
+    model.compositor_hz = 500e6;
+    model.scaled_cycles = 0.75;
+
+    auto const parsed = parse_cost_model(cost_model_json(model));
+    CHECK(parsed.driver == "vc4");
+    CHECK(parsed.compositor_hz == 500e6);
+    CHECK(parsed.scaled_cycles == 0.75);
+    CHECK(parsed.unscaled_cycles == model.unscaled_cycles);
+    CHECK(parsed.memory_bandwidth == model.memory_bandwidth);
+    CHECK(parsed.line_buffer_size == model.line_buffer_size);
+
+    auto const partial = parse_cost_model(R"({"memory_bandwidth": 1e9})");
+    CHECK(partial.driver.empty());
+    CHECK(partial.memory_bandwidth == 1e9);
+    CHECK(partial.compositor_hz == 0);
+
+    CHECK_THROWS_AS(parse_cost_model("[1, 2]"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_cost_model("{\"driver\": 5}"), std::invalid_argument);
+    CHECK_THROWS_AS(
+        parse_cost_model(R"({"compositor_hz": -1})"), std::invalid_argument
+    );
+}
+
+}  // namespace pivid
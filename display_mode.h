@@ -25,6 +25,7 @@ struct DisplayMode {
     int pixel_khz = 0;      // Basic pixel clock
     int nominal_hz = 0;     // Approx refresh rate (like 30 or 60)
     double actual_hz() const;  // Computes true refresh frequency
+    bool operator==(DisplayMode const&) const = default;
 };
 
 // All modes listed in the CTA-861 standard
@@ -4,24 +4,33 @@
 #include <drm_fourcc.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cctype>
 #include <cmath>
+#include <cstring>
+#include <deque>
+#include <future>
 #include <map>
 #include <mutex>
 #include <optional>
 #include <set>
 #include <system_error>
+#include <thread>
+#include <tuple>
 #include <type_traits>
 
 #include <fmt/core.h>
 
 #include "logging_policy.h"
+#include "software_compositor.h"
 #include "unix_system.h"
 
 namespace pivid {
@@ -135,6 +144,26 @@ uint32_t format_to_drm(uint32_t format) {
     }
 }
 
+bool drm_format_opaque(uint32_t drm_format) {
+    switch (drm_format) {
+        case DRM_FORMAT_BGR565:
+        case DRM_FORMAT_BGR888:
+        case DRM_FORMAT_BGRX8888:
+        case DRM_FORMAT_NV12:
+        case DRM_FORMAT_NV21:
+        case DRM_FORMAT_RGB565:
+        case DRM_FORMAT_RGB888:
+        case DRM_FORMAT_RGBX8888:
+        case DRM_FORMAT_XBGR8888:
+        case DRM_FORMAT_XRGB8888:
+        case DRM_FORMAT_YUV420:
+        case DRM_FORMAT_YUV422:
+            return true;
+        default:
+            return false;  // Assume alpha (or unknown) is transparent
+    }
+}
+
 void to_premultiplied_rgba(
     uint32_t format, int width, uint8_t const* from, uint8_t* to
 ) {
@@ -211,6 +240,8 @@ class DumbBuffer : public MemoryBuffer {
     virtual uint32_t drm_handle() const final { return ddat.handle; }
     uint8_t* write() { read(); return (uint8_t*) mem.get(); }
     ptrdiff_t stride() const { return ddat.pitch; }
+    XY<int> image_size() const { return {int(ddat.width), int(ddat.height)}; }
+    int bpp() const { return ddat.bpp; }
 
     DumbBuffer(DumbBuffer const&) = delete;
     DumbBuffer& operator=(DumbBuffer const&) = delete;
@@ -222,6 +253,74 @@ class DumbBuffer : public MemoryBuffer {
     std::shared_ptr<void> mem;
 };
 
+// Keeps released DumbBuffer objects (and their memory maps) for reuse,
+// to avoid allocation ioctls and page faults for every converted image.
+// *Internally synchronized* for multithreaded access.
+class DumbBufferPool : public std::enable_shared_from_this<DumbBufferPool> {
+  public:
+    DumbBufferPool(std::shared_ptr<FileDescriptor> fd, size_t max_bytes)
+        : fd(std::move(fd)), max_bytes(max_bytes) {}
+
+    // Returns a buffer which goes back into the pool when released.
+    std::shared_ptr<DumbBuffer> get(XY<int> size, int bpp) {
+        std::unique_ptr<DumbBuffer> buf;
+        {
+            std::scoped_lock const lock{mutex};
+            for (auto it = idle.rbegin(); it != idle.rend(); ++it) {
+                if ((*it)->image_size() == size && (*it)->bpp() == bpp) {
+                    buf = std::move(*it);
+                    idle.erase(std::next(it).base());
+                    idle_bytes -= buf->size();
+                    break;
+                }
+            }
+        }
+
+        if (buf) {
+            TRACE(logger, "  (reusing {}x{}x{} buffer)", size.x, size.y, bpp);
+        } else {
+            buf = std::make_unique<DumbBuffer>(fd, size, bpp);
+        }
+
+        std::weak_ptr<DumbBufferPool> const weak_pool = weak_from_this();
+        return {buf.release(), [weak_pool](DumbBuffer* released) {
+            std::unique_ptr<DumbBuffer> owned{released};
+            if (auto const pool = weak_pool.lock())
+                pool->recycle(std::move(owned));
+        }};
+    }
+
+    DumbBufferPool(DumbBufferPool const&) = delete;
+    DumbBufferPool& operator=(DumbBufferPool const&) = delete;
+
+  private:
+    std::shared_ptr<log::logger> const logger = display_logger();
+    std::shared_ptr<FileDescriptor> const fd;
+    size_t const max_bytes;
+
+    std::mutex mutex;
+    std::deque<std::unique_ptr<DumbBuffer>> idle;  // Oldest first
+    size_t idle_bytes = 0;
+
+    void recycle(std::unique_ptr<DumbBuffer> buf) {
+        size_t const bytes = buf->size();
+        if (bytes > max_bytes) return;  // Too big to keep, just free it
+
+        // Free evicted buffers outside the lock (they make ioctl calls).
+        std::deque<std::unique_ptr<DumbBuffer>> evicted;
+        {
+            std::scoped_lock const lock{mutex};
+            while (!idle.empty() && idle_bytes + bytes > max_bytes) {
+                idle_bytes -= idle.front()->size();
+                evicted.push_back(std::move(idle.front()));
+                idle.pop_front();
+            }
+            idle_bytes += bytes;
+            idle.push_back(std::move(buf));
+        }
+    }
+};
+
 class ImportedBuffer {
   public:
     ImportedBuffer(std::shared_ptr<FileDescriptor> drm_fd, int dma_fd) {
@@ -246,14 +345,20 @@ class ImportedBuffer {
     drm_prime_handle hdat = {};
 };
 
-class LoadedImageDef : public LoadedImage {
+// A DRM framebuffer for an image, holding its DMA-to-DRM imports open.
+// May be shared between LoadedImageDef objects via FramebufferCache.
+class Framebuffer {
   public:
-    LoadedImageDef(std::shared_ptr<FileDescriptor> fd, ImageBuffer image) {
-        im = std::move(image);
+    Framebuffer(
+        std::shared_ptr<FileDescriptor> fd,
+        ImageBuffer const& im,
+        std::vector<std::shared_ptr<ImportedBuffer>> imports
+    ) {
         CHECK_ARG(
             im.channels.size() <= 4,
             "Too many image channels ({}) for DRM", im.channels.size()
         );
+        ASSERT(imports.size() == im.channels.size());
 
         static_assert(std::extent_v<decltype(fdat.handles)> >= 4);
         fdat.width = im.size.x;
@@ -261,65 +366,241 @@ class LoadedImageDef : public LoadedImage {
         fdat.pixel_format = format_to_drm(im.fourcc);
         fdat.flags = DRM_MODE_FB_MODIFIERS;
 
-        // Keep DMA-to-DRM imports until the ADDFB2 call which will ref them.
-        std::vector<std::unique_ptr<ImportedBuffer>> imports;
         for (size_t ci = 0; ci < im.channels.size(); ++ci) {
             auto const& ch = im.channels[ci];
-            auto const dma_fd = ch.memory->dma_fd();
-            auto const drm_handle = ch.memory->drm_handle();
-            CHECK_ARG(dma_fd >= 0 || drm_handle, "No DMA handle (ch{})", ci);
-
             fdat.pitches[ci] = ch.stride;
             fdat.offsets[ci] = ch.offset;
             fdat.modifier[ci] = im.modifier;
-
-            // For the same memory buffer, reuse the handle & references.
-            for (size_t pci = 0; pci < ci; ++pci) {
-                if (ch.memory == im.channels[pci].memory) {
-                    ASSERT(fdat.handles[pci]);
-                    fdat.handles[ci] = fdat.handles[pci];
-                    break;
-                }
-            }
-
-            if (fdat.handles[ci]) continue;
-
-            if (drm_handle) {
-                fdat.handles[ci] = drm_handle;
-            } else {
-                auto imp = std::make_unique<ImportedBuffer>(fd, dma_fd);
-                fdat.handles[ci] = imp->drm_handle();
-                imports.push_back(std::move(imp));
-            }
+            fdat.handles[ci] = imports[ci]
+                ? imports[ci]->drm_handle() : ch.memory->drm_handle();
+            CHECK_ARG(fdat.handles[ci], "No DMA handle (ch{})", ci);
         }
 
         auto const logger = display_logger();
         this->fd = std::move(fd);
+        this->imports = std::move(imports);
         TRACE(logger, "Loading framebuffer...", debug(im));
         this->fd->ioc<DRM_IOCTL_MODE_ADDFB2>(&fdat).ex("DRM framebuffer");
         DEBUG(logger, "LOADED fb{} {}", fdat.fb_id, debug(im));
     }
 
-    ~LoadedImageDef() {
+    ~Framebuffer() {
         if (!fdat.fb_id) return;
         auto const logger = display_logger();
         (void) fd->ioc<DRM_IOCTL_MODE_RMFB>(&fdat.fb_id);
         TRACE(logger, "Unload fb{} {}x{}", fdat.fb_id, fdat.width, fdat.height);
     }
 
-    virtual uint32_t drm_id() const final { return fdat.fb_id; }
-    virtual uint32_t drm_format() const final { return fdat.pixel_format; }
+    uint32_t drm_id() const { return fdat.fb_id; }
+    uint32_t drm_format() const { return fdat.pixel_format; }
+
+    Framebuffer(Framebuffer const&) = delete;
+    Framebuffer& operator=(Framebuffer const&) = delete;
+
+  private:
+    std::shared_ptr<FileDescriptor> fd;
+    std::vector<std::shared_ptr<ImportedBuffer>> imports;
+    drm_mode_fb_cmd2 fdat = {};
+};
+
+// Keeps framebuffers (and DMA imports) for DMA buffers that were loaded
+// recently. Hardware decoders recycle a small set of buffers, so matching
+// buffers (by dma-buf inode and layout) can skip import and ADDFB2/RMFB.
+// *Internally synchronized* for multithreaded access.
+class FramebufferCache {
+  public:
+    FramebufferCache(
+        std::shared_ptr<UnixSystem> sys,
+        std::shared_ptr<FileDescriptor> fd,
+        DisplayDriverOptions const& options
+    ) : sys(std::move(sys)), fd(std::move(fd)),
+        max_idle(options.framebuffer_cache_size),
+        idle_time(options.framebuffer_cache_idle_time) {}
+
+    // Returns a framebuffer for the image, reusing a cached one if possible.
+    std::shared_ptr<Framebuffer const> get(ImageBuffer const& im) {
+        // Cache key: DMA buffer identity (by inode) and layout of each channel
+        Key key = {im.fourcc, im.modifier, im.size, {}};
+        std::vector<std::optional<DmaId>> dma_ids;
+        for (auto const& ch : im.channels) {
+            auto* id = &dma_ids.emplace_back();
+            auto const dma_fd = ch.memory->dma_fd();
+            if (dma_fd < 0 || ch.memory->drm_handle()) continue;
+            auto const st = sys->fstat(dma_fd).ex("Stat DMA buffer");
+            *id = DmaId{st.st_dev, st.st_ino};
+            key.channels.push_back({**id, ch.offset, ch.size, ch.stride});
+        }
+
+        // Only cache images made entirely of DMA buffers
+        if (key.channels.size() != im.channels.size()) key.channels.clear();
+
+        std::unique_lock lock{mutex};
+        auto const now = sys->clock(CLOCK_MONOTONIC);
+        expire_idle(now);
+
+        if (!key.channels.empty()) {
+            auto const it = cache.find(key);
+            if (it != cache.end()) {
+                TRACE(logger, "  (reusing fb{})", it->second.fb->drm_id());
+                it->second.use_time = now;
+                return it->second.fb;
+            }
+        }
+
+        // Import each distinct DMA buffer, sharing existing DRM handles
+        // (the kernel returns the same handle for repeat imports).
+        std::vector<std::shared_ptr<ImportedBuffer>> ch_imports;
+        for (size_t ci = 0; ci < im.channels.size(); ++ci) {
+            auto* imp = &ch_imports.emplace_back();
+            if (!dma_ids[ci]) continue;
+
+            auto* weak = &imports[*dma_ids[ci]];
+            *imp = weak->lock();
+            if (!*imp) {
+                auto const dma_fd = im.channels[ci].memory->dma_fd();
+                *imp = std::make_shared<ImportedBuffer>(fd, dma_fd);
+                *weak = *imp;
+            }
+        }
+
+        auto fb = std::make_shared<Framebuffer const>(
+            fd, im, std::move(ch_imports)
+        );
+
+        if (!key.channels.empty())
+            cache[std::move(key)] = {fb, now};
+        return fb;
+    }
+
+    FramebufferCache(FramebufferCache const&) = delete;
+    FramebufferCache& operator=(FramebufferCache const&) = delete;
+
+  private:
+    using DmaId = std::pair<dev_t, ino_t>;
+
+    struct Key {
+        uint32_t fourcc;
+        uint64_t modifier;
+        XY<int> size;
+        std::vector<std::tuple<DmaId, int, int, int>> channels;
+        auto operator<=>(Key const&) const = default;
+    };
+
+    struct Entry {
+        std::shared_ptr<Framebuffer const> fb;
+        double use_time = 0.0;
+    };
+
+    std::shared_ptr<log::logger> const logger = display_logger();
+    std::shared_ptr<UnixSystem> const sys;
+    std::shared_ptr<FileDescriptor> const fd;
+    size_t const max_idle;
+    double const idle_time;
+
+    std::mutex mutex;
+    std::map<Key, Entry> cache;
+    std::map<DmaId, std::weak_ptr<ImportedBuffer>> imports;
+
+    // Drops framebuffers nobody else uses that have aged out or overflowed.
+    // (Cached imports keep DMA buffers alive, so don't hold them forever.)
+    void expire_idle(double now) {
+        std::vector<std::map<Key, Entry>::iterator> idle;
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->second.fb.use_count() == 1) idle.push_back(it);
+        }
+
+        std::sort(idle.begin(), idle.end(), [](auto const& a, auto const& b) {
+            return a->second.use_time < b->second.use_time;
+        });
+
+        size_t excess = idle.size() > max_idle ? idle.size() - max_idle : 0;
+        for (auto const& it : idle) {
+            if (excess == 0 && now - it->second.use_time <= idle_time) break;
+            TRACE(logger, "  (expiring fb{})", it->second.fb->drm_id());
+            cache.erase(it);
+            if (excess > 0) --excess;
+        }
+
+        auto it = imports.begin();
+        while (it != imports.end())
+            it = it->second.expired() ? imports.erase(it) : std::next(it);
+    }
+};
+
+class LoadedImageDef : public LoadedImage {
+  public:
+    LoadedImageDef(std::shared_ptr<Framebuffer const> fb, ImageBuffer image)
+        : fb(std::move(fb)), im(std::move(image)) {}
+
+    virtual uint32_t drm_id() const final { return fb->drm_id(); }
+    virtual uint32_t drm_format() const final { return fb->drm_format(); }
     virtual ImageBuffer const& content() const { return im; }
 
     LoadedImageDef(LoadedImageDef const&) = delete;
     LoadedImageDef& operator=(LoadedImageDef const&) = delete;
 
   private:
-    std::shared_ptr<FileDescriptor> fd;
-    drm_mode_fb_cmd2 fdat = {};
+    std::shared_ptr<Framebuffer const> fb;
+    ImageBuffer im;
+};
+
+// Stand-in for a CPU-composited layer that hasn't been rendered yet,
+// used to estimate the display cost of flattening.
+class PlaceholderImage : public LoadedImage {
+  public:
+    PlaceholderImage(XY<int> size) {
+        im.fourcc = fourcc("rgbA");
+        im.size = size;
+        im.channels.resize(1);
+        im.channels[0].stride = size.x * 4;
+        im.channels[0].size = size.x * size.y * 4;
+    }
+
+    virtual uint32_t drm_id() const final { return 0; }
+    virtual ImageBuffer const& content() const { return im; }
+
+  private:
     ImageBuffer im;
 };
 
+bool is_overload(DisplayCost const& cost) {
+    return
+        cost.memory_bandwidth >= 1.0 ||
+        cost.compositor_bandwidth >= 1.0 ||
+        cost.line_buffer_memory >= 1.0;
+}
+
+double peak_load(DisplayCost const& cost) {
+    return std::max({
+        cost.memory_bandwidth,
+        cost.compositor_bandwidth,
+        cost.line_buffer_memory
+    });
+}
+
+// Summarizes what matters for display hardware acceptance of a frame
+// (mode, formats, scaling, rotation, blending, plane count), ignoring
+// positions and image contents, to key cached validate() verdicts.
+std::vector<int64_t> frame_shape(uint32_t screen_id, DisplayFrame const& f) {
+    std::vector<int64_t> shape = {
+        screen_id, f.mode.size.x, f.mode.size.y, f.mode.nominal_hz
+    };
+
+    for (auto const& layer : visible_layers(f)) {
+        auto const& im = layer.image->content();
+        auto const format = layer.image->drm_format();
+        shape.push_back(format ? format : format_to_drm(im.fourcc));
+        shape.push_back(im.modifier);
+        auto const& from = layer.from_size;
+        shape.push_back(std::lround(1024 * from.x / layer.to_size.x));
+        shape.push_back(std::lround(1024 * from.y / layer.to_size.y));
+        shape.push_back(layer.rotate);
+        shape.push_back(layer.reflect);
+        shape.push_back(layer.opacity < 1.0);
+    }
+    return shape;
+}
+
 //
 // DisplayDriver implementation
 //
@@ -328,6 +609,26 @@ class DisplayDriverDef : public DisplayDriver {
   public:
     DisplayDriverDef() {}
 
+    virtual ~DisplayDriverDef() {
+        std::unique_lock lock{mutex};
+        if (event_thread_handle.joinable()) {
+            DEBUG(logger, "Stopping display event thread...");
+            event_shutdown = true;
+            lock.unlock();
+            event_wakeup->set();
+            event_thread_handle.join();
+        }
+
+        std::unique_lock writeback_lock{writeback_mutex};
+        if (writeback_thread_handle.joinable()) {
+            DEBUG(logger, "Stopping writeback thread...");
+            writeback_shutdown = true;
+            writeback_lock.unlock();
+            writeback_wakeup->set();
+            writeback_thread_handle.join();
+        }
+    }
+
     virtual std::vector<DisplayScreen> scan_screens() final {
         TRACE(logger, "Scanning screens...");
         std::vector<DisplayScreen> out;
@@ -398,7 +699,7 @@ class DisplayDriverDef : public DisplayDriver {
                     debug_size(chan->offset)
                 );
 
-                auto buf = std::make_shared<DumbBuffer>(fd, im.size, 32);
+                auto buf = buffer_pool->get(im.size, 32);
                 uint8_t const* read_from = chan->memory->read() + chan->offset;
                 uint8_t* write_to = buf->write();
                 for (int y = 0; y < h; ++y) {
@@ -449,7 +750,7 @@ class DisplayDriverDef : public DisplayDriver {
                     pchan.memory->read() + pchan.offset, pal
                 );
 
-                auto buf = std::make_shared<DumbBuffer>(fd, im.size, 32);
+                auto buf = buffer_pool->get(im.size, 32);
                 uint8_t const* read_from = chan->memory->read() + chan->offset;
                 uint8_t* write_to = buf->write();
                 for (int y = 0; y < h; ++y) {
@@ -487,8 +788,8 @@ class DisplayDriverDef : public DisplayDriver {
                 if (!total_space) break;  // No copying needed.
                 auto const start_mt = sys->clock(CLOCK_MONOTONIC);
                 auto const pixels = im.size.x * im.size.y;
-                auto copy = std::make_shared<DumbBuffer>(
-                    fd, im.size, (8 * total_space + pixels - 1) / pixels
+                auto copy = buffer_pool->get(
+                    im.size, (8 * total_space + pixels - 1) / pixels
                 );
 
                 CHECK_RUNTIME(
@@ -521,157 +822,1056 @@ class DisplayDriverDef : public DisplayDriver {
             }
         }
 
-        return std::make_unique<LoadedImageDef>(fd, std::move(im));
+        auto fb = framebuffer_cache->get(im);
+        return std::make_unique<LoadedImageDef>(std::move(fb), std::move(im));
     }
 
-    virtual DisplayUpdated update(
-        uint32_t screen_id, DisplayFrame const& frame
+    virtual std::future<DisplayUpdated> request_update(
+        uint32_t screen_id, DisplayFrame const& in_frame
     ) final {
         auto* const conn = &connectors.at(screen_id);
-        auto cost = predict_cost(frame);
+        auto const flat_frame = prepare_frame(conn, in_frame);
+        auto const* frame = flat_frame ? &*flat_frame : &in_frame;
 
-        if (
-            cost.memory_bandwidth >= 1.0 ||
-            cost.compositor_bandwidth >= 1.0 ||
-            cost.line_buffer_memory >= 1.0
-        ) {
-            logger->warn(
-                "Predicted overload {} {}l mbw={:.0f}% cbw={:.0f}% lbm={:.0f}%",
-                conn->name, frame.layers.size(), cost.memory_bandwidth * 100,
-                cost.compositor_bandwidth * 100, cost.line_buffer_memory * 100
-            );
-            for (auto const& layer : frame.layers) {
-                auto const layer_cost = predict_cost({frame.mode, {layer}});
-                logger->warn(
-                    "  {:4.1f}%m {:4.1f}%c {:4.1f}%l {}",
-                    layer_cost.memory_bandwidth * 100,
-                    layer_cost.compositor_bandwidth * 100,
-                    layer_cost.line_buffer_memory * 100,
-                    debug(layer)
-                );
-            }
-        } else {
-            DEBUG(
-                logger, "UPDATE {} {}l mbw={:.0f}% cbw={:.0f}% lbm={:.0f}%",
-                conn->name, frame.layers.size(), cost.memory_bandwidth * 100,
-                cost.compositor_bandwidth * 100, cost.line_buffer_memory * 100
+        auto waiter = std::make_shared<FlipWaiter>();
+        auto future = waiter->promise.get_future();
+        std::unique_lock lock{mutex};
+        start_or_queue(lock, {{conn, frame}}, std::move(waiter));
+        return future;
+    }
+
+    virtual std::future<std::map<uint32_t, DisplayUpdated>>
+    request_group_update(
+        std::map<uint32_t, DisplayFrame> const& in_frames
+    ) final {
+        std::vector<std::optional<DisplayFrame>> flat_frames;
+        flat_frames.reserve(in_frames.size());  // Pointers below stay valid
+        std::vector<std::pair<Connector*, DisplayFrame const*>> frames;
+        for (auto const& [screen_id, in_frame] : in_frames) {
+            auto* const conn = &connectors.at(screen_id);
+            auto const& flat = flat_frames.emplace_back(
+                prepare_frame(conn, in_frame)
             );
+            frames.emplace_back(conn, flat ? &*flat : &in_frame);
         }
 
-        for (auto const& warning : frame.warnings)
-            logger->warn("{} {}", conn->name, warning);
-
+        auto waiter = std::make_shared<FlipWaiter>();
+        waiter->group = true;
+        auto future = waiter->group_promise.get_future();
         std::unique_lock lock{mutex};
-        auto* crtc = conn->using_crtc;
-        CHECK_ARG(
-            !crtc || !crtc->pending_flip,
-            "Update requested before prev done"
-        );
-
-        if (!crtc) {
-            if (!frame.mode.nominal_hz) {
-                DEBUG(logger, "  ({} was off, staying off)", conn->name);
-                return {};
-            }
-
-            for (auto* const c : conn->usable_crtcs) {
-                if (c->used_by_conn) continue;
-                ASSERT(!c->pending_flip);
-                crtc = c;
-                break;
-            }
+        start_or_queue(lock, frames, std::move(waiter));
+        return future;
+    }
 
-            CHECK_RUNTIME(crtc, "No DRM CRTC: {}", conn->name);
+    virtual size_t validate(
+        uint32_t screen_id, DisplayFrame const& frame
+    ) final {
+        auto* const conn = &connectors.at(screen_id);
+        auto const count = frame.layers.size();
+        if (test_frame(conn, frame)) return count;
+
+        // Find the longest accepted prefix (fewer layers never hurt)
+        size_t good = 0, bad = count;
+        while (bad - good > 1) {
+            auto const mid = good + (bad - good) / 2;
+            DisplayFrame prefix = {frame.mode, {}};
+            auto const& layers = frame.layers;
+            prefix.layers.assign(layers.begin(), layers.begin() + mid);
+            (test_frame(conn, prefix) ? good : bad) = mid;
         }
 
-        // Build the atomic update and the state that will result.
-        std::map<uint32_t, std::map<PropId const*, uint64_t>> props;
-        std::shared_ptr<uint32_t const> mode_blob;
-        Crtc::State next = {};
-        int32_t writeback_fd = -1;
-
-        ASSERT(crtc);
-        if (!frame.mode.nominal_hz) {
-            DEBUG(logger, "  ({} turning off)", conn->name);
-            props[conn->id][&conn->CRTC_ID] = 0;
-            props[crtc->id][&crtc->ACTIVE] = 0;
-            props[crtc->id][&crtc->MODE_ID] = 0;
-            // Leave next state zeroed (disassociate CRTC).
-        } else {
-            next.mode = mode_to_drm(frame.mode);
-            static_assert(sizeof(crtc->active.mode) == sizeof(next.mode));
-            if (memcmp(&crtc->active.mode, &next.mode, sizeof(next.mode))) {
-                DEBUG(logger, "  {}: {}", conn->name, debug(frame.mode));
-                if (frame.mode.nominal_hz) mode_blob = create_blob(next.mode);
-                props[crtc->id][&crtc->ACTIVE] = frame.mode.nominal_hz ? 1 : 0;
-                props[crtc->id][&crtc->MODE_ID] = mode_blob ? *mode_blob : 0;
-            }
-
-            if (conn->WRITEBACK_FB_ID.prop_id) {
-                XY<int> const size = {next.mode.hdisplay, next.mode.vdisplay};
-                auto buf = std::make_shared<DumbBuffer>(fd, size, 32);
+        logger->warn(
+            "{} accepts {} of {} layers: {}",
+            conn->name, good, count, debug(frame.mode)
+        );
+        return good;
+    }
 
-                Writeback wb = {};
-                wb.image.fourcc = fourcc("RGBA");
-                wb.image.size = size;
-                wb.image.channels.resize(1);
-                wb.image.channels[0].stride = buf->stride();
-                wb.image.channels[0].memory = std::move(buf);
-                wb.fb_id = load_image(wb.image);
-
-                int const id = wb.fb_id->drm_id();
-                DEBUG(logger, "  writeback: fb{} {}", id, debug(wb.image));
-                next.writeback = std::move(wb);
-                props[conn->id][&conn->WRITEBACK_FB_ID] = id;
-                props[conn->id][&conn->WRITEBACK_OUT_FENCE_PTR] =
-                    (uint64_t) &writeback_fd;
-            }
+    virtual DisplayCost predict_cost(DisplayFrame const& frame) const final {
+        return estimate_cost(cost_model, frame);
+    }
 
-            if (!conn->using_crtc || next.writeback) {
-                props[conn->id][&conn->CRTC_ID] = crtc->id;
-                props[crtc->id][&crtc->ACTIVE] = 1;
-            }
+    void open(
+        std::shared_ptr<UnixSystem> sys,
+        std::string const& dev,
+        DisplayDriverOptions const& options
+    ) {
+        logger->info("Opening display \"{}\"...", dev);
+        this->options = options;
+        this->sys = std::move(sys);
+        fd = this->sys->open(dev.c_str(), O_RDWR).ex(dev);
+        buffer_pool = std::make_shared<DumbBufferPool>(
+            fd, options.buffer_pool_bytes
+        );
+        framebuffer_cache = std::make_unique<FramebufferCache>(
+            this->sys, fd, options
+        );
+        if (options.software_fallback)
+            compositor = start_software_compositor(this->sys);
+        try {
+            fd->ioc<DRM_IOCTL_SET_MASTER>().ex("DRM master mode");
+        } catch (std::system_error const& e) {
+            logger->error("{}", e.what());
+            // Continue, though something will probably fail later
+        }
 
-            int first_plane = true;
-            auto plane_iter = crtc->usable_planes.begin();
-            for (auto const& layer : frame.layers) {
-                // Don't send invisible layers to the compositor
-                // TODO: Also detect layers positioned fully off-screen?
-                if (!layer.to_size || layer.opacity <= 0) continue;
+        fd->ioc<DRM_IOCTL_SET_CLIENT_CAP>(
+            drm_set_client_cap{DRM_CLIENT_CAP_ATOMIC, 1}
+        ).ex("Enable DRM atomic modesetting");
+        fd->ioc<DRM_IOCTL_SET_CLIENT_CAP>(
+            drm_set_client_cap{DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1}
+        ).ex("Enable DRM universal planes");
+        fd->ioc<DRM_IOCTL_SET_CLIENT_CAP>(
+            drm_set_client_cap{DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1}
+        ).ex("Enable DRM universal planes");
 
-                // Find an appropriate plane (Primary=1, Overlay=0)
-                uint64_t const wanted_type = first_plane ? 1 : 0;
-                for (;; ++plane_iter) {
-                    CHECK_RUNTIME(
-                        plane_iter != crtc->usable_planes.end(),
-                        "No DRM plane: {}", conn->name
-                    );
+        std::vector<char> name;
+        drm_version ver = {};
+        do {
+            fd->ioc<DRM_IOCTL_VERSION>(&ver).ex("Get version");
+        } while (size_vec(&ver.name, &ver.name_len, &name));
+        std::string const driver_name(name.begin(), name.end());
+        cost_model = options.cost_model.value_or(
+            default_cost_model(driver_name)
+        );
+        if (cost_model.driver != driver_name) {
+            logger->warn(
+                "Cost model for \"{}\" used with \"{}\" driver",
+                cost_model.driver, driver_name
+            );
+        }
 
-                    auto const* plane = (*plane_iter);
-                    auto const type = plane->type.init_value;
-                    auto const* used_by = plane->used_by_crtc;
-                    if (type == wanted_type && (used_by == crtc || !used_by))
-                        break;
+        drm_mode_card_res res = {};
+        std::vector<uint32_t> crtc_ids, conn_ids;
+        do {
+            res.count_fbs = res.count_encoders = 0;  // Don't use these.
+            fd->ioc<DRM_IOCTL_MODE_GETRESOURCES>(&res).ex("DRM resources");
+        } while (
+            size_vec(&res.crtc_id_ptr, &res.count_crtcs, &crtc_ids) +
+            size_vec(&res.connector_id_ptr, &res.count_connectors, &conn_ids)
+        );
 
-                    // Disable any plane no longer used by this CRTC
-                    if (used_by == crtc) {
-                        DEBUG(logger, "  pl{}: disable (skipped)", plane->id);
-                        auto* plane_props = &props[plane->id];
-                        (*plane_props)[&plane->CRTC_ID] = 0;
-                        (*plane_props)[&plane->FB_ID] = 0;
-                    }
-                }
+        for (auto const crtc_id : crtc_ids) {
+            drm_mode_crtc ccdat = {};
+            ccdat.crtc_id = crtc_id;
+            fd->ioc<DRM_IOCTL_MODE_GETCRTC>(&ccdat).ex("DRM CRTC");
 
-                first_plane = false;
-                auto* plane = *plane_iter++;
-                int const fb_id = layer.image->drm_id();
-                next.using_planes.push_back(plane);
-                next.images.push_back(layer.image);
+            auto* crtc = &crtcs[crtc_id];
+            crtc->id = crtc_id;
+            lookup_required_prop_ids(crtc_id, &crtc->prop_ids);
+            if (ccdat.mode_valid)  // Round-trip to ensure struct memcmp().
+                crtc->active.mode = mode_to_drm(mode_from_drm(ccdat.mode));
+        }
 
-                DEBUG(logger, "  pl{}: {}", plane->id, debug(layer));
-                auto* plane_props = &props[plane->id];
-                (*plane_props)[&plane->CRTC_ID] = crtc->id;
-                (*plane_props)[&plane->FB_ID] = fb_id;
+        for (auto const conn_id : conn_ids) {
+            drm_mode_get_connector cdat = {};
+            cdat.connector_id = conn_id;
+            std::vector<uint32_t> enc_ids;
+            do {
+                cdat.count_props = cdat.count_modes = 0;
+                fd->ioc<DRM_IOCTL_MODE_GETCONNECTOR>(&cdat).ex("DRM conn");
+            } while (
+                size_vec(&cdat.encoders_ptr, &cdat.count_encoders, &enc_ids)
+            );
+
+            auto* conn = &connectors[conn_id];
+            conn->id = conn_id;
+            lookup_required_prop_ids(conn_id, &conn->prop_ids);
+            lookup_prop_ids(conn_id, &conn->opt_ids);
+            switch (cdat.connector_type) {
+                case DRM_MODE_CONNECTOR_HDMIA: conn->name = "HDMI"; break;
+#define T(x) case DRM_MODE_CONNECTOR_##x: conn->name = #x; break
+                T(Unknown);
+                T(VGA);
+                T(DVII);
+                T(DVID);
+                T(DVIA);
+                T(Composite);
+                T(SVIDEO);
+                T(LVDS);
+                T(Component);
+                T(9PinDIN);
+                T(DisplayPort);
+                T(HDMIB);
+                T(TV);
+                T(eDP);
+                T(VIRTUAL);
+                T(DSI);
+                T(DPI);
+                T(WRITEBACK);
+                T(SPI);
+                T(USB);
+#undef T
+                default: conn->name = fmt::format("[#{}]", cdat.connector_type);
+            }
+            conn->name += fmt::format("-{}", cdat.connector_type_id);
+
+            for (auto const enc_id : enc_ids) {
+                drm_mode_get_encoder edat = {};
+                edat.encoder_id = enc_id;
+                fd->ioc<DRM_IOCTL_MODE_GETENCODER>(&edat).ex("DRM encoder");
+                for (size_t i = 0; i < crtc_ids.size(); ++i) {
+                    if (edat.possible_crtcs & (1 << i)) {
+                        auto* const crtc = &crtcs.at(crtc_ids[i]);
+                        conn->usable_crtcs.push_back(crtc);
+                    }
+                }
+            }
+
+            if (conn->CRTC_ID.init_value) {
+                auto *crtc = &crtcs.at(conn->CRTC_ID.init_value);
+                conn->using_crtc = crtc;
+                crtc->used_by_conn = conn;
+            }
+        }
+
+        drm_mode_get_plane_res pres = {};
+        std::vector<uint32_t> plane_ids;
+        do {
+            fd->ioc<DRM_IOCTL_MODE_GETPLANERESOURCES>(&pres).ex("DRM planes");
+        } while (size_vec(&pres.plane_id_ptr, &pres.count_planes, &plane_ids));
+
+        for (auto const plane_id : plane_ids) {
+            drm_mode_get_plane pdat = {};
+            pdat.plane_id = plane_id;
+            fd->ioc<DRM_IOCTL_MODE_GETPLANE>(&pdat).ex("DRM plane");
+
+            auto* plane = &planes[plane_id];
+            plane->id = plane_id;
+            lookup_required_prop_ids(plane_id, &plane->prop_ids);
+            lookup_prop_ids(plane_id, &plane->opt_ids);
+            for (size_t i = 0; i < crtc_ids.size(); ++i) {
+                if (pdat.possible_crtcs & (1 << i))
+                    crtcs[crtc_ids[i]].usable_planes.push_back(plane);
+            }
+
+            if (plane->IN_FORMATS.init_value) {
+                drm_mode_get_blob bdat = {};
+                bdat.blob_id = plane->IN_FORMATS.init_value;
+                std::vector<uint8_t> blob_data;
+                do {
+                    fd->ioc<DRM_IOCTL_MODE_GETPROPBLOB>(&bdat).ex("DRM blob");
+                } while (size_vec(&bdat.data, &bdat.length, &blob_data));
+
+                auto const* blob_bytes = blob_data.data();
+                auto const* blob = (drm_format_modifier_blob const*) blob_bytes;
+                if (blob->version == FORMAT_BLOB_CURRENT) {
+                    auto const* fmt_bytes = blob_bytes + blob->formats_offset;
+                    auto const* fmts = (uint32_t const*) fmt_bytes;
+                    plane->formats.insert(fmts, fmts + blob->count_formats);
+                }
+            }
+        }
+
+        DEBUG(
+            logger, "  opened fd={}: {} planes, {} crtcs, {} screen connectors",
+            fd->raw_fd(), planes.size(), crtcs.size(), connectors.size()
+        );
+
+        event_wakeup = this->sys->make_flag();
+        event_thread_handle = std::thread(
+            &DisplayDriverDef::event_thread, this
+        );
+
+        if (options.capture_sink) {
+            writeback_wakeup = this->sys->make_flag();
+            writeback_thread_handle = std::thread(
+                &DisplayDriverDef::writeback_thread, this
+            );
+        }
+    }
+
+    DisplayDriverDef(DisplayDriverDef const&) = delete;
+    DisplayDriverDef& operator=(DisplayDriverDef const&) = delete;
+
+  private:
+    struct PropId {
+        using Map = std::map<std::string_view, PropId*>;
+        PropId(std::string_view n, Map* map) : name(n) { (*map)[n] = this; }
+        std::string_view name;
+        uint32_t prop_id = 0;     // Filled by open() -> lookup_prop_ids()
+        uint64_t init_value = 0;  // The property value at open() time
+    };
+
+    struct Writeback {
+        std::shared_ptr<LoadedImage> fb;  // From Connector::writeback_ring
+        std::shared_ptr<FileDescriptor> fence;
+    };
+
+    // A finished flip whose writeback may still be in progress
+    struct PendingCapture {
+        DisplayCapture capture;
+        std::shared_ptr<FileDescriptor> fence;
+    };
+
+    // Completion of an update, shared by the CRTCs its commit flips
+    struct FlipWaiter {
+        bool group = false;  // Fulfill group_promise (else promise)
+        std::promise<DisplayUpdated> promise;
+        std::promise<std::map<uint32_t, DisplayUpdated>> group_promise;
+        std::map<uint32_t, DisplayUpdated> flips;  // By screen, as they land
+        size_t pending = 0;                        // CRTCs yet to flip
+        bool done = false;
+
+        void keep() {
+            if (done) return;
+            done = true;
+            if (group) {
+                group_promise.set_value(std::move(flips));
+            } else {
+                ASSERT(flips.size() == 1);
+                promise.set_value(flips.begin()->second);
+            }
+        }
+
+        void fail(std::exception_ptr error) {
+            if (done) return;
+            done = true;
+            if (group) {
+                group_promise.set_exception(error);
+            } else {
+                promise.set_exception(error);
+            }
+        }
+    };
+
+    // An update held until pending flips on its CRTCs are done
+    struct Connector;
+    struct QueuedUpdate {
+        std::vector<std::pair<Connector*, DisplayFrame>> frames;
+        std::shared_ptr<FlipWaiter> waiter;
+    };
+
+    struct Crtc;
+    struct Plane {
+        // Constant from setup to ~
+        uint32_t id = 0;
+        std::set<uint32_t> formats;
+        PropId::Map prop_ids, opt_ids;
+        PropId alpha{"alpha", &opt_ids};
+        PropId CRTC_ID{"CRTC_ID", &prop_ids};
+        PropId CRTC_X{"CRTC_X", &prop_ids};
+        PropId CRTC_Y{"CRTC_Y", &prop_ids};
+        PropId CRTC_W{"CRTC_W", &prop_ids};
+        PropId CRTC_H{"CRTC_H", &prop_ids};
+        PropId FB_ID{"FB_ID", &prop_ids};
+        PropId IN_FORMATS{"IN_FORMATS", &prop_ids};
+        PropId rotation{"rotation", &opt_ids};
+        PropId SRC_X{"SRC_X", &prop_ids};
+        PropId SRC_Y{"SRC_Y", &prop_ids};
+        PropId SRC_W{"SRC_W", &prop_ids};
+        PropId SRC_H{"SRC_H", &prop_ids};
+        PropId type{"type", &prop_ids};
+
+        // Guarded by DisplayDriverDef::mutex
+        Crtc* used_by_crtc = nullptr;
+    };
+
+    struct Crtc {
+        struct State {
+            std::vector<Plane*> using_planes;
+            std::vector<std::shared_ptr<LoadedImage>> images;
+            drm_mode_modeinfo mode = {};
+            std::optional<Writeback> writeback;
+            std::map<uint32_t, std::map<PropId const*, uint64_t>> plane_props;
+        };
+
+        // Constant from setup to ~
+        uint32_t id = 0;
+        std::vector<Plane*> usable_planes;
+        PropId::Map prop_ids;
+        PropId ACTIVE{"ACTIVE", &prop_ids};
+        PropId MODE_ID{"MODE_ID", &prop_ids};
+
+        // Guarded by DisplayDriverDef::mutex
+        Connector* used_by_conn = nullptr;
+        State active;
+        std::optional<State> pending_flip;
+        std::shared_ptr<FlipWaiter> pending_waiter;  // Kept at flip
+        std::shared_ptr<QueuedUpdate> queued;  // Started after pending flips
+    };
+
+    struct Connector {
+        // Constant from setup to ~
+        uint32_t id = 0;
+        std::string name;
+        std::vector<Crtc*> usable_crtcs;
+        PropId::Map prop_ids, opt_ids;
+        PropId CRTC_ID{"CRTC_ID", &prop_ids};
+        PropId WRITEBACK_FB_ID{"WRITEBACK_FB_ID", &opt_ids};
+        PropId WRITEBACK_OUT_FENCE_PTR{"WRITEBACK_OUT_FENCE_PTR", &opt_ids};
+
+        // Guarded by DisplayDriverDef::mutex
+        Crtc* using_crtc = nullptr;
+        std::vector<std::shared_ptr<LoadedImage>> writeback_ring;
+
+        std::mutex flat_mutex;  // Guard for below (held while compositing)
+        std::vector<DisplayLayer> flat_inputs;  // Layers last composited
+        std::shared_ptr<LoadedImage> flat_image;
+        XY<int> flat_origin;
+        std::vector<DisplayLayer> last_layers;  // Visible in the last request
+    };
+
+    // An atomic update being built (see build_commit())
+    struct Commit {
+        std::map<uint32_t, std::map<PropId const*, uint64_t>> props;
+        std::shared_ptr<uint32_t const> mode_blob;
+        Crtc::State next = {};
+        int32_t writeback_fd = -1;  // Written by the kernel during commit
+    };
+
+    // These containers are constant after startup (contained objects change)
+    std::shared_ptr<log::logger> const logger = display_logger();
+    DisplayDriverOptions options;
+    std::shared_ptr<UnixSystem> sys;
+    std::shared_ptr<FileDescriptor> fd;
+    std::shared_ptr<DumbBufferPool> buffer_pool;
+    std::unique_ptr<FramebufferCache> framebuffer_cache;
+    std::unique_ptr<SoftwareCompositor> compositor;  // For software_fallback
+
+    std::mutex mutex;  // Guard for dynamic properties of objects below
+    std::map<uint32_t, Plane> planes;
+    std::map<uint32_t, Crtc> crtcs;
+    std::map<uint32_t, Connector> connectors;
+    std::map<uint32_t, std::string> prop_names;
+    uint64_t update_sequence = 0;
+    bool event_shutdown = false;
+    struct Verdict { bool valid; uint64_t used; };  // From test_frame()
+    std::map<std::vector<int64_t>, Verdict> verdicts;  // LRU by shape
+    uint64_t verdict_uses = 0;
+    static constexpr size_t max_verdicts = 4096;
+
+    // Constant from open() to ~
+    DisplayCostModel cost_model;
+    std::thread event_thread_handle;
+    std::unique_ptr<SyncFlag> event_wakeup;
+    std::thread writeback_thread_handle;  // Only if options.capture_sink
+    std::unique_ptr<SyncFlag> writeback_wakeup;
+
+    std::mutex writeback_mutex;  // Guard for the writeback queue
+    std::deque<PendingCapture> writeback_queue;
+    bool writeback_shutdown = false;
+
+    // Counts the planes a screen could use (or SIZE_MAX if unknown).
+    size_t plane_budget(Connector const* conn) {
+        std::unique_lock const lock{mutex};
+        Crtc const* crtc = choose_crtc(lock, conn);
+        if (!crtc) return SIZE_MAX;
+
+        size_t count = 0;
+        for (auto const* plane : crtc->usable_planes) {
+            if (!plane->used_by_crtc || plane->used_by_crtc == crtc) ++count;
+        }
+        return count;
+    }
+
+    // Tests a frame as request_update() would commit it (after any software
+    // fallback, planned as if the frame were held on screen, so the plan
+    // depends only on the frame), with a test-only commit. Hardware rejections
+    // are cached by frame shape; transient errors (like EBUSY) count as
+    // accepted. The kernel is called without holding the driver mutex.
+    bool test_frame(Connector* conn, DisplayFrame const& frame) {
+        DisplayFrame test = {frame.mode, visible_layers(frame)};
+        std::optional<FramePlan> plan;
+        if (options.software_fallback) {
+            auto const& static_layers = test.layers;
+            auto const cost = predict_cost(test);
+            plan = plan_frame(conn, test, cost, static_layers);
+            if (plan->changed) {
+                auto placeholder =
+                    std::make_shared<PlaceholderImage>(plan->flat_size);
+                test = planned_frame(test, *plan, std::move(placeholder));
+            }
+        }
+
+        auto const shape = frame_shape(conn->id, test);
+        std::unique_lock lock{mutex};
+        auto const cached = verdicts.find(shape);
+        if (cached != verdicts.end()) {
+            cached->second.used = ++verdict_uses;
+            return cached->second.valid;
+        }
+
+        if (plan && plan->flat_begin < plan->flat_end) {
+            // Test with a real framebuffer in place of the placeholder
+            lock.unlock();
+            auto const size = plan->flat_size;
+            auto buf = buffer_pool->get(size, 32);
+            auto flat = load_image(flat_buffer(size, std::move(buf)));
+            test.layers[plan->flat_begin].image = std::move(flat);
+            lock.lock();
+        }
+
+        auto* const crtc = choose_crtc(lock, conn);
+        if (!crtc) return !frame.mode.nominal_hz;
+
+        bool valid = true;
+        try {
+            Commit commit = {};
+            build_commit(lock, conn, crtc, test, true, {}, &commit);
+            if (!commit.props.empty()) {
+                lock.unlock();  // Don't hold up flips and updates
+                uint32_t const flags =
+                    DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET;
+                auto const result = submit_commit(commit, flags, 0);
+                lock.lock();
+                if (result.err) {
+                    auto const err = result.err;
+                    DEBUG(logger, "{} test failed (err={})", conn->name, err);
+                    if (err != EINVAL && err != ERANGE) return true;
+                    valid = false;
+                }
+            }
+        } catch (std::runtime_error const& e) {
+            if (!lock.owns_lock()) lock.lock();
+            DEBUG(logger, "{} test failed: {}", conn->name, e.what());
+            valid = false;
+        }
+
+        if (verdicts.size() >= max_verdicts) {
+            auto lru = verdicts.begin();
+            for (auto it = verdicts.begin(); it != verdicts.end(); ++it) {
+                if (it->second.used < lru->second.used) lru = it;
+            }
+            verdicts.erase(lru);
+        }
+
+        verdicts[shape] = {valid, ++verdict_uses};
+        if (!valid) {
+            logger->warn(
+                "{} rejects {}l frame shape: {}",
+                conn->name, test.layers.size(), debug(frame.mode)
+            );
+        }
+        return valid;
+    }
+
+    // How a frame is fitted to the hardware by flatten_if_overloaded():
+    // a run of layers composited on the CPU, or topmost layers dropped
+    // (only when out of planes).
+    struct FramePlan {
+        std::vector<DisplayLayer> layers;  // Visible layers of the frame
+        size_t flat_begin = 0, flat_end = 0;  // Run to composite, if any
+        XY<int> flat_origin, flat_size;       // Screen area of the run
+        size_t keep = 0;                      // Layers kept, if dropping
+        bool changed = false;                 // Not shown as given
+        DisplayCost cost;                     // Of the planned frame
+    };
+
+    // Plans for a frame that would overload the display (or run out of
+    // planes): replace the run of layers that best relieves the load with
+    // one CPU-composited layer. Only runs unchanged since the previous frame
+    // (static layers) are considered, so the composited image is reused from
+    // frame to frame. If no such run helps, an overloaded frame is left as-is,
+    // and layers beyond the available planes are dropped.
+    FramePlan plan_frame(
+        Connector const* conn, DisplayFrame const& frame, DisplayCost cost,
+        std::vector<DisplayLayer> const& last_layers
+    ) {
+        FramePlan plan = {};
+        plan.layers = visible_layers(frame);
+        plan.cost = cost;
+        auto const& layers = plan.layers;
+        size_t const planes = plane_budget(conn);
+        if (!is_overload(cost) && layers.size() <= planes) return plan;
+
+        // Try each run of static compositable layers, preferring the least
+        // CPU work among runs that fit in the hardware, else the lowest peak
+        // load. (Compositing changing content on every frame would load the
+        // CPU on the player's critical path.)
+        struct Candidate {
+            size_t begin = 0, end = 0;
+            XY<int> origin, size;
+            DisplayCost cost;
+            bool fits = false;
+            double work = 0.0;
+        };
+
+        std::optional<Candidate> best;
+        for (size_t begin = 0; begin < layers.size(); ++begin) {
+            XY<int> lo = frame.mode.size, hi = {0, 0};
+            double work = 0.0;
+            for (size_t end = begin + 1; end <= layers.size(); ++end) {
+                auto const& layer = layers[end - 1];
+                if (!can_composite(layer)) break;
+                auto const last_it =
+                    std::find(last_layers.begin(), last_layers.end(), layer);
+                if (last_it == last_layers.end()) break;  // Changed
+
+                auto const layer_end = layer.to_xy + layer.to_size;
+                auto const& screen = frame.mode.size;
+                lo.x = std::max(0, std::min(lo.x, layer.to_xy.x));
+                lo.y = std::max(0, std::min(lo.y, layer.to_xy.y));
+                hi.x = std::min(screen.x, std::max(hi.x, layer_end.x));
+                hi.y = std::min(screen.y, std::max(hi.y, layer_end.y));
+                work += double(layer.to_size.x) * layer.to_size.y;
+                if (hi.x <= lo.x || hi.y <= lo.y) continue;
+
+                Candidate c = {};
+                c.begin = begin;
+                c.end = end;
+                c.origin = lo;
+                c.size = hi - lo;
+
+                FramePlan trial_plan = plan;
+                trial_plan.flat_begin = begin;
+                trial_plan.flat_end = end;
+                trial_plan.flat_origin = c.origin;
+                trial_plan.flat_size = c.size;
+                auto const placeholder =
+                    std::make_shared<PlaceholderImage>(c.size);
+                auto const trial = planned_frame(
+                    frame, trial_plan, placeholder
+                );
+
+                c.cost = predict_cost(trial);
+                c.fits = !is_overload(c.cost) && trial.layers.size() <= planes;
+                c.work = work;
+                if (
+                    !best ||
+                    (c.fits && (!best->fits || c.work < best->work)) ||
+                    (!c.fits && !best->fits &&
+                        peak_load(c.cost) < peak_load(best->cost))
+                ) {
+                    best = c;
+                }
+            }
+        }
+
+        bool const helps = best &&
+            (best->fits || peak_load(best->cost) < peak_load(cost));
+        if (!helps) {
+            // Bandwidth overload is only warned about (see prepare_frame()),
+            // but layers beyond the planes can't be shown at all
+            if (layers.size() <= planes) return plan;
+            plan.changed = true;
+            plan.keep = planes;
+            plan.cost = predict_cost({frame.mode, {
+                layers.begin(), layers.begin() + planes
+            }});
+            return plan;
+        }
+
+        plan.changed = true;
+        plan.flat_begin = best->begin;
+        plan.flat_end = best->end;
+        plan.flat_origin = best->origin;
+        plan.flat_size = best->size;
+        plan.cost = best->cost;
+        return plan;
+    }
+
+    // Returns the frame a plan produces, given the run's composited image.
+    static DisplayFrame planned_frame(
+        DisplayFrame const& frame, FramePlan const& plan,
+        std::shared_ptr<LoadedImage> flat_image
+    ) {
+        auto const& layers = plan.layers;
+        DisplayFrame out = {frame.mode, {}, frame.warnings};
+        if (plan.flat_begin == plan.flat_end) {
+            out.layers.assign(layers.begin(), layers.begin() + plan.keep);
+            out.warnings.push_back(fmt::format(
+                "Out of display planes, dropped {} of {} layers",
+                layers.size() - plan.keep, layers.size()
+            ));
+            return out;
+        }
+
+        out.layers.assign(layers.begin(), layers.begin() + plan.flat_begin);
+        auto* flat = &out.layers.emplace_back();
+        flat->image = std::move(flat_image);
+        flat->to_xy = plan.flat_origin;
+        flat->to_size = plan.flat_size;
+        flat->from_size = plan.flat_size.as<double>();
+        out.layers.insert(
+            out.layers.end(), layers.begin() + plan.flat_end, layers.end()
+        );
+        return out;
+    }
+
+    // Fits a frame to the hardware per plan_frame(), compositing on the CPU
+    // (reusing the last composited image if the run is unchanged).
+    // Returns nullopt if the frame is left as-is.
+    std::optional<DisplayFrame> flatten_if_overloaded(
+        Connector* conn, DisplayFrame const& frame, DisplayCost* cost
+    ) {
+        std::unique_lock const lock{conn->flat_mutex};  // Just this screen
+        auto const plan = plan_frame(conn, frame, *cost, conn->last_layers);
+        conn->last_layers = plan.layers;
+        *cost = plan.cost;
+        if (!plan.changed) {
+            conn->flat_inputs.clear();
+            conn->flat_image.reset();
+            return {};
+        }
+
+        if (plan.flat_begin == plan.flat_end) {
+            DEBUG(
+                logger, "  {} out of planes, no static layers to flatten",
+                conn->name
+            );
+            return planned_frame(frame, plan, {});
+        }
+
+        std::vector<DisplayLayer> const run(
+            plan.layers.begin() + plan.flat_begin,
+            plan.layers.begin() + plan.flat_end
+        );
+
+        bool const reuse =
+            conn->flat_image && conn->flat_origin == plan.flat_origin &&
+            conn->flat_image->content().size == plan.flat_size &&
+            std::equal(
+                run.begin(), run.end(),
+                conn->flat_inputs.begin(), conn->flat_inputs.end()
+            );
+
+        if (reuse) {
+            TRACE(logger, "  {} reusing flattened {}l", conn->name, run.size());
+        } else {
+            auto const start_mt = sys->clock(CLOCK_MONOTONIC);
+            auto buf = buffer_pool->get(plan.flat_size, 32);
+            compositor->composite(
+                run, plan.flat_origin, plan.flat_size,
+                buf->write(), buf->stride()
+            );
+
+            auto im = flat_buffer(plan.flat_size, std::move(buf));
+            im.source_comment = fmt::format("flattened {}l", run.size());
+            conn->flat_image = load_image(std::move(im));
+            conn->flat_inputs = run;
+            conn->flat_origin = plan.flat_origin;
+
+            DEBUG(
+                logger, "  {} flattened {}l on CPU ({:.1f}ms)",
+                conn->name, run.size(),
+                (sys->clock(CLOCK_MONOTONIC) - start_mt) * 1e3
+            );
+        }
+
+        return planned_frame(frame, plan, conn->flat_image);
+    }
+
+    // Describes a pooled buffer as an image for a flattened layer.
+    static ImageBuffer flat_buffer(
+        XY<int> size, std::shared_ptr<DumbBuffer> buf
+    ) {
+        ImageBuffer im = {};
+        im.fourcc = fourcc("rgbA");
+        im.size = size;
+        im.channels.resize(1);
+        im.channels[0].size = buf->size();
+        im.channels[0].stride = buf->stride();
+        im.channels[0].memory = std::move(buf);
+        return im;
+    }
+
+    // Checks a frame's predicted load (flattening layers on the CPU if
+    // needed and enabled) and logs it. Returns nullopt to use the frame as-is.
+    std::optional<DisplayFrame> prepare_frame(
+        Connector* conn, DisplayFrame const& in_frame
+    ) {
+        auto cost = predict_cost(in_frame);
+
+        std::optional<DisplayFrame> flat_frame;
+        if (options.software_fallback)
+            flat_frame = flatten_if_overloaded(conn, in_frame, &cost);
+        auto const& frame = flat_frame ? *flat_frame : in_frame;
+
+        if (is_overload(cost)) {
+            logger->warn(
+                "Predicted overload {} {}l mbw={:.0f}% cbw={:.0f}% lbm={:.0f}%",
+                conn->name, frame.layers.size(), cost.memory_bandwidth * 100,
+                cost.compositor_bandwidth * 100, cost.line_buffer_memory * 100
+            );
+            for (auto const& layer : frame.layers) {
+                auto const layer_cost = predict_cost({frame.mode, {layer}});
+                logger->warn(
+                    "  {:4.1f}%m {:4.1f}%c {:4.1f}%l {}",
+                    layer_cost.memory_bandwidth * 100,
+                    layer_cost.compositor_bandwidth * 100,
+                    layer_cost.line_buffer_memory * 100,
+                    debug(layer)
+                );
+            }
+        } else {
+            DEBUG(
+                logger, "UPDATE {} {}l mbw={:.0f}% cbw={:.0f}% lbm={:.0f}%",
+                conn->name, frame.layers.size(), cost.memory_bandwidth * 100,
+                cost.compositor_bandwidth * 100, cost.line_buffer_memory * 100
+            );
+        }
+
+        for (auto const& warning : frame.warnings)
+            logger->warn("{} {}", conn->name, warning);
+
+        return flat_frame;
+    }
+
+    // Starts an update of some screens, or holds it (one deep) until the
+    // pending flips on any of their CRTCs are done (see finish_flip()).
+    // On error, throws and leaves the waiter alone.
+    void start_or_queue(
+        std::unique_lock<std::mutex> const& lock,
+        std::vector<std::pair<Connector*, DisplayFrame const*>> const& frames,
+        std::shared_ptr<FlipWaiter> waiter
+    ) {
+        ASSERT(lock.owns_lock());
+        std::vector<Crtc*> busy;
+        for (auto const& [conn, frame] : frames) {
+            auto* const crtc = conn->using_crtc;
+            if (crtc && crtc->pending_flip) {
+                CHECK_ARG(!crtc->queued, "Update requested before prev done");
+                busy.push_back(crtc);
+            }
+        }
+
+        if (busy.empty()) {
+            start_update(lock, frames, waiter);
+            return;
+        }
+
+        auto queued = std::make_shared<QueuedUpdate>();
+        for (auto const& [conn, frame] : frames) {
+            DEBUG(logger, "  {} queued behind pending flip", conn->name);
+            queued->frames.emplace_back(conn, *frame);
+        }
+        queued->waiter = std::move(waiter);
+        for (auto* crtc : busy) crtc->queued = queued;
+    }
+
+    // Builds and submits one nonblocking atomic commit for all the screens
+    // in an update, so they flip on the same vsync cycle. The waiter is
+    // kept (to be fulfilled at vblank) or fulfilled (if no commit was
+    // needed). On error, throws and leaves the waiter alone.
+    void start_update(
+        std::unique_lock<std::mutex> const& lock,
+        std::vector<std::pair<Connector*, DisplayFrame const*>> const& frames,
+        std::shared_ptr<FlipWaiter> const& waiter
+    ) {
+        ASSERT(lock.owns_lock());
+        std::vector<Commit> commits(frames.size());  // Not resized (fd ptrs)
+        std::vector<Crtc*> flipping(frames.size(), nullptr);
+        std::set<Plane const*> claimed;  // Planes taken by earlier screens
+        Commit merged = {};              // All screens' properties
+        for (size_t f = 0; f < frames.size(); ++f) {
+            auto const& [conn, frame] = frames[f];
+            ASSERT(!conn->using_crtc || !conn->using_crtc->pending_flip);
+            if (!conn->using_crtc && !frame->mode.nominal_hz) {
+                DEBUG(logger, "  ({} was off, staying off)", conn->name);
+                continue;
+            }
+
+            auto* const crtc = choose_crtc(lock, conn, flipping);
+            CHECK_RUNTIME(crtc, "No DRM CRTC: {}", conn->name);
+            ASSERT(!crtc->pending_flip);
+
+            auto* const commit = &commits[f];
+            build_commit(lock, conn, crtc, *frame, false, claimed, commit);
+            auto& next = commit->next;
+            if (commit->props.empty()) {
+                TRACE(logger, "  {} unchanged!", conn->name);
+                ASSERT(conn->using_crtc == crtc);
+                ASSERT(crtc->used_by_conn == conn);
+                crtc->active = std::move(next);
+                continue;
+            }
+
+            claimed.insert(next.using_planes.begin(), next.using_planes.end());
+            merged.props.merge(commit->props);  // Objects are disjoint
+            flipping[f] = crtc;
+        }
+
+        if (merged.props.empty()) {
+            for (auto const& [conn, frame] : frames) waiter->flips[conn->id];
+            waiter->keep();
+            return;
+        }
+
+        // The nonblocking commit returns promptly; the flips complete later,
+        // reported by DRM events (one per CRTC) handled by event_thread().
+        uint32_t const flags =
+            DRM_MODE_PAGE_FLIP_EVENT |
+            DRM_MODE_ATOMIC_NONBLOCK |
+            DRM_MODE_ATOMIC_ALLOW_MODESET;
+        auto const sequence = update_sequence++;
+        std::string names;
+        for (size_t f = 0; f < frames.size(); ++f) {
+            if (!flipping[f]) continue;
+            names += (names.empty() ? "" : "+") + frames[f].first->name;
+        }
+        DEBUG(logger, "  {} u{} committing...", names, sequence);
+        auto const result = submit_commit(merged, flags, sequence);
+        TRACE(
+            logger, "  {} u{} commit queued (err={})",
+            names, sequence, result.err
+        );
+
+        result.check("DRM atomic update");  // Throws on error
+        for (size_t f = 0; f < frames.size(); ++f) {
+            auto* const conn = frames[f].first;
+            auto* const crtc = flipping[f];
+            if (!crtc) {
+                waiter->flips[conn->id];  // Nothing to wait for
+                continue;
+            }
+
+            auto& next = commits[f].next;
+            if (commits[f].writeback_fd >= 0)
+                next.writeback->fence = sys->adopt(commits[f].writeback_fd);
+
+            conn->using_crtc = crtc;
+            crtc->used_by_conn = conn;
+            for (auto* plane : next.using_planes) {
+                ASSERT(plane->used_by_crtc == crtc || !plane->used_by_crtc);
+                plane->used_by_crtc = crtc;
+            }
+
+            crtc->pending_flip.emplace(std::move(next));
+            crtc->pending_waiter = waiter;
+            ++waiter->pending;
+        }
+
+        event_wakeup->set();
+    }
+
+    // Picks the CRTC for a screen: its current one, or else a free one
+    // (other than any taken by other screens in the same commit).
+    Crtc* choose_crtc(
+        std::unique_lock<std::mutex> const& lock, Connector const* conn,
+        std::vector<Crtc*> const& taken = {}
+    ) {
+        ASSERT(lock.owns_lock());
+        if (conn->using_crtc) return conn->using_crtc;
+        for (auto* const c : conn->usable_crtcs) {
+            if (c->used_by_conn) continue;
+            if (std::find(taken.begin(), taken.end(), c) != taken.end())
+                continue;
+            return c;
+        }
+        return nullptr;
+    }
+
+    // Returns an idle framebuffer from a connector's writeback ring (adding
+    // one if the ring has room), or nullptr if all are in use.
+    std::shared_ptr<LoadedImage> writeback_buffer(
+        std::unique_lock<std::mutex> const& lock, Connector* conn, XY<int> size
+    ) {
+        ASSERT(lock.owns_lock());
+        auto* const ring = &conn->writeback_ring;
+        if (!ring->empty() && ring->front()->content().size != size)
+            ring->clear();  // Mode change; captures in flight keep old ones
+
+        for (auto const& fb : *ring) {
+            if (fb.use_count() == 1) return fb;  // Only the ring refers to it
+        }
+        if (ring->size() >= options.writeback_buffers) return nullptr;
+
+        // Import the dumb buffer as-is (not "RGBA", which would be copied)
+        auto buf = buffer_pool->get(size, 32);
+        ImageBuffer im = {};
+        im.fourcc = fourcc("rgbA");
+        im.size = size;
+        im.channels.resize(1);
+        im.channels[0].size = buf->size();
+        im.channels[0].stride = buf->stride();
+        im.channels[0].memory = std::move(buf);
+        im.source_comment = fmt::format("{} writeback", conn->name);
+        ring->push_back(load_image(std::move(im)));
+        return ring->back();
+    }
+
+    // Builds the atomic properties to show a frame on a CRTC, and the CRTC
+    // state that will result. Unless test_only, omits plane values matching
+    // the active state and sets up writeback (if the connector supports it).
+    // Claimed planes (taken by other CRTCs in the same commit) are avoided.
+    void build_commit(
+        std::unique_lock<std::mutex> const& lock,
+        Connector* conn, Crtc* crtc, DisplayFrame const& frame,
+        bool test_only, std::set<Plane const*> const& claimed, Commit* out
+    ) {
+        ASSERT(lock.owns_lock());
+        auto& props = out->props;
+        auto& next = out->next;
+        if (!frame.mode.nominal_hz) {
+            DEBUG(logger, "  ({} turning off)", conn->name);
+            props[conn->id][&conn->CRTC_ID] = 0;
+            props[crtc->id][&crtc->ACTIVE] = 0;
+            props[crtc->id][&crtc->MODE_ID] = 0;
+            // Leave next state zeroed (disassociate CRTC).
+        } else {
+            next.mode = mode_to_drm(frame.mode);
+            static_assert(sizeof(crtc->active.mode) == sizeof(next.mode));
+            if (memcmp(&crtc->active.mode, &next.mode, sizeof(next.mode))) {
+                DEBUG(logger, "  {}: {}", conn->name, debug(frame.mode));
+                auto& blob = out->mode_blob;
+                if (frame.mode.nominal_hz) blob = create_blob(next.mode);
+                props[crtc->id][&crtc->ACTIVE] = frame.mode.nominal_hz ? 1 : 0;
+                props[crtc->id][&crtc->MODE_ID] = blob ? *blob : 0;
+            }
+
+            bool const capture = options.capture_sink && !test_only;
+            if (conn->WRITEBACK_FB_ID.prop_id && capture) {
+                XY<int> const size = {next.mode.hdisplay, next.mode.vdisplay};
+                Writeback wb = {};
+                wb.fb = writeback_buffer(lock, conn, size);
+                if (!wb.fb) {
+                    DEBUG(logger, "  ({} writeback ring full)", conn->name);
+                } else {
+                    int const id = wb.fb->drm_id();
+                    auto const& im = wb.fb->content();
+                    DEBUG(logger, "  writeback: fb{} {}", id, debug(im));
+                    next.writeback = std::move(wb);
+                    props[conn->id][&conn->WRITEBACK_FB_ID] = id;
+                    props[conn->id][&conn->WRITEBACK_OUT_FENCE_PTR] =
+                        (uint64_t) &out->writeback_fd;
+                }
+            }
+
+            if (!conn->using_crtc || next.writeback) {
+                props[conn->id][&conn->CRTC_ID] = crtc->id;
+                props[crtc->id][&crtc->ACTIVE] = 1;
+            }
+
+            int first_plane = true;
+            auto plane_iter = crtc->usable_planes.begin();
+            // Don't send culled layers to the compositor
+            for (auto const& layer : visible_layers(frame)) {
+                // Find an appropriate plane (Primary=1, Overlay=0)
+                uint64_t const wanted_type = first_plane ? 1 : 0;
+                for (;; ++plane_iter) {
+                    CHECK_RUNTIME(
+                        plane_iter != crtc->usable_planes.end(),
+                        "No DRM plane: {}", conn->name
+                    );
+
+                    auto const* plane = (*plane_iter);
+                    auto const type = plane->type.init_value;
+                    auto const* used_by = plane->used_by_crtc;
+                    bool const free = !used_by && !claimed.count(plane);
+                    if (type == wanted_type && (used_by == crtc || free))
+                        break;
+
+                    // Disable any plane no longer used by this CRTC
+                    if (used_by == crtc) {
+                        DEBUG(logger, "  pl{}: disable (skipped)", plane->id);
+                        auto* plane_props = &props[plane->id];
+                        (*plane_props)[&plane->CRTC_ID] = 0;
+                        (*plane_props)[&plane->FB_ID] = 0;
+                    }
+                }
+
+                first_plane = false;
+                auto* plane = *plane_iter++;
+                int const fb_id = layer.image->drm_id();
+                next.using_planes.push_back(plane);
+                next.images.push_back(layer.image);
+
+                if (!test_only)
+                    DEBUG(logger, "  pl{}: {}", plane->id, debug(layer));
+                auto* plane_props = &next.plane_props[plane->id];
+                (*plane_props)[&plane->CRTC_ID] = crtc->id;
+                (*plane_props)[&plane->FB_ID] = fb_id;
 
                 (*plane_props)[&plane->SRC_X] = 65536.0 * layer.from_xy.x;
                 (*plane_props)[&plane->SRC_Y] = 65536.0 * layer.from_xy.y;
@@ -717,37 +1917,34 @@ class DisplayDriverDef : public DisplayDriver {
                     (*plane_props)[&plane->FB_ID] = 0;
                 }
             }
-        }
-
-        if (props.empty()) {
-            TRACE(logger, "  {} unchanged!", conn->name);
-            ASSERT(conn->using_crtc == crtc);
-            ASSERT(crtc->used_by_conn == conn);
-            ASSERT(!crtc->pending_flip);
-            crtc->active = std::move(next);
-            return {};
-        }
 
-        conn->using_crtc = crtc;
-        crtc->used_by_conn = conn;
-        crtc->pending_flip.emplace(std::move(next));
-        crtc->vblank_event.reset();
-        for (auto* plane : crtc->pending_flip->using_planes) {
-            ASSERT(plane->used_by_crtc == crtc || !plane->used_by_crtc);
-            plane->used_by_crtc = crtc;
+            // Only send plane properties that differ from the active state
+            // (planes keep their values while they stay on this CRTC)
+            auto const& active_props = crtc->active.plane_props;
+            for (auto const& [plane_id, values] : next.plane_props) {
+                auto const active = active_props.find(plane_id);
+                for (auto const& [prop, value] : values) {
+                    if (!test_only && active != active_props.end()) {
+                        auto const old = active->second.find(prop);
+                        if (old != active->second.end() && old->second == value)
+                            continue;
+                    }
+                    props[plane_id][prop] = value;
+                }
+            }
         }
 
-        //
-        // UNLOCK for blocking commit
-        //
-
-        lock.unlock();
+    }
 
+    // Sends an atomic commit (or test) to the kernel.
+    ErrnoOr<int> submit_commit(
+        Commit const& commit, uint32_t flags, uint64_t user_data
+    ) {
         std::vector<uint32_t> obj_ids;
         std::vector<uint32_t> obj_prop_counts;
         std::vector<uint32_t> prop_ids;
         std::vector<uint64_t> prop_values;
-        for (auto const& obj_props : props) {
+        for (auto const& obj_props : commit.props) {
             obj_ids.push_back(obj_props.first);
             obj_prop_counts.push_back(obj_props.second.size());
             for (auto const& prop_value : obj_props.second) {
@@ -761,59 +1958,32 @@ class DisplayDriverDef : public DisplayDriver {
         }
 
         drm_mode_atomic atomic = {
-            .flags =
-                DRM_MODE_PAGE_FLIP_EVENT |
-                DRM_MODE_ATOMIC_ALLOW_MODESET,
+            .flags = flags,
             .count_objs = (uint32_t) obj_ids.size(),
             .objs_ptr = (uint64_t) obj_ids.data(),
             .count_props_ptr = (uint64_t) obj_prop_counts.data(),
             .props_ptr = (uint64_t) prop_ids.data(),
             .prop_values_ptr = (uint64_t) prop_values.data(),
             .reserved = 0,
-            .user_data = update_sequence++,
+            .user_data = user_data,
         };
 
-        DEBUG(logger, "  {} u{} committing...", conn->name, atomic.user_data);
-        auto const result = fd->ioc<DRM_IOCTL_MODE_ATOMIC>(&atomic);
-        TRACE(
-            logger, "  {} u{} commit done (err={})",
-            conn->name, atomic.user_data, result.err
-        );
-
-        std::unique_ptr<FileDescriptor> writeback_fence;
-        if (writeback_fd >= 0) writeback_fence = sys->adopt(writeback_fd);
-
-        //
-        // RE-LOCK after blocking commit
-        //
-
-        lock.lock();
-        ASSERT(conn->using_crtc == crtc);
-        ASSERT(crtc->used_by_conn == conn);
-
-        // If update failed, clear the pending flip value.
-        if (result.err) {
-            crtc->pending_flip.reset();
-            result.check("DRM atomic update");  // Throws an exception
-        }
-
-        // Read and store events until we've seen one for this CRTC
-        while (!crtc->vblank_event) {
-            drm_event_vblank ev = {};
-            do {
-                auto const len = fd->read(&ev, sizeof(ev)).ex("Read DRM event");
-                CHECK_RUNTIME(len == sizeof(ev), "Bad DRM event size");
-            } while (ev.base.type != DRM_EVENT_FLIP_COMPLETE);
-
-            auto* const crtc = &crtcs.at(ev.crtc_id);
-            CHECK_RUNTIME(
-                crtc->pending_flip && crtc->used_by_conn && !crtc->vblank_event,
-                "Unexpected DRM CRTC pageflip ({})", crtc->id
-            );
-            crtc->vblank_event = std::move(ev);
-        }
+        return fd->ioc<DRM_IOCTL_MODE_ATOMIC>(&atomic);
+    }
 
-        auto const& ev = *crtc->vblank_event;
+    // Completes a pending flip when its vblank event arrives, then starts
+    // any update that was queued behind it.
+    void finish_flip(
+        std::unique_lock<std::mutex> const& lock, drm_event_vblank const& ev
+    ) {
+        ASSERT(lock.owns_lock());
+        auto* const crtc = &crtcs.at(ev.crtc_id);
+        CHECK_RUNTIME(
+            crtc->pending_flip && crtc->used_by_conn,
+            "Unexpected DRM CRTC pageflip ({})", crtc->id
+        );
+
+        auto* const conn = crtc->used_by_conn;
         DisplayUpdated done = {};
         do {
             double const flip_mt = ev.tv_sec + 1e-6 * ev.tv_usec;
@@ -859,321 +2029,153 @@ class DisplayDriverDef : public DisplayDriver {
         ASSERT(!crtc->used_by_conn || crtc->used_by_conn == conn);
         ASSERT(!conn->using_crtc || conn->using_crtc == crtc);
 
-        if (writeback_fence) {
-            TRACE(logger, "  (writeback fd={})", writeback_fence->raw_fd());
-            // TODO: Read from writeback fence
-            // (see https://forums.raspberrypi.com/viewtopic.php?t=328068)
+        if (crtc->active.writeback && crtc->active.writeback->fence) {
+            auto const& wb = *crtc->active.writeback;
+            TRACE(logger, "  (writeback fd={})", wb.fence->raw_fd());
+            PendingCapture pending = {};
+            pending.capture.screen_id = conn->id;
+            pending.capture.connector = conn->name;
+            pending.capture.flip_time = done.flip_time;
+            pending.capture.image = wb.fb;
+            pending.fence = wb.fence;
+
+            std::unique_lock const writeback_lock{writeback_mutex};
+            writeback_queue.push_back(std::move(pending));
+            writeback_wakeup->set();
         }
 
-        return done;
-    }
-
-    virtual DisplayCost predict_cost(DisplayFrame const& frame) const final {
-        // These calculations are all RPi 4B specific. TODO: Generalize?
-        DisplayCost out = {};
-        for (auto const& layer : frame.layers) {
-            // Skip invisible frames (matching logic to skip them in update())
-            if (!layer.to_size || layer.opacity <= 0) continue;
-
-            auto const& image = layer.image->content();
-            auto const image_pix = image.size.x * image.size.y;
-            if (image_pix <= 0) continue;
-
-            int image_bytes = 0;
-            for (auto const& chan : image.channels) image_bytes += chan.size;
-            auto const pix_bytes = (image_bytes + image_pix - 1) / image_pix;
-
-            // https://github.com/raspberrypi/linux/blob/rpi-5.15.y/drivers/gpu/drm/vc4/vc4_plane.c#:~:text=vc4_plane_calc_load
-            if (layer.to_size.y <= 0) continue;
-            out.memory_bandwidth +=
-                std::ceil(layer.from_size.x) * std::ceil(layer.from_size.y)
-                * std::ceil(layer.from_size.y / layer.to_size.y) * pix_bytes;
-
-            bool scaled_uv = false;
-            switch (image.fourcc) {
-                case fourcc("I420"):
-                case fourcc("NV12"):
-                case fourcc("NV21"):
-                case fourcc("Y42B"):
-                    scaled_uv = true;
+        auto const waiter = std::move(crtc->pending_waiter);
+        crtc->pending_waiter = {};
+        waiter->flips[conn->id] = done;
+        if (--waiter->pending == 0) waiter->keep();
+
+        // Start the queued update once none of its CRTCs are still flipping
+        auto const queued = std::move(crtc->queued);
+        crtc->queued = {};
+        if (queued && queued.use_count() == 1) {
+            std::vector<std::pair<Connector*, DisplayFrame const*>> frames;
+            for (auto const& [c, frame] : queued->frames)
+                frames.emplace_back(c, &frame);
+            try {
+                start_or_queue(lock, frames, queued->waiter);
+            } catch (std::exception const& e) {
+                logger->error("{} queued update: {}", conn->name, e.what());
+                queued->waiter->fail(std::current_exception());
             }
+        }
+    }
 
-            bool const scaled = scaled_uv || layer.from_size != layer.to_size;
-            out.compositor_bandwidth +=
-                layer.to_size.x * layer.to_size.y * (scaled ? 0.5 : 0.25);
-
-            // https://github.com/raspberrypi/linux/blob/rpi-5.15.y/drivers/gpu/drm/vc4/vc4_plane.c#:~:text=vc4_lbm_size
-            // https://github.com/raspberrypi/linux/blob/rpi-5.15.y/drivers/gpu/drm/vc4/vc4_plane.c#:~:text=vc4_get_scaling_mode
-            if (scaled_uv || layer.from_size.y != layer.to_size.y) {
-                int const line_pix =   // Dest if TPZ, source otherwise
-                    3 * layer.to_size.x < 2 * layer.from_size.x
-                        ? layer.to_size.x : std::ceil(layer.from_size.x);
-
-                int const lbm_pix =  // 2x if TPZ, 4x otherwise
-                     (!scaled_uv && 3 * layer.to_size.y < 2 * layer.from_size.y)
-                        ? line_pix * 2 : line_pix * 4;
-
-                // Align to 128 bytes (32 pixels, 8 "words")
-                out.line_buffer_memory += (lbm_pix + 31) / 32 * 32;
+    // Fails all pending and queued updates, after a DRM event read error.
+    void fail_pending(
+        std::unique_lock<std::mutex> const& lock, std::exception_ptr error
+    ) {
+        ASSERT(lock.owns_lock());
+        for (auto& id_crtc : crtcs) {
+            auto* const crtc = &id_crtc.second;
+            if (!crtc->pending_flip) continue;
+            crtc->pending_flip.reset();
+            crtc->pending_waiter->fail(error);
+            crtc->pending_waiter.reset();
+            if (crtc->queued) {
+                crtc->queued->waiter->fail(error);
+                crtc->queued.reset();
             }
         }
-
-        // https://github.com/raspberrypi/linux/blob/rpi-5.15.y/drivers/gpu/drm/vc4/vc4_kms.c#:~:text=vc4_load_tracker_atomic_check
-        // Empirically, the Pi4 can do ~150% the Pi3, despite 2x clock??
-        out.compositor_bandwidth *= frame.mode.actual_hz() / (340 * 1000000.0);
-
-        // https://forums.raspberrypi.com/viewtopic.php?t=271121
-        // Empirically, Pi4 has ~2x Pi3's bandwidth, and indeed 2x1.5GB=3.0GB
-        // seems to be around where HVS underruns start creeping in.
-        out.memory_bandwidth *= frame.mode.actual_hz() / (3072 * 1048576.0);
-
-        // https://github.com/raspberrypi/linux/blob/rpi-5.15.y/drivers/gpu/drm/vc4/vc4_hvs.c#:~:text=60k%20words
-        // The *2 is because both the old & new config must be allocated.
-        out.line_buffer_memory *= 2.0 / (60 * 1024);
-        return out;
     }
 
-    void open(std::shared_ptr<UnixSystem> sys, std::string const& dev) {
-        logger->info("Opening display \"{}\"...", dev);
-        this->sys = std::move(sys);
-        fd = this->sys->open(dev.c_str(), O_RDWR).ex(dev);
+    // Reads DRM events (blocking) whenever any flip is pending.
+    void event_thread() {
+        pthread_setname_np(pthread_self(), "pivid:display");
+        DEBUG(logger, "Display event thread running...");
         try {
-            fd->ioc<DRM_IOCTL_SET_MASTER>().ex("DRM master mode");
+            sys->set_thread_policy(options.event_thread_policy).ex("Display");
         } catch (std::system_error const& e) {
-            logger->error("{}", e.what());
-            // Continue, though something will probably fail later
-        }
-
-        fd->ioc<DRM_IOCTL_SET_CLIENT_CAP>(
-            drm_set_client_cap{DRM_CLIENT_CAP_ATOMIC, 1}
-        ).ex("Enable DRM atomic modesetting");
-        fd->ioc<DRM_IOCTL_SET_CLIENT_CAP>(
-            drm_set_client_cap{DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1}
-        ).ex("Enable DRM universal planes");
-        fd->ioc<DRM_IOCTL_SET_CLIENT_CAP>(
-            drm_set_client_cap{DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1}
-        ).ex("Enable DRM universal planes");
-
-        drm_mode_card_res res = {};
-        std::vector<uint32_t> crtc_ids, conn_ids;
-        do {
-            res.count_fbs = res.count_encoders = 0;  // Don't use these.
-            fd->ioc<DRM_IOCTL_MODE_GETRESOURCES>(&res).ex("DRM resources");
-        } while (
-            size_vec(&res.crtc_id_ptr, &res.count_crtcs, &crtc_ids) +
-            size_vec(&res.connector_id_ptr, &res.count_connectors, &conn_ids)
-        );
-
-        for (auto const crtc_id : crtc_ids) {
-            drm_mode_crtc ccdat = {};
-            ccdat.crtc_id = crtc_id;
-            fd->ioc<DRM_IOCTL_MODE_GETCRTC>(&ccdat).ex("DRM CRTC");
-
-            auto* crtc = &crtcs[crtc_id];
-            crtc->id = crtc_id;
-            lookup_required_prop_ids(crtc_id, &crtc->prop_ids);
-            if (ccdat.mode_valid)  // Round-trip to ensure struct memcmp().
-                crtc->active.mode = mode_to_drm(mode_from_drm(ccdat.mode));
+            logger->warn("Thread policy: {}", e.what());
         }
 
-        for (auto const conn_id : conn_ids) {
-            drm_mode_get_connector cdat = {};
-            cdat.connector_id = conn_id;
-            std::vector<uint32_t> enc_ids;
-            do {
-                cdat.count_props = cdat.count_modes = 0;
-                fd->ioc<DRM_IOCTL_MODE_GETCONNECTOR>(&cdat).ex("DRM conn");
-            } while (
-                size_vec(&cdat.encoders_ptr, &cdat.count_encoders, &enc_ids)
-            );
-
-            auto* conn = &connectors[conn_id];
-            conn->id = conn_id;
-            lookup_required_prop_ids(conn_id, &conn->prop_ids);
-            lookup_prop_ids(conn_id, &conn->opt_ids);
-            switch (cdat.connector_type) {
-                case DRM_MODE_CONNECTOR_HDMIA: conn->name = "HDMI"; break;
-#define T(x) case DRM_MODE_CONNECTOR_##x: conn->name = #x; break
-                T(Unknown);
-                T(VGA);
-                T(DVII);
-                T(DVID);
-                T(DVIA);
-                T(Composite);
-                T(SVIDEO);
-                T(LVDS);
-                T(Component);
-                T(9PinDIN);
-                T(DisplayPort);
-                T(HDMIB);
-                T(TV);
-                T(eDP);
-                T(VIRTUAL);
-                T(DSI);
-                T(DPI);
-                T(WRITEBACK);
-                T(SPI);
-                T(USB);
-#undef T
-                default: conn->name = fmt::format("[#{}]", cdat.connector_type);
+        std::unique_lock lock{mutex};
+        while (!event_shutdown) {
+            bool any_pending = false;
+            for (auto const& id_crtc : crtcs)
+                any_pending = any_pending || id_crtc.second.pending_flip;
+
+            lock.unlock();
+            if (!any_pending) {
+                event_wakeup->sleep();
+                lock.lock();
+                continue;
             }
-            conn->name += fmt::format("-{}", cdat.connector_type_id);
 
-            for (auto const enc_id : enc_ids) {
-                drm_mode_get_encoder edat = {};
-                edat.encoder_id = enc_id;
-                fd->ioc<DRM_IOCTL_MODE_GETENCODER>(&edat).ex("DRM encoder");
-                for (size_t i = 0; i < crtc_ids.size(); ++i) {
-                    if (edat.possible_crtcs & (1 << i)) {
-                        auto* const crtc = &crtcs.at(crtc_ids[i]);
-                        conn->usable_crtcs.push_back(crtc);
-                    }
-                }
+            drm_event_vblank ev = {};
+            std::exception_ptr error;
+            try {
+                auto const len = fd->read(&ev, sizeof(ev)).ex("Read DRM event");
+                CHECK_RUNTIME(len == sizeof(ev), "Bad DRM event size");
+            } catch (std::exception const& e) {
+                logger->error("{}", e.what());
+                error = std::current_exception();
             }
 
-            if (conn->CRTC_ID.init_value) {
-                auto *crtc = &crtcs.at(conn->CRTC_ID.init_value);
-                conn->using_crtc = crtc;
-                crtc->used_by_conn = conn;
+            lock.lock();
+            if (error) {
+                fail_pending(lock, error);
+            } else if (ev.base.type == DRM_EVENT_FLIP_COMPLETE) {
+                try {
+                    finish_flip(lock, ev);
+                } catch (std::exception const& e) {
+                    logger->error("{}", e.what());
+                }
             }
         }
 
-        drm_mode_get_plane_res pres = {};
-        std::vector<uint32_t> plane_ids;
-        do {
-            fd->ioc<DRM_IOCTL_MODE_GETPLANERESOURCES>(&pres).ex("DRM planes");
-        } while (size_vec(&pres.plane_id_ptr, &pres.count_planes, &plane_ids));
-
-        for (auto const plane_id : plane_ids) {
-            drm_mode_get_plane pdat = {};
-            pdat.plane_id = plane_id;
-            fd->ioc<DRM_IOCTL_MODE_GETPLANE>(&pdat).ex("DRM plane");
+        DEBUG(logger, "Display event thread ending...");
+    }
 
-            auto* plane = &planes[plane_id];
-            plane->id = plane_id;
-            lookup_required_prop_ids(plane_id, &plane->prop_ids);
-            lookup_prop_ids(plane_id, &plane->opt_ids);
-            for (size_t i = 0; i < crtc_ids.size(); ++i) {
-                if (pdat.possible_crtcs & (1 << i))
-                    crtcs[crtc_ids[i]].usable_planes.push_back(plane);
+    // Waits for each writeback fence, then passes the capture to the sink.
+    void writeback_thread() {
+        pthread_setname_np(pthread_self(), "pivid:writeback");
+        DEBUG(logger, "Writeback thread running...");
+
+        std::unique_lock lock{writeback_mutex};
+        while (!writeback_shutdown) {
+            if (writeback_queue.empty()) {
+                lock.unlock();
+                writeback_wakeup->sleep();
+                lock.lock();
+                continue;
             }
 
-            if (plane->IN_FORMATS.init_value) {
-                drm_mode_get_blob bdat = {};
-                bdat.blob_id = plane->IN_FORMATS.init_value;
-                std::vector<uint8_t> blob_data;
-                do {
-                    fd->ioc<DRM_IOCTL_MODE_GETPROPBLOB>(&bdat).ex("DRM blob");
-                } while (size_vec(&bdat.data, &bdat.length, &blob_data));
+            auto pending = std::move(writeback_queue.front());
+            writeback_queue.pop_front();
+            lock.unlock();
 
-                auto const* blob_bytes = blob_data.data();
-                auto const* blob = (drm_format_modifier_blob const*) blob_bytes;
-                if (blob->version == FORMAT_BLOB_CURRENT) {
-                    auto const* fmt_bytes = blob_bytes + blob->formats_offset;
-                    auto const* fmts = (uint32_t const*) fmt_bytes;
-                    plane->formats.insert(fmts, fmts + blob->count_formats);
+            // The out-fence becomes readable once the kernel has written
+            // the frame (within a frame or so of the flip)
+            auto const& name = pending.capture.connector;
+            auto const ready = pending.fence->poll(POLLIN, 1.0);
+            if (ready.err || !ready.value) {
+                logger->warn(
+                    "{} writeback fence {}", name,
+                    ready.err ? std::strerror(ready.err) : "timed out"
+                );
+            } else {
+                TRACE(
+                    logger, "{} captured {}",
+                    name, abbrev_realtime(pending.capture.flip_time)
+                );
+                try {
+                    options.capture_sink(std::move(pending.capture));
+                } catch (std::exception const& e) {
+                    logger->error("{} capture: {}", name, e.what());
                 }
             }
+
+            lock.lock();
         }
 
-        DEBUG(
-            logger, "  opened fd={}: {} planes, {} crtcs, {} screen connectors",
-            fd->raw_fd(), planes.size(), crtcs.size(), connectors.size()
-        );
+        DEBUG(logger, "Writeback thread ending...");
     }
 
-    DisplayDriverDef(DisplayDriverDef const&) = delete;
-    DisplayDriverDef& operator=(DisplayDriverDef const&) = delete;
-
-  private:
-    struct PropId {
-        using Map = std::map<std::string_view, PropId*>;
-        PropId(std::string_view n, Map* map) : name(n) { (*map)[n] = this; }
-        std::string_view name;
-        uint32_t prop_id = 0;     // Filled by open() -> lookup_prop_ids()
-        uint64_t init_value = 0;  // The property value at open() time
-    };
-
-    struct Writeback {
-        ImageBuffer image;
-        std::shared_ptr<LoadedImage> fb_id;
-        std::shared_ptr<FileDescriptor> fence;
-    };
-
-    struct Crtc;
-    struct Plane {
-        // Constant from setup to ~
-        uint32_t id = 0;
-        std::set<uint32_t> formats;
-        PropId::Map prop_ids, opt_ids;
-        PropId alpha{"alpha", &opt_ids};
-        PropId CRTC_ID{"CRTC_ID", &prop_ids};
-        PropId CRTC_X{"CRTC_X", &prop_ids};
-        PropId CRTC_Y{"CRTC_Y", &prop_ids};
-        PropId CRTC_W{"CRTC_W", &prop_ids};
-        PropId CRTC_H{"CRTC_H", &prop_ids};
-        PropId FB_ID{"FB_ID", &prop_ids};
-        PropId IN_FORMATS{"IN_FORMATS", &prop_ids};
-        PropId rotation{"rotation", &opt_ids};
-        PropId SRC_X{"SRC_X", &prop_ids};
-        PropId SRC_Y{"SRC_Y", &prop_ids};
-        PropId SRC_W{"SRC_W", &prop_ids};
-        PropId SRC_H{"SRC_H", &prop_ids};
-        PropId type{"type", &prop_ids};
-
-        // Guarded by DisplayDriverDef::mutex
-        Crtc* used_by_crtc = nullptr;
-    };
-
-    struct Connector;
-    struct Crtc {
-        struct State {
-            std::vector<Plane*> using_planes;
-            std::vector<std::shared_ptr<LoadedImage>> images;
-            drm_mode_modeinfo mode = {};
-            std::optional<Writeback> writeback;
-        };
-
-        // Constant from setup to ~
-        uint32_t id = 0;
-        std::vector<Plane*> usable_planes;
-        PropId::Map prop_ids;
-        PropId ACTIVE{"ACTIVE", &prop_ids};
-        PropId MODE_ID{"MODE_ID", &prop_ids};
-
-        // Guarded by DisplayDriverDef::mutex
-        Connector* used_by_conn = nullptr;
-        State active;
-        std::optional<State> pending_flip;
-        std::optional<drm_event_vblank> vblank_event;
-    };
-
-    struct Connector {
-        // Constant from setup to ~
-        uint32_t id = 0;
-        std::string name;
-        std::vector<Crtc*> usable_crtcs;
-        PropId::Map prop_ids, opt_ids;
-        PropId CRTC_ID{"CRTC_ID", &prop_ids};
-        PropId WRITEBACK_FB_ID{"WRITEBACK_FB_ID", &opt_ids};
-        PropId WRITEBACK_OUT_FENCE_PTR{"WRITEBACK_OUT_FENCE_PTR", &opt_ids};
-
-        // Guarded by DisplayDriverDef::mutex
-        Crtc* using_crtc = nullptr;
-    };
-
-    // These containers are constant after startup (contained objects change)
-    std::shared_ptr<log::logger> const logger = display_logger();
-    std::shared_ptr<UnixSystem> sys;
-    std::shared_ptr<FileDescriptor> fd;
-
-    std::mutex mutex;  // Guard for dynamic properties of objects below
-    std::map<uint32_t, Plane> planes;
-    std::map<uint32_t, Crtc> crtcs;
-    std::map<uint32_t, Connector> connectors;
-    std::map<uint32_t, std::string> prop_names;
-    uint64_t update_sequence = 0;
-
     void lookup_required_prop_ids(uint32_t obj_id, PropId::Map* map) {
         lookup_prop_ids(obj_id, map);
         for (auto const& name_propid : *map) {
@@ -1308,13 +2310,77 @@ std::vector<DisplayDriverListing> list_display_drivers(
 }
 
 std::unique_ptr<DisplayDriver> open_display_driver(
-    std::shared_ptr<UnixSystem> sys, std::string const& dev
+    std::shared_ptr<UnixSystem> sys, std::string const& dev,
+    DisplayDriverOptions const& options
 ) {
     auto driver = std::make_unique<DisplayDriverDef>();
-    driver->open(std::move(sys), dev);
+    driver->open(std::move(sys), dev, options);
     return driver;
 }
 
+std::vector<DisplayLayer> visible_layers(DisplayFrame const& frame) {
+    XY<int> const screen = frame.mode.size;
+    std::vector<DisplayLayer> out;
+    for (auto const& layer : frame.layers) {
+        if (!layer.image || layer.to_size.x <= 0 || layer.to_size.y <= 0)
+            continue;
+        if (layer.opacity <= 0) continue;
+
+        auto const to_end = layer.to_xy + layer.to_size;
+        if (to_end.x <= 0 || to_end.y <= 0) continue;
+        if (layer.to_xy.x >= screen.x || layer.to_xy.y >= screen.y) continue;
+
+        // Clip to the screen edges (only for unrotated, unreflected layers,
+        // where screen and source axes line up directly)
+        auto clipped = layer;
+        if (!layer.rotate && !layer.reflect) {
+            XY<double> const scale = {
+                layer.from_size.x / layer.to_size.x,
+                layer.from_size.y / layer.to_size.y
+            };
+            XY<int> const lo = {
+                std::max(0, -layer.to_xy.x), std::max(0, -layer.to_xy.y)
+            };
+            XY<int> const cut = lo + XY<int>{
+                std::max(0, to_end.x - screen.x),
+                std::max(0, to_end.y - screen.y)
+            };
+            clipped.from_xy.x += lo.x * scale.x;
+            clipped.from_xy.y += lo.y * scale.y;
+            clipped.from_size.x -= cut.x * scale.x;
+            clipped.from_size.y -= cut.y * scale.y;
+            clipped.to_xy = layer.to_xy + lo;
+            clipped.to_size = layer.to_size - cut;
+        }
+
+        out.push_back(std::move(clipped));
+    }
+
+    // Drop layers entirely covered by an opaque layer above them
+    for (size_t i = out.size(); i > 0; --i) {
+        auto const& top = out[i - 1];
+        auto const top_format = top.image->drm_format()
+            ? top.image->drm_format()
+            : format_to_drm(top.image->content().fourcc);
+        if (top.opacity < 1.0 || !drm_format_opaque(top_format)) continue;
+
+        auto const top_end = top.to_xy + top.to_size;
+        auto const covered = [&](DisplayLayer const& below) {
+            auto const end = below.to_xy + below.to_size;
+            return
+                below.to_xy.x >= top.to_xy.x && below.to_xy.y >= top.to_xy.y &&
+                end.x <= top_end.x && end.y <= top_end.y;
+        };
+
+        auto const below_end = out.begin() + (i - 1);
+        auto const kept = std::remove_if(out.begin(), below_end, covered);
+        i -= below_end - kept;
+        out.erase(kept, below_end);
+    }
+
+    return out;
+}
+
 //
 // Debugging utilities 
 //
@@ -3,11 +3,15 @@
 #pragma once
 
 #include <algorithm>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
 #include <string>
 #include <optional>
 #include <vector>
 
+#include "display_cost.h"
 #include "display_mode.h"
 #include "image_buffer.h"
 #include "unix_system.h"
@@ -34,6 +38,7 @@ struct DisplayLayer {
     double opacity = 1.0;
     bool reflect = false;  // Horizontal reflection applied before any rotation
     int rotate = 0;        // Clockwise rotation: 0, 90, 180, 270
+    bool operator==(DisplayLayer const&) const = default;
 };
 
 // A complete description of what to show on screen
@@ -41,19 +46,21 @@ struct DisplayFrame {
     DisplayMode mode;
     std::vector<DisplayLayer> layers;        // Ordered from back to front
     std::vector<std::string> warnings = {};  // Log if this frame is shown
+    bool operator==(DisplayFrame const&) const = default;
 };
 
-// Returned by DisplayDriver::update() after a frame has become visible.
+// Returned by DisplayDriver::request_update() after a frame has become visible.
 struct DisplayUpdated {
-    double flip_time;                      // Time of vsync flip
-    std::optional<ImageBuffer> writeback;  // Output for writeback "connectors"
+    double flip_time;  // Time of vsync flip
 };
 
-// Estimate of display load factors, where 1.0 is max capacity.
-struct DisplayCost {
-    double memory_bandwidth = 0.0;
-    double compositor_bandwidth = 0.0;
-    double line_buffer_memory = 0.0;
+// Output of a writeback "connector", once the kernel has finished writing it.
+// Passed to DisplayDriverOptions::capture_sink.
+struct DisplayCapture {
+    uint32_t screen_id = 0;
+    std::string connector;
+    double flip_time = 0.0;              // When the captured frame was shown
+    std::shared_ptr<LoadedImage> image;  // Not reused for capture while held
 };
 
 // Interface to a GPU device. Normally one per system, handling all outputs.
@@ -69,11 +76,44 @@ class DisplayDriver {
     // Imports an image into the GPU for use in DisplayUpdateRequest.
     virtual std::unique_ptr<LoadedImage> load_image(ImageBuffer) = 0;
 
+    // Starts updating a screen's contents &/or video mode at the next vsync.
+    // Returns immediately; the future is ready once the update is visible.
+    // While one update is pending, one more may be requested; it is committed
+    // when the pending one completes.
+    virtual std::future<DisplayUpdated> request_update(
+        uint32_t screen_id, DisplayFrame const&
+    ) = 0;
+
     // Updates a screen's contents &/or video mode at vsync.
     // BLOCKS until the vsync has occurred and the update is complete.
-    virtual DisplayUpdated update(uint32_t screen_id, DisplayFrame const&) = 0;
-
-    // Estimate the system load needed to show a particular frame.
+    DisplayUpdated update(uint32_t screen_id, DisplayFrame const& frame) {
+        return request_update(screen_id, frame).get();
+    }
+
+    // Starts updating several screens (by ID) in one atomic commit, so all
+    // of them switch on the same vsync cycle (frame-accurate across outputs).
+    // The future is ready once every screen's update is visible, with each
+    // screen's flip. Queuing works as for request_update(), per screen.
+    virtual std::future<std::map<uint32_t, DisplayUpdated>>
+    request_group_update(std::map<uint32_t, DisplayFrame> const&) = 0;
+
+    // Updates several screens together at vsync (see request_group_update()).
+    // BLOCKS until all the updates are complete.
+    std::map<uint32_t, DisplayUpdated> group_update(
+        std::map<uint32_t, DisplayFrame> const& frames
+    ) {
+        return request_group_update(frames).get();
+    }
+
+    // Checks (with test-only commits) how many of a frame's layers, from the
+    // bottom, the hardware accepts as they would be committed (including any
+    // software fallback). Returns frame.layers.size() if all are accepted.
+    // Verdicts are cached by frame "shape" (formats, scaling, rotation,
+    // blending, layer count), so this is cheap to call for every frame.
+    virtual size_t validate(uint32_t screen_id, DisplayFrame const&) = 0;
+
+    // Estimate the system load needed to show a particular frame,
+    // per the driver's DisplayCostModel.
     virtual DisplayCost predict_cost(DisplayFrame const&) const = 0;
 };
 
@@ -88,6 +128,24 @@ struct DisplayDriverListing {
     auto operator<=>(DisplayDriverListing const&) const = default;
 };
 
+// Tuning parameters for open_display_driver().
+struct DisplayDriverOptions {
+    size_t buffer_pool_bytes = 32 << 20;  // Idle converted-image memory to keep
+    size_t framebuffer_cache_size = 64;   // Idle DMA framebuffers to keep
+    double framebuffer_cache_idle_time = 1.0;  // Drop idle framebuffers after
+    bool software_fallback = true;  // Flatten layers on CPU if overloaded
+    size_t writeback_buffers = 3;   // Capture ring size for writeback screens
+    ThreadPolicy event_thread_policy;  // For flip completion handling
+
+    // Hardware capacities for predict_cost(); if unset, uses the built-in
+    // default_cost_model() for the device's driver.
+    std::optional<DisplayCostModel> cost_model;
+
+    // Receives writeback captures, in order, on a driver thread (must not
+    // block for long). Writeback is only enabled if this is set.
+    std::function<void(DisplayCapture)> capture_sink;
+};
+
 // Lists GPU devices present on the system (typically only one).
 std::vector<DisplayDriverListing> list_display_drivers(
     std::shared_ptr<UnixSystem> const& sys
@@ -97,9 +155,15 @@ std::vector<DisplayDriverListing> list_display_drivers(
 // (The screen must be on a text console, not a desktop environment.)
 // Each GPU may be opened *once* at a time across the *entire system*.
 std::unique_ptr<DisplayDriver> open_display_driver(
-    std::shared_ptr<UnixSystem> sys, std::string const& dev_file
+    std::shared_ptr<UnixSystem> sys, std::string const& dev_file,
+    DisplayDriverOptions const& = {}
 );
 
+// Returns the layers of a frame that need to be composited: drops layers
+// that are transparent, off-screen, or hidden under an opaque layer above,
+// and clips unrotated layers to the screen edges.
+std::vector<DisplayLayer> visible_layers(DisplayFrame const&);
+
 // Debugging descriptions of structures.
 std::string debug(DisplayLayer const&);
 std::string debug(DisplayDriverListing const&);
@@ -0,0 +1,90 @@
+#include "display_output.h"
+
+#include <doctest/doctest.h>
+
+namespace pivid {
+
+namespace {
+
+class FakeImage : public LoadedImage {
+  public:
+    FakeImage(uint32_t fourcc, XY<int> size) {
+        im.fourcc = fourcc;
+        im.size = size;
+    }
+    virtual uint32_t drm_id() const final { return 1; }
+    virtual ImageBuffer const& content() const final { return im; }
+
+  private:
+    ImageBuffer im;
+};
+
+DisplayLayer make_layer(uint32_t fourcc, XY<int> to_xy, XY<int> to_size) {
+    DisplayLayer layer = {};
+    layer.image = std::make_shared<FakeImage>(fourcc, to_size);
+    layer.from_size = to_size.as<double>();
+    layer.to_xy = to_xy;
+    layer.to_size = to_size;
+    return layer;
+}
+
+}  // anonymous namespace
+
+TEST_CASE("visible_layers") {
+    DisplayFrame frame = {};
+    frame.mode.size = {1920, 1080};
+
+    SUBCASE("Invisible") {
+        frame.layers.push_back(make_layer(fourcc("RGBA"), {0, 0}, {0, 0}));
+        frame.layers.push_back(make_layer(fourcc("RGBA"), {0, 0}, {10, 10}));
+        frame.layers.back().opacity = 0.0;
+        frame.layers.push_back(make_layer(fourcc("RGBA"), {1920, 0}, {10, 10}));
+        frame.layers.push_back(make_layer(fourcc("RGBA"), {0, -10}, {10, 10}));
+        CHECK(visible_layers(frame).empty());
+    }
+
+    SUBCASE("Clipped") {
+        auto layer = make_layer(fourcc("RGBA"), {-100, 1000}, {200, 200});
+        layer.from_size = {400, 100};
+        frame.layers.push_back(layer);
+
+        auto const out = visible_layers(frame);
+        REQUIRE(out.size() == 1);
+        CHECK(out[0].to_xy == XY<int>{0, 1000});
+        CHECK(out[0].to_size == XY<int>{100, 80});
+        CHECK(out[0].from_xy == XY<double>{200, 0});
+        CHECK(out[0].from_size == XY<double>{200, 40});
+    }
+
+    SUBCASE("Rotated not clipped") {
+        frame.layers.push_back(make_layer(fourcc("RGBA"), {-5, 0}, {10, 10}));
+        frame.layers.back().rotate = 90;
+        auto const out = visible_layers(frame);
+        REQUIRE(out.size() == 1);
+        CHECK(out[0].to_xy == XY<int>{-5, 0});
+    }
+
+    SUBCASE("Occluded") {
+        frame.layers.push_back(make_layer(fourcc("RGBA"), {10, 10}, {50, 50}));
+        frame.layers.push_back(make_layer(fourcc("RGBA"), {50, 50}, {50, 50}));
+        frame.layers.push_back(make_layer(fourcc("I420"), {0, 0}, {80, 80}));
+        frame.layers.push_back(make_layer(fourcc("RGBA"), {0, 0}, {20, 20}));
+
+        auto const out = visible_layers(frame);
+        REQUIRE(out.size() == 3);
+        CHECK(out[0].to_xy == XY<int>{50, 50});
+        CHECK(out[1].to_xy == XY<int>{0, 0});
+        CHECK(out[1].to_size == XY<int>{80, 80});
+        CHECK(out[2].to_size == XY<int>{20, 20});
+    }
+
+    SUBCASE("Not occluded by alpha") {
+        frame.layers.push_back(make_layer(fourcc("I420"), {0, 0}, {50, 50}));
+        frame.layers.push_back(make_layer(fourcc("RGBA"), {0, 0}, {80, 80}));
+        frame.layers.push_back(make_layer(fourcc("I420"), {0, 0}, {80, 80}));
+        frame.layers.back().opacity = 0.5;
+        CHECK(visible_layers(frame).size() == 3);
+    }
+}
+
+}  // namespace pivid
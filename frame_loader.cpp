@@ -136,6 +136,11 @@ class FrameLoaderDef : public FrameLoader {
         auto const thread_name = "pivid:" + short_filename(cx.filename);
         pthread_setname_np(pthread_self(), thread_name.substr(0, 15).c_str());
         TRACE(logger, "Starting reader: {}", short_filename(cx.filename));
+        try {
+            cx.sys->set_thread_policy(cx.thread_policy).ex(thread_name);
+        } catch (std::system_error const& e) {
+            logger->warn("Thread policy: {}", e.what());
+        }
 
         std::map<double, Decoder> decoders;
         std::unique_lock lock{mutex};
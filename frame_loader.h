@@ -52,6 +52,7 @@ struct FrameLoaderContext {
     std::shared_ptr<UnixSystem> sys;
     std::shared_ptr<DisplayDriver> driver;
     std::string filename;  // The media file the loader will be reading
+    ThreadPolicy thread_policy;  // Applied to the loader thread
     std::function<std::unique_ptr<MediaDecoder>(std::string const&)> decoder_f;
 };
 
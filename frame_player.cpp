@@ -2,12 +2,22 @@
 
 #include <pthread.h>
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <future>
+#include <limits>
+#include <map>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <fmt/core.h>
 
 #include "logging_policy.h"
+#include "spsc_queue.h"
 
 namespace pivid {
 
@@ -18,187 +28,523 @@ auto const& player_logger() {
     return logger;
 }
 
-class FramePlayerDef : public FramePlayer {
-  public:
-    virtual ~FramePlayerDef() {
-        std::unique_lock lock{mutex};
-        if (thread.joinable()) {
-            DEBUG(logger, "Stopping frame player...");
-            shutdown = true;
-            lock.unlock();
-            wakeup->set();
-            thread.join();
-        }
-    }
+// Frames for FramePlayer::replace_timeline(), queued for the player thread.
+struct TimelineUpdate {
+    double from = 0.0;
+    FramePlayer::Timeline frames;
+    std::shared_ptr<SyncFlag> notify;
+};
 
-    virtual void set_timeline(
-        Timeline timeline,
-        std::shared_ptr<SyncFlag> notify
-    ) final {
-        std::unique_lock lock{mutex};
+// Updates pending for the player; producers wait (rarely) if it fills.
+size_t const update_queue_size = 64;
 
-        // Avoid thread wakeup if the wakeup schedule doesn't change.
-        bool const same_keys = 
-            timeline.size() == this->timeline.size() && std::equal(
-                timeline.begin(), timeline.end(), this->timeline.begin(),
-                [] (auto const& a, auto const& b) { return a.first == b.first; }
-            );
+// State for one screen, shared by its FramePlayer and the player thread.
+struct PlayerScreen {
+    uint32_t screen_id = 0;
 
-        if (timeline.empty()) {
-            TRACE(logger, "SET empty");
-        } else {
-            TRACE(logger, 
-                "SET {}f: {}~{} {}",
-                timeline.size(),
-                abbrev_realtime(timeline.begin()->first),
-                abbrev_realtime(timeline.rbegin()->first),
-                same_keys ? "[same]" : "[diff]"
-            );
-        }
+    // Lock-free handoff between producers and the player thread
+    SpscQueue<TimelineUpdate> updates{update_queue_size};
+    std::atomic<double> shown = 0.0;
+    std::atomic<bool> blank = false;  // Owner gone, show an empty frame
 
-        this->timeline = std::move(timeline);
-        this->notify = std::move(notify);
-        if (!this->timeline.empty() && !same_keys) {
-            lock.unlock();
+    std::mutex push_mutex;  // Serializes replace_timeline() callers
+    std::unique_ptr<SyncFlag> popped;     // Set when a waiting caller may push
+    std::atomic<bool> push_waiting = false;  // A caller awaits queue space
+
+    // Guarded by status_mutex (only waited on by the player when idle)
+    std::mutex mutable status_mutex;
+    VsyncClock published_vsync;
+    FramePlayerStats published_stats;
+};
+
+// Thread that shows frames for one or more screens. Frames due on the same
+// vsync cycle are committed together (one atomic update for all screens).
+// Shared by the screens' FramePlayer instances; stops when all are gone.
+class PlayerThread {
+  public:
+    ~PlayerThread() { stop(); }
+
+    void stop() {
+        if (thread.joinable()) {
+            DEBUG(logger, "{} Stopping frame player...", ids);
+            shutdown = true;
             wakeup->set();
+            thread.join();
         }
     }
 
-    virtual double last_shown() const final {
-        std::scoped_lock const lock{mutex};
-        return shown;
-    }
+    PlayerScreen* screen(size_t index) { return screens.at(index).get(); }
+    void wake() { wakeup->set(); }
 
     void start(
         std::shared_ptr<DisplayDriver> driver,
-        uint32_t screen_id,
-        std::shared_ptr<UnixSystem> sys
+        std::vector<uint32_t> const& screen_ids,
+        std::shared_ptr<UnixSystem> sys,
+        ThreadPolicy const& policy
     ) {
-        logger->info("s{} Launching frame player...", screen_id);
+        CHECK_ARG(!screen_ids.empty(), "No screens for frame player");
+        for (auto const id : screen_ids) {
+            ids += fmt::format("{}s{}", ids.empty() ? "" : "+", id);
+            screens.push_back(std::make_unique<PlayerScreen>());
+            screens.back()->screen_id = id;
+            screens.back()->popped = sys->make_flag();
+        }
+
+        logger->info("{} Launching frame player...", ids);
         wakeup = sys->make_flag();
         thread = std::thread(
-            &FramePlayerDef::player_thread,
+            &PlayerThread::player_thread,
             this,
             std::move(driver),
-            screen_id,
-            std::move(sys)
+            std::move(sys),
+            policy
         );
     }
 
+  private:
+    // A screen's playback state, owned by the player thread
+    struct Playing {
+        FramePlayer::Timeline timeline;
+        std::shared_ptr<SyncFlag> notify;
+        VsyncClock vsync;
+        FramePlayerStats stats;
+        bool unpublished = false;
+        double shown_time = {};
+        DisplayMode mode = {};  // Of the last frame submitted
+
+        FramePlayer::Timeline::iterator show;  // Next frame, if any
+        bool due = false;                      // Showing on this cycle
+    };
+
+    // One screen's frame in a commit, as recorded when it was requested
+    struct Submitted {
+        size_t index = 0;         // Into screens and playing
+        double frame_time = 0.0;  // Scheduled time
+        size_t layer_count = 0;
+        double hz = 0.0;
+    };
+
+    // A commit handed to the driver, kept until its future is ready
+    // (one of the futures is valid, depending on screen count, unless the
+    // request itself failed).
+    struct InFlight {
+        std::future<DisplayUpdated> single;
+        std::future<std::map<uint32_t, DisplayUpdated>> group;
+        std::vector<Submitted> frames;
+        bool failed = false;  // The request or its flip threw
+
+        // Returns true once the commit is done (at once if it failed).
+        bool wait_for(double seconds) const {
+            std::chrono::duration<double> const d{std::max(seconds, 0.0)};
+            if (single.valid())
+                return single.wait_for(d) == std::future_status::ready;
+            if (group.valid())
+                return group.wait_for(d) == std::future_status::ready;
+            return true;
+        }
+    };
+
+    // The driver holds one commit pending a flip and one queued behind it
+    static constexpr size_t max_in_flight = 2;
+    static constexpr double flip_wait = 0.1;  // Recheck shutdown this often
+
     void player_thread(
         std::shared_ptr<DisplayDriver> driver,
-        uint32_t screen_id,
-        std::shared_ptr<UnixSystem> sys
+        std::shared_ptr<UnixSystem> sys,
+        ThreadPolicy const policy
     ) {
-        auto const thread_name = fmt::format("pivid:play:s{}", screen_id);
+        auto const thread_name = fmt::format("pivid:play:{}", ids);
         pthread_setname_np(pthread_self(), thread_name.substr(0, 15).c_str());
-        DEBUG(logger, "s{} Frame player thread running...", screen_id);
+        DEBUG(logger, "{} Frame player thread running...", ids);
+        try {
+            sys->set_thread_policy(policy).ex(thread_name);
+        } catch (std::system_error const& e) {
+            logger->warn("{} Thread policy: {}", ids, e.what());
+        }
+
+        // Owned by this thread; producers hand over changes via updates
+        std::vector<Playing> playing(screens.size());
+        std::deque<InFlight> in_flight;  // Oldest first
+        std::map<uint32_t, DisplayFrame> group_frames;
+        double const inf = std::numeric_limits<double>::infinity();
 
-        std::unique_lock lock{mutex};
         while (!shutdown) {
-            if (timeline.empty()) {
-                TRACE(logger, "s{} PLAY no frames, sleep", screen_id);
-                lock.unlock();
-                wakeup->sleep();
-                lock.lock();
-                continue;
+            // Record commits that have completed (or failed)
+            auto in_flight_it = in_flight.begin();
+            while (in_flight_it != in_flight.end()) {
+                if (in_flight_it->wait_for(0)) {
+                    finish(sys.get(), &*in_flight_it, &playing);
+                    in_flight_it = in_flight.erase(in_flight_it);
+                } else {
+                    ++in_flight_it;
+                }
             }
 
-            TRACE(logger, 
-                "s{} PLAY {}f {}~{}",
-                screen_id, timeline.size(),
-                abbrev_realtime(timeline.begin()->first),
-                abbrev_realtime(timeline.rbegin()->first)
-            );
-
             auto const now = sys->clock();
-            auto show = timeline.upper_bound(now);
-            if (show != timeline.begin()) {
-                auto before = show;
-                --before;
-                if (before->first > shown) show = before;
-            }
+            double next_submit = inf;
+            for (size_t si = 0; si < screens.size(); ++si) {
+                auto* const screen = screens[si].get();
+                auto* const p = &playing[si];
+                auto const screen_id = screen->screen_id;
+                if (p->unpublished)
+                    p->unpublished = !publish(screen, *p, false);
 
-            for (auto s = timeline.upper_bound(shown); s != show; ++s) {
-                if (!s->second.layers.empty()) {
-                    logger->warn(
-                        "s{} SKIPPING FRAME {}l {} ({:.3f}s old)",
-                        screen_id, s->second.layers.size(),
-                        abbrev_realtime(s->first), now - s->first
-                    );
-                } else {
-                    TRACE(
-                        logger, "s{} skip *empty* {} ({:.3f}s old)",
-                        screen_id, abbrev_realtime(s->first), now - s->first
+                while (auto update = screen->updates.try_pop()) {
+                    p->timeline.erase(
+                        p->timeline.lower_bound(update->from),
+                        p->timeline.end()
                     );
+                    p->timeline.merge(update->frames);  // Splices, no alloc
+                    p->notify = std::move(update->notify);
+                    if (screen->push_waiting.exchange(false))
+                        screen->popped->set();
+                }
+
+                if (screen->blank.exchange(false)) {
+                    // Keep the mode, so the group needs no modeset
+                    auto const t = std::nextafter(p->shown_time, inf);
+                    DisplayFrame empty = {p->mode, {}};
+                    p->timeline.clear();
+                    p->timeline.emplace(std::max(now, t), std::move(empty));
+                    p->notify = {};
+                }
+
+                p->show = p->timeline.end();
+                p->due = false;
+                if (p->timeline.empty()) {
+                    TRACE(logger, "s{} PLAY no frames", screen_id);
+                    continue;
+                }
+
+                TRACE(logger,
+                    "s{} PLAY {}f {}~{}",
+                    screen_id, p->timeline.size(),
+                    abbrev_realtime(p->timeline.begin()->first),
+                    abbrev_realtime(p->timeline.rbegin()->first)
+                );
+
+                // Frames are submitted half a period before their vblank,
+                // well after the previous flip but with time to commit.
+                auto const lead = p->vsync.period() / 2;
+                auto show = p->timeline.upper_bound(now + lead);
+                if (show != p->timeline.begin()) {
+                    auto before = show;
+                    --before;
+                    if (before->first > p->shown_time) show = before;
+                }
+
+                auto s = p->timeline.upper_bound(p->shown_time);
+                for (; s != show; ++s) {
+                    if (!s->second.layers.empty()) {
+                        ++p->stats.skipped;
+                        p->unpublished = true;
+                        logger->warn(
+                            "s{} SKIPPING FRAME {}l {} ({:.3f}s old)",
+                            screen_id, s->second.layers.size(),
+                            abbrev_realtime(s->first), now - s->first
+                        );
+                    } else {
+                        TRACE(
+                            logger, "s{} skip *empty* {} ({:.3f}s old)",
+                            screen_id, abbrev_realtime(s->first),
+                            now - s->first
+                        );
+                    }
+                    p->shown_time = s->first;
+                }
+
+                p->timeline.erase(p->timeline.begin(), show);  // Done
+                if (show == p->timeline.end()) {
+                    TRACE(logger, "s{}  (no more frames)", screen_id);
+                    continue;
                 }
-                shown = s->first;
+
+                p->show = show;
+                next_submit = std::min(next_submit, show->first - lead);
+            }
+
+            // With the driver's queue full, wait for the oldest commit
+            // (commits complete within a vsync period or so)
+            if (in_flight.size() >= max_in_flight) {
+                TRACE(logger, "{}  (commits in flight, waiting)", ids);
+                in_flight.front().wait_for(flip_wait);
+                continue;
             }
 
-            if (show == timeline.end()) {
-                TRACE(logger, "s{}  (no more frames, sleep)", screen_id);
-                lock.unlock();
+            if (next_submit == inf && !in_flight.empty()) {
+                TRACE(logger, "{}  (nothing new, awaiting flip)", ids);
+                in_flight.front().wait_for(flip_wait);
+                continue;
+            }
+
+            if (next_submit == inf) {
+                TRACE(logger, "{}  (nothing to show, sleep)", ids);
+                for (size_t si = 0; si < screens.size(); ++si) {
+                    if (playing[si].unpublished)
+                        publish(screens[si].get(), playing[si], true);
+                    playing[si].unpublished = false;
+                }
                 wakeup->sleep();
-                lock.lock();
                 continue;
             }
 
-            if (show->first > now) {
-                auto const delay = show->first - now;
-                TRACE(logger, "s{}  (waiting {:.3f}s)", screen_id, delay);
-                lock.unlock();
-                wakeup->sleep_until(show->first);
-                lock.lock();
+            if (next_submit > now) {
+                auto const wait = next_submit - now;
+                TRACE(logger, "{}  (waiting {:.3f}s)", ids, wait);
+                if (in_flight.empty()) {
+                    wakeup->sleep_until(next_submit);
+                } else {
+                    in_flight.front().wait_for(wait);  // Or until it flips
+                }
                 continue;
             }
 
-            auto const frame_time = show->first;
-            DisplayFrame frame = std::move(show->second);
-            auto const layer_count = frame.layers.size();
-            lock.unlock();
+            // Take every screen's frame for the vblank coming up (within
+            // half a period of the earliest frame that is due now).
+            double first_due = inf;
+            for (auto const& p : playing) {
+                if (p.show == p.timeline.end()) continue;
+                if (p.show->first - p.vsync.period() / 2 <= now)
+                    first_due = std::min(first_due, p.show->first);
+            }
+
+            InFlight commit = {};
+            double min_period = inf;
+            for (size_t si = 0; si < playing.size(); ++si) {
+                auto* const p = &playing[si];
+                if (p->show == p->timeline.end()) continue;
+                auto const lead = p->vsync.period() / 2;
+                auto const t = p->show->first;
+                if (t - lead > now && t >= first_due + lead) continue;
+
+                auto const hz = p->show->second.mode.actual_hz();
+                if (hz > 0 && p->vsync.nominal_period() != 1.0 / hz)
+                    p->vsync = VsyncClock{1.0 / hz};  // Mode change
+                if (hz > 0) min_period = std::min(min_period, 1.0 / hz);
 
+                p->due = true;
+                p->mode = p->show->second.mode;
+                commit.frames.push_back({
+                    .index = si,
+                    .frame_time = t,
+                    .layer_count = p->show->second.layers.size(),
+                    .hz = hz,
+                });
+            }
+
+            // Hand the commit to the driver; its future is collected above
+            // after the flip, so the next frame can be staged meanwhile.
+            auto const start_time = sys->clock();
             try {
-                auto const start_time = sys->clock();
-                driver->update(screen_id, std::move(frame));
-                auto const elapsed_time = sys->clock() - start_time;
-                auto const expected_time = 1.0 / frame.mode.actual_hz();
-                if (elapsed_time > expected_time + 0.005) {
-                    logger->warn(
-                        "s{} Slow update: took {:.3f}s, expected {:.3f}s",
-                        screen_id, elapsed_time, expected_time
-                    );
+                if (commit.frames.size() == 1) {
+                    auto* const p = &playing[commit.frames[0].index];
+                    auto const id = screens[commit.frames[0].index]->screen_id;
+                    commit.single = driver->request_update(id, p->show->second);
+                } else {
+                    group_frames.clear();
+                    for (auto const& f : commit.frames) {
+                        auto* const p = &playing[f.index];
+                        auto const id = screens[f.index]->screen_id;
+                        group_frames[id] = std::move(p->show->second);
+                    }
+                    commit.group = driver->request_group_update(group_frames);
                 }
             } catch (std::runtime_error const& e) {
-                logger->error("s{} Display: {}", screen_id, e.what());
-                // Continue as if displayed to avoid looping
+                logger->error("{} Display: {}", ids, e.what());
+                for (auto const& f : commit.frames)
+                    ++playing[f.index].stats.errors;
+                commit.failed = true;  // Finished (not shown) at once
+            }
+
+            // Requests should return well before the vblank they target
+            auto const request_time = sys->clock() - start_time;
+            if (request_time > min_period / 2) {
+                logger->warn(
+                    "{} Slow update: took {:.3f}s, expected {:.3f}s",
+                    ids, request_time, min_period / 2
+                );
+            }
+            for (size_t si = 0; si < playing.size(); ++si) {
+                auto* const p = &playing[si];
+                if (!p->due) continue;
+                p->stats.commit_time.add(request_time);
+                p->shown_time = p->show->first;
+                p->timeline.erase(p->show);
+                p->show = p->timeline.end();
+                p->due = false;
+            }
+
+            in_flight.push_back(std::move(commit));
+        }
+
+        DEBUG(logger, "{} Frame player thread ending...", ids);
+    }
+
+    // Records the outcome of a completed commit for each of its screens.
+    void finish(
+        UnixSystem* sys, InFlight* commit, std::vector<Playing>* playing
+    ) {
+        std::map<uint32_t, DisplayUpdated> flips;
+        try {
+            if (commit->single.valid()) {
+                auto const id = screens[commit->frames[0].index]->screen_id;
+                flips[id] = commit->single.get();
+            } else if (commit->group.valid()) {
+                flips = commit->group.get();
             }
+        } catch (std::runtime_error const& e) {
+            logger->error("{} Display: {}", ids, e.what());
+            for (auto const& f : commit->frames)
+                ++(*playing)[f.index].stats.errors;
+            commit->failed = true;
+        }
+
+        for (auto const& f : commit->frames) {
+            auto* const screen = screens[f.index].get();
+            auto* const p = &(*playing)[f.index];
+            auto const it = flips.find(screen->screen_id);
+            double const flip_time =
+                (it != flips.end()) ? it->second.flip_time : 0.0;
 
             DEBUG(
-                logger, "s{} Frame {}l {} ({:.3f}s old)",
-                screen_id, layer_count, abbrev_realtime(frame_time),
-                now - frame_time
+                logger, "s{} Frame {}l {} (flip {:+.3f}s)",
+                screen->screen_id, f.layer_count,
+                abbrev_realtime(f.frame_time),
+                (flip_time ? flip_time : sys->clock()) - f.frame_time
             );
 
-            lock.lock();  // State may have changed!
-            shown = frame_time;
-            if (notify) notify->set();
+            // Failed frames still advance playback to avoid looping
+            if (!commit->failed) {
+                ++p->stats.shown;
+                if (!f.layer_count) ++p->stats.empty;
+            }
+            if (flip_time) {  // Unchanged (or failed) frames don't flip
+                auto const delta = flip_time - f.frame_time;
+                p->stats.flip_delta.add(delta);
+                if (f.hz > 0 && delta > 1.5 / f.hz) ++p->stats.late;
+                if (f.hz > 0) p->vsync.add_flip(flip_time);
+            }
+
+            p->unpublished = !publish(screen, *p, false);
+            screen->shown.store(f.frame_time, std::memory_order_release);
+            if (p->notify) p->notify->set();
+        }
+    }
+
+    // Shares status with readers. Unless waiting is allowed (when idle),
+    // gives up (returning false) rather than block on a reader's lock.
+    static bool publish(PlayerScreen* screen, Playing const& p, bool wait) {
+        std::unique_lock lock{screen->status_mutex, std::defer_lock};
+        if (wait) {
+            lock.lock();
+        } else if (!lock.try_lock()) {
+            return false;
         }
 
-        DEBUG(logger, "s{} Frame player thread ending...", screen_id);
+        screen->published_vsync = p.vsync;
+        screen->published_stats = p.stats;
+        return true;
     }
 
-  private:
     // Constant from start to ~
     std::shared_ptr<log::logger> const logger = player_logger();
+    std::vector<std::unique_ptr<PlayerScreen>> screens;
+    std::string ids;  // Like "s1" or "s1+s2", for logging
     std::thread thread;
     std::unique_ptr<SyncFlag> wakeup;
+    std::atomic<bool> shutdown = false;
+};
 
-    // Guarded by mutex
-    std::mutex mutable mutex;
-    bool shutdown = false;
-    std::shared_ptr<SyncFlag> notify;
-    Timeline timeline;
-    double shown = {};
+class FramePlayerDef : public FramePlayer {
+  public:
+    FramePlayerDef(std::shared_ptr<PlayerThread> t, PlayerScreen* s)
+        : player(std::move(t)), screen(s) {}
+
+    virtual ~FramePlayerDef() {
+        if (player.use_count() > 1) {
+            screen->blank = true;  // Others in the group keep playing
+            player->wake();
+        } else {
+            player->stop();
+        }
+
+        std::scoped_lock const lock{screen->status_mutex};
+        auto const& st = screen->published_stats;
+        auto const id = screen->screen_id;
+        if (st.shown || st.skipped || st.errors) {
+            logger->info(
+                "s{} Shown {}f ({} empty, {} late), {} skipped, {} errors",
+                id, st.shown, st.empty, st.late, st.skipped, st.errors
+            );
+            auto const flip = debug(st.flip_delta, 1e3);
+            auto const commit = debug(st.commit_time, 1e3);
+            logger->info("s{}  flip delta ms {}", id, flip);
+            logger->info("s{}  commit ms {}", id, commit);
+        }
+    }
+
+    virtual void replace_timeline(
+        double from,
+        Timeline timeline,
+        std::shared_ptr<SyncFlag> notify
+    ) final {
+        CHECK_ARG(
+            timeline.empty() || timeline.begin()->first >= from,
+            "Timeline frame {} before replacement start {}",
+            timeline.empty() ? 0.0 : timeline.begin()->first, from
+        );
+
+        auto const id = screen->screen_id;
+        auto const from_text = std::isfinite(from)
+            ? abbrev_realtime(from) : std::string("start");
+        if (timeline.empty()) {
+            TRACE(logger, "s{} SET empty from {}", id, from_text);
+        } else {
+            TRACE(logger,
+                "s{} SET {}f: {}~{} from {}",
+                id, timeline.size(),
+                abbrev_realtime(timeline.begin()->first),
+                abbrev_realtime(timeline.rbegin()->first),
+                from_text
+            );
+        }
+
+        std::unique_lock const lock{screen->push_mutex};  // Serialize callers
+        TimelineUpdate update = {from, std::move(timeline), std::move(notify)};
+        if (!screen->updates.try_push(std::move(update))) {
+            // Only if the player is stuck (in a display update); wait it out.
+            // (The flag is set when the player takes an update after seeing
+            // push_waiting, so recheck the queue after raising it.)
+            logger->warn("s{} Frame player behind, waiting to queue", id);
+            for (;;) {
+                screen->push_waiting = true;
+                if (screen->updates.try_push(std::move(update))) break;
+                player->wake();
+                screen->popped->sleep();
+            }
+            screen->push_waiting = false;
+        }
+        player->wake();
+    }
+
+    virtual double last_shown() const final {
+        return screen->shown.load(std::memory_order_acquire);
+    }
+
+    virtual VsyncClock vsync_clock() const final {
+        std::scoped_lock const lock{screen->status_mutex};
+        return screen->published_vsync;
+    }
+
+    virtual FramePlayerStats stats() const final {
+        std::scoped_lock const lock{screen->status_mutex};
+        return screen->published_stats;
+    }
+
+  private:
+    std::shared_ptr<log::logger> const logger = player_logger();
+    std::shared_ptr<PlayerThread> player;
+    PlayerScreen* screen;  // Owned by the player
 };
 
 }  // anonymous namespace
@@ -206,11 +552,30 @@ class FramePlayerDef : public FramePlayer {
 std::unique_ptr<FramePlayer> start_frame_player(
     std::shared_ptr<DisplayDriver> driver,
     uint32_t screen_id,
-    std::shared_ptr<UnixSystem> sys
+    std::shared_ptr<UnixSystem> sys,
+    ThreadPolicy const& policy
 ) {
-    auto p = std::make_unique<FramePlayerDef>();
-    p->start(std::move(driver), screen_id, std::move(sys));
-    return p;
+    auto players = start_frame_player_group(
+        std::move(driver), {screen_id}, std::move(sys), policy
+    );
+    return std::move(players.at(0));
+}
+
+std::vector<std::unique_ptr<FramePlayer>> start_frame_player_group(
+    std::shared_ptr<DisplayDriver> driver,
+    std::vector<uint32_t> const& screen_ids,
+    std::shared_ptr<UnixSystem> sys,
+    ThreadPolicy const& policy
+) {
+    auto thread = std::make_shared<PlayerThread>();
+    thread->start(std::move(driver), screen_ids, std::move(sys), policy);
+
+    std::vector<std::unique_ptr<FramePlayer>> players;
+    for (size_t i = 0; i < screen_ids.size(); ++i) {
+        auto* const screen = thread->screen(i);
+        players.push_back(std::make_unique<FramePlayerDef>(thread, screen));
+    }
+    return players;
 }
 
 }  // namespace pivid
@@ -2,38 +2,88 @@
 
 #pragma once
 
+#include <limits>
 #include <map>
 #include <memory>
+#include <vector>
 
 #include "display_output.h"
+#include "histogram.h"
 #include "unix_system.h"
+#include "vsync_clock.h"
 
 namespace pivid {
 
+// Presentation statistics for a FramePlayer's screen since it started.
+// Returned by FramePlayer::stats().
+struct FramePlayerStats {
+    int64_t shown = 0;    // Frames sent to the display
+    int64_t empty = 0;    // Shown frames with no layers (blank screen)
+    int64_t late = 0;     // Shown frames flipped >1.5 periods after time
+    int64_t skipped = 0;  // Frames with layers never shown (came too late)
+    int64_t errors = 0;   // Display updates that failed
+    Histogram flip_delta{-0.005, 0.050, 110};  // Flip time - frame time
+    Histogram commit_time{0.0, 0.050, 100};    // Starting each update
+};
+
 // Interface to an asynchronous thread that shows images in timed sequence.
 // *Internally synchronized* for multithreaded access.
 class FramePlayer {
   public:
-    // Sequence of frames with system clock display time.
+    // Sequence of frames with system clock display time. Each frame is
+    // submitted shortly before the first vblank at or after its time,
+    // so times are best placed on vblanks (see vsync_clock()).
     using Timeline = std::map<double, DisplayFrame>;
 
     // Interrupts and shuts down the frame player.
     virtual ~FramePlayer() = default;
 
-    // Sets the list of frames to play. These are uncompressed; normally this
-    // is limited to a short near-term buffer and periodically refreshed.
+    // Replaces frames at or after a time with new frames (all at or after
+    // that time), keeping earlier frames; to append, pass a time after the
+    // last frame sent. Frames are uncompressed; normally the timeline is
+    // limited to a short near-term buffer and extended as time passes.
     // The signal (if any) is set when frames are shown.
-    virtual void set_timeline(Timeline, std::shared_ptr<SyncFlag> = {}) = 0;
+    // Never blocks the player thread, which takes updates from a lock-free
+    // queue; callers are serialized among themselves.
+    virtual void replace_timeline(
+        double from, Timeline, std::shared_ptr<SyncFlag> = {}
+    ) = 0;
+
+    // Replaces the entire list of frames to play.
+    void set_timeline(Timeline t, std::shared_ptr<SyncFlag> notify = {}) {
+        double const all = -std::numeric_limits<double>::infinity();
+        replace_timeline(all, std::move(t), std::move(notify));
+    }
 
     // Returns the *scheduled* time of the most recently shown frame.
     // (TODO: Make DisplayOutputDone also available.)
     virtual double last_shown() const = 0;
+
+    // Returns the screen's vblank timing as fit to flips seen so far.
+    virtual VsyncClock vsync_clock() const = 0;
+
+    // Returns presentation counters and timing histograms (may lag the
+    // most recent frame slightly, to avoid ever blocking the player).
+    virtual FramePlayerStats stats() const = 0;
 };
 
 // Creates a frame player instance for a given driver and screen.
+// The policy is applied to the player thread (typically realtime).
 std::unique_ptr<FramePlayer> start_frame_player(
     std::shared_ptr<DisplayDriver>, uint32_t screen_id,
-    std::shared_ptr<UnixSystem> = global_system()
+    std::shared_ptr<UnixSystem> = global_system(),
+    ThreadPolicy const& = {}
+);
+
+// Creates frame players (in order) for a "screen group" sharing one thread.
+// Frames due on the same vsync cycle go out in one atomic commit (see
+// DisplayDriver::request_group_update()), keeping the screens in step.
+// Destroying one player blanks its screen (an empty frame in the same mode);
+// the rest keep playing.
+std::vector<std::unique_ptr<FramePlayer>> start_frame_player_group(
+    std::shared_ptr<DisplayDriver>, std::vector<uint32_t> const& screen_ids,
+    std::shared_ptr<UnixSystem> = global_system(),
+    ThreadPolicy const& = {}
 );
 
 }  // namespace pivid
@@ -0,0 +1,125 @@
+#include "frame_player.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include <doctest/doctest.h>
+
+#include "virtual_display.h"
+
+namespace pivid {
+
+namespace {
+
+// Virtual display whose updates can be made to fail or stall.
+class TestDriver : public DisplayDriver {
+  public:
+    std::shared_ptr<VirtualDisplayDriver> const inner =
+        open_virtual_display_driver(global_system());
+    std::atomic<bool> fail = false;
+    std::atomic<double> stall = 0.0;  // Seconds to block each request
+
+    virtual std::vector<DisplayScreen> scan_screens() final {
+        return inner->scan_screens();
+    }
+
+    virtual std::unique_ptr<LoadedImage> load_image(ImageBuffer im) final {
+        return inner->load_image(std::move(im));
+    }
+
+    virtual std::future<DisplayUpdated> request_update(
+        uint32_t screen_id, DisplayFrame const& frame
+    ) final {
+        std::this_thread::sleep_for(std::chrono::duration<double>(stall));
+        if (fail) throw std::runtime_error("Test failure");
+        return inner->request_update(screen_id, frame);
+    }
+
+    virtual std::future<std::map<uint32_t, DisplayUpdated>>
+    request_group_update(
+        std::map<uint32_t, DisplayFrame> const& frames
+    ) final {
+        if (fail) throw std::runtime_error("Test failure");
+        return inner->request_group_update(frames);
+    }
+
+    virtual size_t validate(uint32_t id, DisplayFrame const& frame) final {
+        return inner->validate(id, frame);
+    }
+
+    virtual DisplayCost predict_cost(DisplayFrame const& frame) const final {
+        return inner->predict_cost(frame);
+    }
+};
+
+}  // anonymous namespace
+
+TEST_CASE("FramePlayer failed updates") {
+    auto const sys = global_system();
+    auto const driver = std::make_shared<TestDriver>();
+    auto const screen = driver->scan_screens().at(0);
+    auto const player = start_frame_player(driver, screen.id, sys);
+
+    // Plays a few frames (one per period) and waits until they're done
+    auto const play = [&]() {
+        DisplayFrame frame = {};
+        frame.mode = screen.modes.at(0);
+        double const period = 1.0 / frame.mode.actual_hz();
+        double const start = sys->clock() + period;
+        FramePlayer::Timeline timeline;
+        for (int f = 0; f < 3; ++f) timeline[start + f * period] = frame;
+        double const last = timeline.rbegin()->first;
+        player->set_timeline(std::move(timeline));
+        while (player->last_shown() < last)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    };
+
+    driver->fail = true;
+    play();  // Playback advances even though updates fail
+    while (player->stats().errors < 3)  // Stats may lag slightly
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    auto const failed = player->stats();
+    CHECK(failed.errors == 3);
+    CHECK(failed.shown == 0);
+    CHECK(failed.empty == 0);
+
+    driver->fail = false;
+    play();
+    while (player->stats().shown < 3)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    auto const ok = player->stats();
+    CHECK(ok.errors == 3);
+    CHECK(ok.shown == 3);
+    CHECK(ok.empty == 3);
+}
+
+TEST_CASE("FramePlayer waits for queue space") {
+    auto const sys = global_system();
+    auto const driver = std::make_shared<TestDriver>();
+    auto const screen = driver->scan_screens().at(0);
+    auto const player = start_frame_player(driver, screen.id, sys);
+
+    DisplayFrame frame = {};
+    frame.mode = screen.modes.at(0);
+    double const start = sys->clock();
+    driver->stall = 0.2;  // The player thread blocks in its first update
+    player->set_timeline({{start, frame}});
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    driver->stall = 0.0;
+
+    // Overfill the update queue; callers wait until the player catches up
+    double last = start;
+    for (int u = 0; u < 200; ++u) {
+        last = start + 0.3 + u * 0.001;
+        player->replace_timeline(last, {{last, frame}});
+    }
+    CHECK(sys->clock() - start >= 0.15);
+
+    while (player->last_shown() < last)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    CHECK(player->last_shown() == last);
+}
+
+}  // namespace pivid
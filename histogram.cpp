@@ -0,0 +1,63 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <fmt/core.h>
+
+#include "logging_policy.h"
+
+namespace pivid {
+
+Histogram::Histogram(double low, double high, int bins)
+    : low(low), high(high), bins(bins) {
+    CHECK_ARG(bins > 0 && high > low, "Bad histogram {}~{}", low, high);
+}
+
+void Histogram::add(double value) {
+    ++count;
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+    if (value < low) {
+        ++below;
+    } else if (value >= high || bins.empty()) {
+        ++above;
+    } else {
+        auto const bin = (value - low) / (high - low) * bins.size();
+        ++bins[std::min<size_t>(bin, bins.size() - 1)];
+    }
+}
+
+double Histogram::quantile(double q) const {
+    if (!count) return 0.0;
+    double const target = std::clamp(q, 0.0, 1.0) * count;
+    if (below > 0 && target <= below)  // Spread evenly from min to low
+        return min + (std::min(low, max) - min) * target / below;
+
+    double seen = below;
+    double const width = (high - low) / std::max<size_t>(bins.size(), 1);
+    for (size_t b = 0; b < bins.size(); ++b) {
+        if (bins[b] && seen + bins[b] >= target) {
+            double const part = (target - seen) / bins[b];
+            double const value = low + (b + part) * width;
+            return std::clamp(value, min, max);
+        }
+        seen += bins[b];
+    }
+
+    // In the "above" overflow, spread evenly from high to max
+    double const part = above > 0 ? (target - seen) / above : 1.0;
+    return std::max(high, min) + (max - std::max(high, min)) * part;
+}
+
+std::string debug(Histogram const& h, double scale) {
+    if (!h.count) return "n=0";
+    return fmt::format(
+        "n={} mean={:.2f} p50={:.2f} p90={:.2f} p99={:.2f} max={:.2f}",
+        h.count, h.mean() * scale, h.quantile(0.5) * scale,
+        h.quantile(0.9) * scale, h.quantile(0.99) * scale, h.max * scale
+    );
+}
+
+}  // namespace pivid
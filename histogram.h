@@ -0,0 +1,37 @@
+// Data structure for summarizing a distribution of numbers (doubles).
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace pivid {
+
+// Counts of values in equal-width bins over [low, high), with values
+// outside that range counted separately, plus exact summary statistics.
+struct Histogram {
+    double low = 0.0, high = 0.0;
+    std::vector<int64_t> bins;     // Equal-width bins from low to high
+    int64_t below = 0, above = 0;  // Values outside [low, high)
+    int64_t count = 0;
+    double sum = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    Histogram() = default;
+    Histogram(double low, double high, int bins);
+
+    void add(double);
+    double mean() const { return count ? sum / count : 0.0; }
+
+    // Estimates the value at some fraction (0-1) of the distribution,
+    // interpolating within bins (clamped to min/max).
+    double quantile(double) const;
+};
+
+// Debugging description (count, mean and percentiles, scaled for display).
+std::string debug(Histogram const&, double scale = 1.0);
+
+}  // namespace pivid
@@ -0,0 +1,44 @@
+#include "histogram.h"
+
+#include <doctest/doctest.h>
+
+using Approx = doctest::Approx;
+
+namespace pivid {
+
+TEST_CASE("Histogram") {
+    Histogram h(0.0, 10.0, 10);
+    CHECK(h.count == 0);
+    CHECK(h.mean() == 0.0);
+    CHECK(h.quantile(0.5) == 0.0);
+    CHECK(debug(h) == "n=0");
+
+    for (int i = 0; i < 100; ++i) h.add(i * 0.1);
+    CHECK(h.count == 100);
+    CHECK(h.below == 0);
+    CHECK(h.above == 0);
+    for (auto const bin : h.bins) CHECK(bin == 10);
+    CHECK(h.min == 0.0);
+    CHECK(h.max == Approx(9.9));
+    CHECK(h.mean() == Approx(4.95));
+    CHECK(h.quantile(0.0) == 0.0);
+    CHECK(h.quantile(0.5) == Approx(5.0));
+    CHECK(h.quantile(0.95) == Approx(9.5));
+    CHECK(h.quantile(1.0) == Approx(9.9));  // Clamped to max
+
+    h.add(-1.0);
+    h.add(25.0);
+    CHECK(h.below == 1);
+    CHECK(h.above == 1);
+    CHECK(h.min == -1.0);
+    CHECK(h.max == 25.0);
+    CHECK(h.quantile(0.0) == -1.0);
+    CHECK(h.quantile(1.0) == 25.0);
+
+    CHECK(
+        debug(h, 1000) ==
+        "n=102 mean=5088.24 p50=5000.00 p90=9080.00 p99=9998.00 max=25000.00"
+    );
+}
+
+}  // namespace pivid
@@ -0,0 +1,342 @@
+// Command line tool to measure display hardware limits for DisplayCostModel,
+// by showing synthetic layer configurations and watching for underruns.
+
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <regex>
+
+#include <CLI/App.hpp>
+#include <CLI/Config.hpp>
+#include <CLI/Formatter.hpp>
+#include <fmt/core.h>
+
+#include "display_cost.h"
+#include "display_output.h"
+#include "logging_policy.h"
+#include "virtual_display.h"
+
+namespace pivid {
+
+namespace {
+
+std::shared_ptr<log::logger> const& calibrate_logger() {
+    static const auto logger = make_logger("pivid_calibrate_cost");
+    return logger;
+}
+
+// Load factors from the model, paired with the capacity that scales each.
+struct Dimension {
+    char const* name;
+    double DisplayCost::* demand;
+    double DisplayCostModel::* capacity;
+};
+
+Dimension const dimensions[] = {
+    {"compositor", &DisplayCost::compositor_bandwidth,
+     &DisplayCostModel::compositor_hz},
+    {"memory", &DisplayCost::memory_bandwidth,
+     &DisplayCostModel::memory_bandwidth},
+    {"line buffer", &DisplayCost::line_buffer_memory,
+     &DisplayCostModel::line_buffer_size},
+};
+
+// Outcome of showing one synthetic frame for a while.
+struct Trial {
+    std::string name;
+    DisplayCost demand;  // Raw load (estimated with unit capacities)
+    int underruns = 0;
+    int late_flips = 0;
+    bool passed() const { return !underruns && !late_flips; }
+};
+
+class PatternBuffer : public MemoryBuffer {
+  public:
+    explicit PatternBuffer(int size) : data(size) {
+        for (size_t i = 0; i < data.size(); ++i) data[i] = (i * 7) % 251;
+    }
+
+    virtual int size() const final { return data.size(); }
+    virtual uint8_t const* read() final { return data.data(); }
+
+  private:
+    std::vector<uint8_t> data;
+};
+
+std::shared_ptr<LoadedImage> load_pattern(
+    DisplayDriver* driver, uint32_t format, XY<int> size
+) {
+    auto const [w, h] = size;
+    ImageBuffer im = {};
+    im.fourcc = format;
+    im.size = size;
+    if (format == fourcc("NV12")) {
+        int const cw = (w + 1) / 2, ch = (h + 1) / 2;
+        im.channels = {
+            {nullptr, 0, w * h, w},
+            {nullptr, w * h, cw * ch * 2, cw * 2},
+        };
+    } else {
+        im.channels = {{nullptr, 0, w * h * 4, w * 4}};
+    }
+
+    auto const& last = im.channels.back();
+    std::shared_ptr const mem =
+        std::make_shared<PatternBuffer>(last.offset + last.size);
+    for (auto& chan : im.channels) chan.memory = mem;
+    im.source_comment = "calibration pattern";
+    return driver->load_image(std::move(im));
+}
+
+// Reads pending kernel log records, counting display underrun reports.
+int count_underruns(FileDescriptor* kmsg) {
+    if (!kmsg) return 0;
+    static std::regex const underrun{"underrun", std::regex::icase};
+    int count = 0;
+    for (;;) {
+        char record[8192];
+        auto const ret = kmsg->read(record, sizeof(record) - 1);
+        if (ret.err == EPIPE) continue;  // kmsg skipped records
+        if (ret.err == EAGAIN) break;
+        auto const len = ret.ex("read /dev/kmsg");
+        record[len] = '\0';
+        if (std::regex_search(record, underrun)) ++count;
+    }
+    return count;
+}
+
+Trial run_trial(
+    DisplayDriver* driver, uint32_t screen_id, FileDescriptor* kmsg,
+    DisplayFrame const& frame, DisplayCostModel const& unit, double duration
+) {
+    auto const logger = calibrate_logger();
+    Trial trial = {};
+    trial.demand = estimate_cost(unit, frame);
+
+    double const period = 1.0 / frame.mode.actual_hz();
+    int const frames = std::max(3, int(std::ceil(duration / period)));
+    double last_flip = 0.0;
+    count_underruns(kmsg);  // Discard older messages
+    for (int f = 0; f < frames; ++f) {
+        auto const flip_time = driver->update(screen_id, frame).flip_time;
+        if (f >= 2 && flip_time - last_flip > period * 1.5) {
+            TRACE(logger, "Late flip {:.1f}ms", (flip_time - last_flip) * 1e3);
+            ++trial.late_flips;
+        }
+        last_flip = flip_time;
+    }
+
+    trial.underruns = count_underruns(kmsg);
+    return trial;
+}
+
+// Sets capacities between the highest passing and lowest failing demands.
+// Failures are blamed on the load furthest beyond its highest passing level.
+DisplayCostModel fit_model(
+    DisplayCostModel const& base, std::vector<Trial> const& trials
+) {
+    auto const logger = calibrate_logger();
+    double const inf = std::numeric_limits<double>::infinity();
+    size_t const dims = std::size(dimensions);
+    std::vector<double> pass_max(dims, 0.0), fail_min(dims, inf);
+
+    for (auto const& trial : trials) {
+        if (!trial.passed()) continue;
+        for (size_t d = 0; d < dims; ++d) {
+            double const demand = trial.demand.*dimensions[d].demand;
+            pass_max[d] = std::max(pass_max[d], demand);
+        }
+    }
+
+    for (auto const& trial : trials) {
+        if (trial.passed()) continue;
+        size_t blame = 0;
+        double blame_ratio = 0.0;
+        for (size_t d = 0; d < dims; ++d) {
+            double const demand = trial.demand.*dimensions[d].demand;
+            double const ratio = pass_max[d] > 0 ? demand / pass_max[d] : inf;
+            if (demand > 0 && ratio > blame_ratio) {
+                blame = d;
+                blame_ratio = ratio;
+            }
+        }
+
+        if (blame_ratio <= 1.0) {
+            logger->warn("Failure within passing loads: {}", trial.name);
+            continue;
+        }
+
+        double const demand = trial.demand.*dimensions[blame].demand;
+        fail_min[blame] = std::min(fail_min[blame], demand);
+    }
+
+    auto model = base;
+    for (size_t d = 0; d < dims; ++d) {
+        auto const& dim = dimensions[d];
+        auto* const capacity = &(model.*dim.capacity);
+        if (fail_min[d] < inf) {
+            *capacity = (pass_max[d] + fail_min[d]) / 2;
+            logger->info(
+                "{}: pass <= {:.4g}, fail >= {:.4g} => {:.4g}",
+                dim.name, pass_max[d], fail_min[d], *capacity
+            );
+        } else if (*capacity > 0 && pass_max[d] > *capacity) {
+            *capacity = pass_max[d];  // Raise a too-low default
+            logger->info(
+                "{}: pass <= {:.4g}, no failures", dim.name, pass_max[d]
+            );
+        } else {
+            logger->info(
+                "{}: pass <= {:.4g}, no failures, keeping {:.4g}",
+                dim.name, pass_max[d], *capacity
+            );
+        }
+    }
+
+    return model;
+}
+
+}  // anonymous namespace
+
+// Main program, parses flags and runs the calibration sweep.
+extern "C" int main(int const argc, char const* const* const argv) {
+    std::string dev_arg;
+    std::string log_arg;
+    std::string output_arg;
+    std::string screen_arg = "HDMI-1";
+    double duration_arg = 2.0;
+    int max_layers_arg = 6;
+
+    CLI::App app("Measure display hardware limits for the cost model");
+    app.add_option(
+        "--dev", dev_arg, "DRM driver description substring, or \"virtual\""
+    );
+    app.add_option("--duration", duration_arg, "Seconds to show each config");
+    app.add_option("--log", log_arg, "Log level/configuration");
+    app.add_option("--max_layers", max_layers_arg, "Most layers to stack");
+    app.add_option("--output", output_arg, "Cost model JSON file to write");
+    app.add_option("--screen", screen_arg, "Video output connector");
+    CLI11_PARSE(app, argc, argv);
+
+    configure_logging(log_arg);
+    auto const logger = calibrate_logger();
+
+    try {
+        auto const sys = global_system();
+        DisplayDriverOptions driver_options = {};
+        driver_options.software_fallback = false;  // Measure the hardware
+
+        std::string driver_name;
+        std::unique_ptr<DisplayDriver> driver;
+        if (dev_arg == "virtual") {
+            driver_name = "virtual";
+            driver = open_virtual_display_driver(sys);
+        } else {
+            for (auto const& d : list_display_drivers(sys)) {
+                if (debug(d).find(dev_arg) == std::string::npos) continue;
+                fmt::print("=== {}\n", debug(d));
+                driver_name = d.driver;
+                driver = open_display_driver(sys, d.dev_file, driver_options);
+                break;
+            }
+        }
+        CHECK_RUNTIME(driver, "No DRM device matching \"{}\"", dev_arg);
+
+        std::optional<DisplayScreen> screen;
+        for (auto const& s : driver->scan_screens()) {
+            if (s.connector == screen_arg) screen = s;
+        }
+        CHECK_RUNTIME(screen, "Screen \"{}\" not found", screen_arg);
+
+        auto const mode = screen->active_mode.nominal_hz
+            ? screen->active_mode
+            : (screen->modes.empty() ? DisplayMode{} : screen->modes[0]);
+        CHECK_RUNTIME(mode.nominal_hz, "No video mode for \"{}\"", screen_arg);
+        fmt::print("Screen {}: {}\n\n", screen->connector, debug(mode));
+
+        std::unique_ptr<FileDescriptor> kmsg;
+        auto kmsg_ret = sys->open("/dev/kmsg", O_RDONLY | O_NONBLOCK);
+        if (kmsg_ret.err) {
+            logger->warn("No /dev/kmsg, detecting late flips only");
+        } else {
+            kmsg = std::move(kmsg_ret).ex("/dev/kmsg");
+        }
+
+        // With unit capacities, estimate_cost() reports raw demand
+        auto const base = default_cost_model(driver_name);
+        auto unit = base;
+        for (auto const& dim : dimensions) unit.*dim.capacity = 1.0;
+
+        std::vector<Trial> trials;
+        for (auto const format : {fourcc("rgbA"), fourcc("NV12")}) {
+            for (double const scale : {1.0, 0.5, 1.5, 2.0}) {
+                XY<int> const from_size = {
+                    int(mode.size.x * scale) & ~1,
+                    int(mode.size.y * scale) & ~1,
+                };
+                auto const image =
+                    load_pattern(driver.get(), format, from_size);
+
+                DisplayFrame frame = {mode, {}};
+                for (int l = 1; l <= max_layers_arg; ++l) {
+                    DisplayLayer layer = {};
+                    layer.image = image;
+                    layer.from_size = from_size.as<double>();
+                    layer.to_size = mode.size;
+                    layer.opacity = frame.layers.empty() ? 1.0 : 0.5;
+                    frame.layers.push_back(layer);
+
+                    auto const name = fmt::format(
+                        "{} {}x{} x{:.1f} {}l", debug_fourcc(format),
+                        from_size.x, from_size.y, scale, l
+                    );
+                    auto const ok = driver->validate(screen->id, frame);
+                    if (ok < frame.layers.size()) {
+                        fmt::print("{:<32} REJECTED\n", name);
+                        break;
+                    }
+
+                    auto trial = run_trial(
+                        driver.get(), screen->id, kmsg.get(), frame, unit,
+                        duration_arg
+                    );
+                    trial.name = name;
+                    fmt::print(
+                        "{:<32} c={:.3g} m={:.3g} l={:.3g} {}\n", name,
+                        trial.demand.compositor_bandwidth,
+                        trial.demand.memory_bandwidth,
+                        trial.demand.line_buffer_memory,
+                        trial.passed() ? "ok" : fmt::format(
+                            "FAIL ({} underruns, {} late)",
+                            trial.underruns, trial.late_flips
+                        )
+                    );
+
+                    trials.push_back(std::move(trial));
+                    if (!trials.back().passed()) break;  // More will fail too
+                }
+            }
+        }
+
+        driver->update(screen->id, {mode, {}});  // Clear the screen
+        fmt::print("\n");
+
+        auto const json = cost_model_json(fit_model(base, trials));
+        if (output_arg.empty()) {
+            fmt::print("{}\n", json);
+        } else {
+            std::ofstream ofs;
+            ofs.exceptions(~std::ofstream::goodbit);
+            ofs.open(output_arg, std::ios::binary | std::ios::trunc);
+            ofs << json << "\n";
+            logger->info("Wrote {}", output_arg);
+        }
+    } catch (std::exception const& e) {
+        logger->critical("{}", e.what());
+        return 1;
+    }
+
+    return 0;
+}
+
+}  // namespace pivid
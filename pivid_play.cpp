@@ -1,7 +1,7 @@
 // Simple command line tool to exercise video decoding and playback.
 
 #include <cmath>
-#include <fstream>
+#include <thread>
 
 #include <CLI/App.hpp>
 #include <CLI/Config.hpp>
@@ -9,10 +9,14 @@
 #include <fmt/core.h>
 #include <nlohmann/json.hpp>
 
+#include "capture_recorder.h"
 #include "display_output.h"
 #include "logging_policy.h"
 #include "script_data.h"
+#include "script_plan.h"
 #include "script_runner.h"
+#include "unix_system.h"
+#include "virtual_display.h"
 
 namespace pivid {
 
@@ -23,7 +27,17 @@ std::shared_ptr<log::logger> const& play_logger() {
     return logger;
 }
 
-std::unique_ptr<DisplayDriver> find_driver(std::string const& dev_arg) {
+std::unique_ptr<DisplayDriver> find_driver(
+    std::string const& dev_arg, DisplayDriverOptions const& options
+) {
+    if (dev_arg == "virtual") {
+        fmt::print("=== Virtual display (no hardware) ===\n\n");
+        VirtualDisplayOptions virtual_options = {};
+        if (options.cost_model)
+            virtual_options.cost_model = *options.cost_model;
+        return open_virtual_display_driver(global_system(), virtual_options);
+    }
+
     fmt::print("=== Video drivers ===\n");
     std::optional<DisplayDriverListing> found;
     for (auto const& d : list_display_drivers(global_system())) {
@@ -35,7 +49,7 @@ std::unique_ptr<DisplayDriver> find_driver(std::string const& dev_arg) {
     fmt::print("\n");
 
     CHECK_RUNTIME(found, "No DRM device matching \"{}\"", dev_arg);
-    return open_display_driver(global_system(), found->dev_file);
+    return open_display_driver(global_system(), found->dev_file, options);
 }
 
 void set_kernel_debug(bool enable) {
@@ -78,6 +92,7 @@ Script make_script(
     );
 
     script.zero_time = global_system()->clock();
+    script.plan = std::make_shared<ScriptPlan const>(compile_script(script));
     play_logger()->info("Start: {}", format_realtime(script.zero_time));
     return script;
 }
@@ -86,33 +101,41 @@ Script load_script(std::string const& script_file) {
     auto const logger = play_logger();
     auto const sys = global_system();
 
-    std::ifstream ifs;
-    ifs.exceptions(~std::ifstream::goodbit);
-    ifs.open(script_file, std::ios::binary);
-    std::string const text(
-        (std::istreambuf_iterator<char>(ifs)),
-        (std::istreambuf_iterator<char>())
-    );
-
+    std::string const text = read_text(script_file);
     double const default_zero_time = sys->clock();
     play_logger()->info("Start: {}", format_realtime(default_zero_time));
     return parse_script(text, default_zero_time);
 }
 
-void run_script(ScriptContext const& context, Script const& script) {
+void run_script(ScriptContext context, Script const& script) {
     auto const logger = play_logger();
     auto const sys = global_system();
-    auto const waiter = sys->make_flag(CLOCK_MONOTONIC);
+    std::shared_ptr<SyncFlag> const waiter = sys->make_flag(CLOCK_MONOTONIC);
+    context.notify = waiter;
 
     ASSERT(script.main_loop_hz > 0);
     double const period = 1.0 / script.main_loop_hz;
-    double loop_mono = 0.0;
+    double last_mono = 0.0;  // When the last update started
+    double next_mono = 0.0;  // The runner's deadline for the next update
+    bool loaded = false;     // Woken by media loading since last update
 
-    auto const runner = make_script_runner(context);
+    auto const runner = make_script_runner(std::move(context));
     for (;;) {
-        loop_mono = std::max(sys->clock(CLOCK_MONOTONIC), loop_mono + period);
-        waiter->sleep_until(loop_mono);
-        runner->update(script);
+        // Update by the runner's deadline, or when media loads (but then
+        // at most once per period), and at least every second to check
+        // whether playback is done.
+        double const mono = sys->clock(CLOCK_MONOTONIC);
+        double due = std::min(next_mono, last_mono + 1.0);
+        if (loaded) due = std::min(due, last_mono + period);
+        if (mono < due) {
+            loaded = waiter->sleep_until(due) || loaded;
+            continue;
+        }
+
+        double const next = runner->update(script);
+        next_mono = sys->clock(CLOCK_MONOTONIC) + (next - sys->clock());
+        last_mono = mono;
+        loaded = false;
 
         bool done = true;
         const double now_t0 = sys->clock() - script.zero_time;
@@ -141,23 +164,43 @@ void run_script(ScriptContext const& context, Script const& script) {
 // Main program, parses flags and calls the decoder loop.
 extern "C" int main(int const argc, char const* const* const argv) {
     std::string dev_arg;
+    std::string capture_arg;
+    std::string cost_model_arg;
     std::string screen_arg = "HDMI-1";
     std::string log_arg;
     std::string media_arg;
     std::string script_arg;
     ScriptMode mode_arg = {{1920, 1080}, 60};
     double seek_arg = -0.2;
+    int player_cpu_arg = -1;
+    int rt_priority_arg = 0;
+    bool lock_memory = false;
     bool debug_kernel = false;
 
     CLI::App app("Decode and show a media file");
-    app.add_option("--dev", dev_arg, "DRM driver description substring");
+    app.add_option(
+        "--dev", dev_arg, "DRM driver description substring, or \"virtual\""
+    );
+    app.add_option(
+        "--capture_dir", capture_arg, "Save writeback screens as TIFF here"
+    );
+    app.add_option(
+        "--cost_model", cost_model_arg, "Display cost model (calibration JSON)"
+    );
     app.add_option("--log", log_arg, "Log level/configuration");
     app.add_option("--mode_x", mode_arg.size.x, "Video pixels per line");
     app.add_option("--mode_y", mode_arg.size.y, "Video scan lines");
     app.add_option("--mode_hz", mode_arg.hz, "Video refresh rate");
+    app.add_option(
+        "--player_cpu", player_cpu_arg, "CPU to reserve for frame players"
+    );
+    app.add_option(
+        "--rt_priority", rt_priority_arg, "SCHED_FIFO priority for players"
+    );
     app.add_option("--screen", screen_arg, "Video output connector");
     app.add_option("--seek", seek_arg, "Seconds into media to start");
     app.add_flag("--debug_kernel", debug_kernel, "Enable kernel DRM debugging");
+    app.add_flag("--lock_memory", lock_memory, "Lock all memory in RAM");
 
     auto input = app.add_option_group("Input")->require_option(0, 1);
     input->add_option("--media", media_arg, "Media file to play");
@@ -170,16 +213,54 @@ extern "C" int main(int const argc, char const* const* const argv) {
     auto const logger = play_logger();
 
     try {
+        // Players (and flip handling) get the reserved CPU, others the rest;
+        // threads started later inherit this thread's policy.
+        ThreadPolicy player_policy = {}, worker_policy = {};
+        player_policy.realtime_priority = rt_priority_arg;
+        if (player_cpu_arg >= 0) {
+            player_policy.cpus = {player_cpu_arg};
+            int const cpus = std::thread::hardware_concurrency();
+            for (int cpu = 0; cpu < cpus; ++cpu) {
+                if (cpu != player_cpu_arg) worker_policy.cpus.push_back(cpu);
+            }
+        }
+
+        auto const sys = global_system();
+        sys->set_thread_policy(worker_policy).ex("Main thread policy");
+        if (lock_memory) sys->lock_memory().ex("Lock memory");
+
+        DisplayDriverOptions driver_options = {};
+        driver_options.event_thread_policy = player_policy;
+        if (!cost_model_arg.empty()) {
+            logger->info("Cost model: {}", cost_model_arg);
+            driver_options.cost_model =
+                parse_cost_model(read_text(cost_model_arg));
+        }
+
+        if (!capture_arg.empty()) {
+            CaptureRecorderOptions recorder_options = {};
+            recorder_options.dir = capture_arg;
+            std::shared_ptr const recorder =
+                start_capture_recorder(global_system(), recorder_options);
+            driver_options.capture_sink = [recorder](DisplayCapture c) {
+                recorder->record(std::move(c));
+            };
+        }
+
         if (!script_arg.empty()) {
             logger->info("Script: {}", script_arg);
             ScriptContext context = {};
-            context.driver = find_driver(dev_arg);
+            context.driver = find_driver(dev_arg, driver_options);
+            context.loader_cx.thread_policy = worker_policy;
+            context.player_policy = player_policy;
             context.file_base = script_arg;
             run_script(context, load_script(script_arg));
         } else if (!media_arg.empty()) {
             ScriptContext context = {};
-            context.driver = find_driver(dev_arg);
-            context.file_base = global_system()->realpath(".").ex("getcwd");
+            context.driver = find_driver(dev_arg, driver_options);
+            context.loader_cx.thread_policy = worker_policy;
+            context.player_policy = player_policy;
+            context.file_base = sys->realpath(".").ex("getcwd");
             run_script(
                 context, make_script(media_arg, screen_arg, mode_arg, seek_arg)
             );
@@ -2,6 +2,7 @@
 
 #include <pthread.h>
 
+#include <cmath>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
@@ -15,11 +16,14 @@
 #include <nlohmann/json.hpp>
 #include <httplib/httplib.h>
 
+#include "capture_recorder.h"
 #include "display_output.h"
+#include "histogram.h"
 #include "logging_policy.h"
 #include "script_data.h"
 #include "script_runner.h"
 #include "unix_system.h"
+#include "virtual_display.h"
 
 namespace pivid {
 
@@ -30,10 +34,31 @@ std::shared_ptr<log::logger> const& server_logger() {
     return logger;
 }
 
+nlohmann::json histogram_json(Histogram const& h) {
+    nlohmann::json j = {
+        {"count", h.count},
+        {"low", h.low},
+        {"high", h.high},
+        {"bins", h.bins},
+        {"below", h.below},
+        {"above", h.above},
+    };
+    if (h.count > 0) {
+        j["mean"] = h.mean();
+        j["min"] = h.min;
+        j["max"] = h.max;
+        j["p50"] = h.quantile(0.5);
+        j["p90"] = h.quantile(0.9);
+        j["p99"] = h.quantile(0.99);
+    }
+    return j;
+}
+
 struct ServerContext {
     std::shared_ptr<UnixSystem> sys;
     std::shared_ptr<DisplayDriver> driver;
     std::unique_ptr<ScriptRunner> runner;
+    std::shared_ptr<SyncFlag> wakeup;  // Monotonic; the runner's notify flag
     double default_zero_time = 0.0;
     bool trust_network = false;
     int port = 31415;
@@ -57,6 +82,7 @@ class Server {
 
         http.Get("/media(/.*)", [&](auto const& q, auto& s) {on_media(q, s);});
         http.Get("/screens", [&](auto const& q, auto& s) {on_screens(q, s);});
+        http.Get("/stats", [&](auto const& q, auto& s) {on_stats(q, s);});
         http.Post("/quit", [&](auto const& q, auto& s) {on_quit(q, s);});
         http.Post("/play", [&](auto const& q, auto& s) {on_play(q, s);});
 
@@ -66,7 +92,8 @@ class Server {
         );
 
         DEBUG(logger, "Launching main loop thread");
-        wakeup_mono = cx.sys->make_flag(CLOCK_MONOTONIC);
+        wakeup_mono = cx.wakeup;
+        if (!wakeup_mono) wakeup_mono = cx.sys->make_flag(CLOCK_MONOTONIC);
         thread = std::thread(&Server::main_loop_thread, this);
         if (cx.trust_network) {
             logger->info("Listening to WHOLE NETWORK on port {}", cx.port);
@@ -82,7 +109,12 @@ class Server {
         pthread_setname_np(pthread_self(), "pivid:mainloop");
         TRACE(logger, "Starting main loop thread");
 
-        double last_mono = 0.0;
+        // Update right away for a new script, by the runner's deadline,
+        // or when media loads (but then at most once per main loop period).
+        std::shared_ptr<Script const> applied;
+        double last_mono = 0.0;  // When the last update started
+        double next_mono = 0.0;  // The runner's deadline for the next update
+        bool loaded = false;     // Woken by media loading since last update
         std::unique_lock lock{mutex};
         while (!shutdown) {
             if (!script) {
@@ -96,23 +128,31 @@ class Server {
             ASSERT(script->main_loop_hz > 0.0);
             double const period = 1.0 / script->main_loop_hz;
             double const mono = cx.sys->clock(CLOCK_MONOTONIC);
-            if (mono < last_mono + period) {
-                TRACE(
-                    logger, "UPDATE (sleep {:.3f}s)",
-                    last_mono + period - mono
-                );
+            double const due =
+                loaded ? std::min(next_mono, last_mono + period) : next_mono;
+            if (script == applied && mono < due) {
+                TRACE(logger, "UPDATE (sleep {:.3f}s)", due - mono);
                 lock.unlock();
-                wakeup_mono->sleep_until(last_mono + period);
+                if (std::isinf(due)) {
+                    wakeup_mono->sleep();
+                    loaded = true;
+                } else {
+                    loaded = wakeup_mono->sleep_until(due) || loaded;
+                }
                 lock.lock();
                 continue;
             }
 
             DEBUG(logger, "UPDATE (mono={:.3f}s)", mono);
-            last_mono = std::max(last_mono + period, mono - period);
-            auto const copy = script;
+            auto const copy = applied = script;
             lock.unlock();
-            cx.runner->update(*copy);
+            double const next = cx.runner->update(*copy);
+            double const wait = next - cx.sys->clock();
             lock.lock();
+
+            last_mono = mono;
+            next_mono = cx.sys->clock(CLOCK_MONOTONIC) + wait;
+            loaded = false;
         }
 
         TRACE(logger, "Main loop thread stopped");
@@ -218,6 +258,35 @@ class Server {
         res.set_content(j.dump(), "application/json");
     }
 
+    void on_stats(httplib::Request const& req, httplib::Response& res) {
+        nlohmann::json j = {{"req", req.path}, {"ok", true}};
+        auto* screens_j = &j["screens"];
+        *screens_j = nlohmann::json::object();
+        auto const underruns = cx.runner->underrun_stats();
+        for (auto const& [connector, st] : cx.runner->screen_stats()) {
+            (*screens_j)[connector] = {
+                {"shown", st.shown},
+                {"empty", st.empty},
+                {"late", st.late},
+                {"skipped", st.skipped},
+                {"errors", st.errors},
+                {"flip_delta", histogram_json(st.flip_delta)},
+                {"commit_time", histogram_json(st.commit_time)},
+            };
+
+            auto const it = underruns.find(connector);
+            if (it != underruns.end()) {
+                (*screens_j)[connector]["underruns"] = {
+                    {"black", it->second.black},
+                    {"nearest", it->second.nearest},
+                    {"previous", it->second.previous},
+                };
+            }
+        }
+
+        res.set_content(j.dump(), "application/json");
+    }
+
     void on_quit(httplib::Request const& req, httplib::Response& res) {
         std::unique_lock lock{mutex};
         DEBUG(logger, "STOP");
@@ -260,16 +329,37 @@ class Server {
 
 extern "C" int main(int const argc, char const* const* const argv) {
     std::string dev_arg;
+    std::string capture_arg;
+    std::string cost_model_arg;
     std::string log_arg;
     std::string media_root_arg;
+    int player_cpu_arg = -1;
+    int rt_priority_arg = 0;
+    bool lock_memory = false;
 
     ScriptContext script_cx;
     ServerContext server_cx;
 
     CLI::App app("Serve HTTP REST API for video playback");
-    app.add_option("--dev", dev_arg, "DRM driver /dev file or hardware path");
+    app.add_option(
+        "--dev", dev_arg,
+        "DRM driver /dev file or hardware path, or \"virtual\""
+    );
+    app.add_option(
+        "--capture_dir", capture_arg, "Save writeback screens as TIFF here"
+    );
+    app.add_option(
+        "--cost_model", cost_model_arg, "Display cost model (calibration JSON)"
+    );
     app.add_option("--log", log_arg, "Log level/configuration");
     app.add_option("--port", server_cx.port, "TCP port to listen on");
+    app.add_option(
+        "--player_cpu", player_cpu_arg, "CPU to reserve for frame players"
+    );
+    app.add_option(
+        "--rt_priority", rt_priority_arg, "SCHED_FIFO priority for players"
+    );
+    app.add_flag("--lock_memory", lock_memory, "Lock all memory in RAM");
     app.add_option(
         "--media_root", script_cx.root_dir, "Media directory"
     )->required();
@@ -283,17 +373,66 @@ extern "C" int main(int const argc, char const* const* const argv) {
 
     try {
         server_cx.sys = global_system();
-        for (auto const& dev : list_display_drivers(server_cx.sys)) {
-            auto const text = debug(dev);
-            if (text.find(dev_arg) == std::string::npos) continue;
-            server_cx.driver = open_display_driver(server_cx.sys, dev.dev_file);
-            break;
+
+        // Players (and flip handling) get the reserved CPU, others the rest;
+        // threads started later inherit this thread's policy.
+        ThreadPolicy player_policy = {}, worker_policy = {};
+        player_policy.realtime_priority = rt_priority_arg;
+        if (player_cpu_arg >= 0) {
+            player_policy.cpus = {player_cpu_arg};
+            int const cpus = std::thread::hardware_concurrency();
+            for (int cpu = 0; cpu < cpus; ++cpu) {
+                if (cpu != player_cpu_arg) worker_policy.cpus.push_back(cpu);
+            }
+        }
+
+        auto const policy_ret = server_cx.sys->set_thread_policy(worker_policy);
+        policy_ret.ex("Main thread policy");
+        if (lock_memory) server_cx.sys->lock_memory().ex("Lock memory");
+
+        DisplayDriverOptions driver_options = {};
+        driver_options.event_thread_policy = player_policy;
+        if (!cost_model_arg.empty()) {
+            logger->info("Cost model: {}", cost_model_arg);
+            driver_options.cost_model =
+                parse_cost_model(read_text(cost_model_arg));
+        }
+
+        if (!capture_arg.empty()) {
+            CaptureRecorderOptions recorder_options = {};
+            recorder_options.dir = capture_arg;
+            std::shared_ptr const recorder =
+                start_capture_recorder(server_cx.sys, recorder_options);
+            driver_options.capture_sink = [recorder](DisplayCapture c) {
+                recorder->record(std::move(c));
+            };
+        }
+
+        if (dev_arg == "virtual") {
+            VirtualDisplayOptions virtual_options = {};
+            if (driver_options.cost_model)
+                virtual_options.cost_model = *driver_options.cost_model;
+            server_cx.driver =
+                open_virtual_display_driver(server_cx.sys, virtual_options);
+        } else {
+            for (auto const& dev : list_display_drivers(server_cx.sys)) {
+                auto const text = debug(dev);
+                if (text.find(dev_arg) == std::string::npos) continue;
+                server_cx.driver = open_display_driver(
+                    server_cx.sys, dev.dev_file, driver_options
+                );
+                break;
+            }
         }
         CHECK_RUNTIME(server_cx.driver, "No DRM device for \"{}\"", dev_arg);
 
         script_cx.sys = server_cx.sys;
         script_cx.driver = server_cx.driver;
+        script_cx.loader_cx.thread_policy = worker_policy;
+        script_cx.player_policy = player_policy;
         script_cx.file_base = script_cx.root_dir;
+        server_cx.wakeup = server_cx.sys->make_flag(CLOCK_MONOTONIC);
+        script_cx.notify = server_cx.wakeup;
         server_cx.default_zero_time = server_cx.sys->clock();
 
         logger->info("Media root: {}", script_cx.root_dir);
@@ -9,6 +9,7 @@
 #include <nlohmann/json.hpp>
 
 #include "logging_policy.h"
+#include "script_plan.h"
 #include "unix_system.h"
 
 using json = nlohmann::json;
@@ -176,6 +177,18 @@ static void from_json(json const& j, ScriptMode& mode) {
     }
 }
 
+static void from_json(json const& j, ScriptUnderrun& underrun) {
+    CHECK_ARG(j.is_string(), "Bad JSON underrun: {}", j.dump());
+    auto const& name = j.get_ref<std::string const&>();
+    CHECK_ARG(
+        name == "black" || name == "nearest" || name == "previous",
+        "Bad JSON underrun: {}", j.dump()
+    );
+    underrun = (name == "nearest") ? ScriptUnderrun::nearest
+        : (name == "previous") ? ScriptUnderrun::previous
+        : ScriptUnderrun::black;
+}
+
 static void from_json(json const& j, ScriptLayer& layer) {
     CHECK_ARG(j.is_object(), "Bad JSON layer: {}", j.dump());
     layer.media = j.value("media", "");
@@ -189,6 +202,7 @@ static void from_json(json const& j, ScriptLayer& layer) {
     j.value("opacity", json()).get_to(layer.opacity);
     j.value("reflect", json(false)).get_to(layer.reflect);
     j.value("rotate", json(0)).get_to(layer.rotate);
+    j.value("underrun", json("black")).get_to(layer.underrun);
 }
 
 static void from_json(json const& j, ScriptScreen& screen) {
@@ -203,6 +217,7 @@ static void from_json(json const& j, ScriptScreen& screen) {
         "JSON update_hz > mode hz: {}", j.dump()
     );
 
+    j.value("group", json("")).get_to(screen.group);
     j.value("layers", json::array()).get_to(screen.layers);
     CHECK_ARG(
         screen.layers.empty() || screen.mode.hz,
@@ -220,6 +235,7 @@ Script parse_script(std::string_view text, double default_zero_time) {
         s.zero_time = j.value("zero_time", default_zero_time);
         s.main_loop_hz = j.value("main_loop_hz", s.main_loop_hz);
         CHECK_ARG(s.main_loop_hz > 0.0, "Bad main_loop_hz: {}", j.dump());
+        s.plan = std::make_shared<ScriptPlan const>(compile_script(s));
         return s;
     } catch (nlohmann::json::exception const& e) {
         std::throw_with_nested(std::invalid_argument(e.what()));
@@ -5,6 +5,7 @@
 
 #include <limits>
 #include <map>
+#include <memory>
 #include <string>
 
 #include <nlohmann/json_fwd.hpp>
@@ -14,6 +15,8 @@
 
 namespace pivid {
 
+struct ScriptPlan;
+
 // A begin/end preload directive for a given media file.
 struct ScriptPreload {
     BezierSpline begin;
@@ -34,6 +37,13 @@ struct ScriptMode {
     auto operator<=>(ScriptMode const&) const = default;
 };
 
+// What to show for a layer when its frame isn't loaded in time.
+enum class ScriptUnderrun {
+    black,     // Omit the layer
+    nearest,   // Show the loaded frame closest in time
+    previous,  // Show the last loaded frame before the wanted one
+};
+
 // One item to layer into the output screen, sourced from a media file,
 // with Bezier-specified position in the file and on the screen.
 struct ScriptLayer {
@@ -43,15 +53,19 @@ struct ScriptLayer {
     XY<BezierSpline> from_xy, from_size;
     XY<BezierSpline> to_xy, to_size;
     BezierSpline opacity;
-    bool reflect;
-    int rotate;
+    bool reflect = false;
+    int rotate = 0;
+    ScriptUnderrun underrun = ScriptUnderrun::black;
+    bool operator==(ScriptLayer const&) const = default;
 };
 
 // Description of what to render on a particular screen.
 struct ScriptScreen {
     ScriptMode mode;
     double update_hz = 0.0;  // How often to change screen content
+    std::string group;       // Screens in the same group flip together
     std::vector<ScriptLayer> layers;  // What to show
+    bool operator==(ScriptScreen const&) const = default;
 };
 
 // An entire parsed play script, including global parameters and all screens.
@@ -60,10 +74,12 @@ struct Script {
     std::map<std::string, ScriptScreen> screens;  // Contents by connector name
     double zero_time = 0.0;         // Make all timestamps relative to this
     double main_loop_hz = 30.0;     // Refresh frame timelines this often
+    std::shared_ptr<ScriptPlan const> plan;  // Compiled from the above
 };
 
 // Returns a script parsed from text.
 // If the script does not specify zero_time, default_zero_time is used.
+// The returned script includes its compiled plan.
 Script parse_script(std::string_view, double default_zero_time);
 
 }  // namespace pivid
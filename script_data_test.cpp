@@ -25,6 +25,7 @@ TEST_CASE("from_json") {
         "full_screen": {
           "mode": [1920, 1080, 30],
           "update_hz": 15.5,
+          "group": "wall",
           "layers": [
             {"media": "empty_layer"},
             {
@@ -42,7 +43,8 @@ TEST_CASE("from_json") {
                 "repeat": true
               },
               "reflect": true,
-              "rotate": 90
+              "rotate": 90,
+              "underrun": "nearest"
             }
           ]
         }
@@ -114,6 +116,7 @@ TEST_CASE("from_json") {
     CHECK(script.screens["empty_screen"].mode.size.y == 0);
     CHECK(script.screens["empty_screen"].mode.hz == 0);
     CHECK(script.screens["empty_screen"].update_hz == 0.0);
+    CHECK(script.screens["empty_screen"].group.empty());
     CHECK(script.screens["empty_screen"].layers.empty());
 
     REQUIRE(script.screens.count("full_screen") == 1);
@@ -122,6 +125,7 @@ TEST_CASE("from_json") {
     CHECK(screen.mode.size.y == 1080);
     CHECK(screen.mode.hz == 30);
     CHECK(screen.update_hz == Approx(15.5));
+    CHECK(screen.group == "wall");
     REQUIRE(screen.layers.size() == 2);
     CHECK(screen.layers[0].media == "empty_layer");
     CHECK(screen.layers[0].play.segments.size() == 1);  // Default
@@ -132,6 +136,7 @@ TEST_CASE("from_json") {
     CHECK(screen.layers[0].buffer == 0.2);
     CHECK(!screen.layers[0].reflect);
     CHECK(screen.layers[0].rotate == 0);
+    CHECK(screen.layers[0].underrun == ScriptUnderrun::black);
 
     CHECK(screen.layers[1].media == "full_layer");
     REQUIRE(screen.layers[1].play.segments.size() == 1);
@@ -164,6 +169,7 @@ TEST_CASE("from_json") {
     CHECK(screen.layers[1].to_size.x.segments[0].begin_v == 700);
     CHECK(screen.layers[1].reflect);
     CHECK(screen.layers[1].rotate == 90);
+    CHECK(screen.layers[1].underrun == ScriptUnderrun::nearest);
 
     REQUIRE(screen.layers[1].opacity.segments.size() == 2);
     CHECK(screen.layers[1].opacity.repeat == 10.0);
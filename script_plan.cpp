@@ -0,0 +1,304 @@
+#include "script_plan.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "logging_policy.h"
+#include "script_data.h"
+
+namespace pivid {
+
+namespace {
+
+PlanSpline compile_spline(BezierSpline const& bez, PlanSegments* out) {
+    auto const& segs = bez.segments;
+    CHECK_ARG(bez.repeat >= 0, "Bad Bezier repeat: {}", bez.repeat);
+
+    PlanSpline plan = {};
+    plan.repeat = bez.repeat;
+    if (segs.empty()) return plan;
+
+    // Fold splines with one value over one contiguous time range
+    bool contiguous = true, constant = true;
+    double const v = segs[0].begin_v;
+    double const inf = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < segs.size(); ++i) {
+        auto const& seg = segs[i];
+        CHECK_ARG(
+            seg.t.end >= seg.t.begin,
+            "Bad Bezier: bt={} > et={}", seg.t.begin, seg.t.end
+        );
+        if (i > 0 && seg.t.begin != segs[i - 1].t.end) contiguous = false;
+        if (seg.begin_v != v || seg.p1_v != v) constant = false;
+        if (seg.p2_v != v || seg.end_v != v) constant = false;
+    }
+
+    if (contiguous && constant) {
+        Interval const t{segs.front().t.begin, segs.back().t.end};
+        if (!bez.repeat) {
+            plan.constant = v;
+            plan.constant_t = t;
+            return plan;
+        } else if (t.end - t.begin >= bez.repeat) {
+            plan.constant = v;
+            plan.constant_t = {t.begin, inf};
+            plan.repeat = 0.0;
+            return plan;
+        }
+    }
+
+    plan.first = out->begin_t.size();
+    plan.count = segs.size();
+    for (auto const& seg : segs) {
+        // Expand the Bezier's Bernstein polynomials into powers of f
+        double const len = seg.t.end - seg.t.begin;
+        double const b = seg.begin_v, p1 = seg.p1_v, p2 = seg.p2_v;
+        double const e = seg.end_v;
+        out->begin_t.push_back(seg.t.begin);
+        out->end_t.push_back(seg.t.end);
+        out->len_t.push_back(len > 0 ? len : 1.0);
+        out->c0.push_back(len > 0 ? b : 0.5 * (b + e));
+        out->c1.push_back(len > 0 ? 3 * (p1 - b) : 0.0);
+        out->c2.push_back(len > 0 ? 3 * (b - 2 * p1 + p2) : 0.0);
+        out->c3.push_back(len > 0 ? e - b + 3 * (p1 - p2) : 0.0);
+    }
+    return plan;
+}
+
+size_t const no_segment = std::numeric_limits<size_t>::max();
+
+// Returns the (absolute) index of the last segment beginning at or before t,
+// or no_segment; if a cursor is given, starts there and updates it.
+size_t find_segment(
+    PlanSegments const& segs, PlanSpline const& spline, double t,
+    PlanCursor* cursor
+) {
+    auto const* begin_t = segs.begin_t.data() + spline.first;
+    auto const count = spline.count;
+    uint32_t i = cursor ? std::min(cursor->index, count - 1) : 0;
+    if (cursor && begin_t[i] <= t) {
+        // Step ahead a little, then search if t has moved further
+        for (int step = 0; step < 4; ++step) {
+            if (i + 1 >= count || begin_t[i + 1] > t) break;
+            ++i;
+        }
+        if (i + 1 < count && begin_t[i + 1] <= t) {
+            auto const stop = begin_t + count;
+            i = std::upper_bound(begin_t + i, stop, t) - begin_t - 1;
+        }
+    } else {
+        auto const after = std::upper_bound(begin_t, begin_t + count, t);
+        if (after == begin_t) return no_segment;
+        i = after - begin_t - 1;
+    }
+
+    if (cursor) cursor->index = i;
+    return spline.first + i;
+}
+
+double segment_value(PlanSegments const& segs, size_t i, double t) {
+    double const f = (t - segs.begin_t[i]) / segs.len_t[i];
+    return segs.c0[i] + f * (segs.c1[i] + f * (segs.c2[i] + f * segs.c3[i]));
+}
+
+// Adds the values of segment i over part of its time range.
+void add_segment_range(
+    PlanSegments const& segs, size_t i, Interval t, IntervalSet* out
+) {
+    t.begin = std::max(t.begin, segs.begin_t[i]);
+    t.end = std::min(t.end, segs.end_t[i]);
+    if (t.empty()) return;
+
+    double const begin_v = segment_value(segs, i, t.begin);
+    double const end_v = segment_value(segs, i, t.end);
+    double min_v = std::min(begin_v, end_v);
+    double max_v = std::max(begin_v, end_v);
+
+    // Check extremes, where the derivative (c1 + 2c2 f + 3c3 f^2) is zero
+    double const a = 3 * segs.c3[i], b = 2 * segs.c2[i], c = segs.c1[i];
+    double roots[2] = {-1.0, -1.0};
+    if (a != 0) {
+        double const d = b * b - 4 * a * c;
+        if (d >= 0) {
+            roots[0] = (-b - std::sqrt(d)) / (2 * a);
+            roots[1] = (-b + std::sqrt(d)) / (2 * a);
+        }
+    } else if (b != 0) {
+        roots[0] = -c / b;
+    }
+
+    for (double const f : roots) {
+        double const root_t = segs.begin_t[i] + f * segs.len_t[i];
+        if (f < 0 || !(root_t >= t.begin && root_t <= t.end)) continue;
+        double const root_v = segment_value(segs, i, root_t);
+        min_v = std::min(min_v, root_v);
+        max_v = std::max(max_v, root_v);
+    }
+
+    if (max_v <= min_v)
+        max_v = std::nextafter(min_v, std::numeric_limits<double>::max());
+    out->insert({min_v, max_v});
+}
+
+// Adds the values of a (nonrepeating) spline's segments over a time range.
+void add_range_nowrap(
+    PlanSegments const& segs, PlanSpline const& spline, Interval t,
+    PlanCursor* cursor, IntervalSet* out
+) {
+    size_t i = find_segment(segs, spline, t.begin, cursor);
+    if (i == no_segment) i = spline.first;
+    size_t const end = spline.first + spline.count;
+    for (; i < end && segs.begin_t[i] <= t.end; ++i)
+        add_segment_range(segs, i, t, out);
+}
+
+XY<PlanSpline> compile_xy(XY<BezierSpline> const& xy, PlanSegments* out) {
+    return {compile_spline(xy.x, out), compile_spline(xy.y, out)};
+}
+
+}  // anonymous namespace
+
+std::optional<double> PlanSpline::value(
+    PlanSegments const& segs, double t, PlanCursor* cursor
+) const {
+    if (constant) {
+        if (t < constant_t.begin || t > constant_t.end) return {};
+        return *constant;
+    }
+
+    if (!count) return {};
+    if (repeat) {
+        double const begin = segs.begin_t[first];
+        if (t < begin) return {};
+        t = std::fmod(t - begin, repeat) + begin;
+    }
+
+    size_t const i = find_segment(segs, *this, t, cursor);
+    if (i == no_segment) return {};
+    ASSERT(segs.begin_t[i] <= t);
+    if (t > segs.end_t[i]) return {};
+    return segment_value(segs, i, t);
+}
+
+void PlanSpline::values(
+    PlanSegments const& segs, std::vector<double> const& t,
+    std::vector<double>* out
+) const {
+    double const nan = std::numeric_limits<double>::quiet_NaN();
+    double const inf = std::numeric_limits<double>::infinity();
+    out->resize(t.size());
+    double* const o = out->data();
+    size_t const n = t.size();
+
+    PlanCursor cursor = {};
+    if (constant || repeat || !count) {
+        for (size_t k = 0; k < n; ++k)
+            o[k] = value(segs, t[k], &cursor).value_or(nan);
+        return;
+    }
+
+    size_t k = 0;
+    while (k < n) {
+        size_t const i = find_segment(segs, *this, t[k], &cursor);
+        if (i == no_segment || t[k] > segs.end_t[i]) {
+            o[k++] = nan;
+            continue;
+        }
+
+        // Find the run of times in this segment, then evaluate them together
+        // in a simple loop the compiler can vectorize.
+        double const begin = segs.begin_t[i], end = segs.end_t[i];
+        double const next = (i + 1 < first + count) ? segs.begin_t[i + 1] : inf;
+        size_t run_end = k + 1;
+        while (run_end < n) {
+            double const rt = t[run_end];
+            if (rt < begin || rt > end || rt >= next) break;
+            ++run_end;
+        }
+
+        double const len = segs.len_t[i];
+        double const c0 = segs.c0[i], c1 = segs.c1[i];
+        double const c2 = segs.c2[i], c3 = segs.c3[i];
+        for (size_t r = k; r < run_end; ++r) {
+            double const f = (t[r] - begin) / len;
+            o[r] = c0 + f * (c1 + f * (c2 + f * c3));
+        }
+        k = run_end;
+    }
+}
+
+IntervalSet PlanSpline::range(
+    PlanSegments const& segs, Interval t, PlanCursor* cursor
+) const {
+    IntervalSet out;
+    if (t.empty()) return out;
+    if (constant) {
+        Interval const overlap{
+            std::max(t.begin, constant_t.begin),
+            std::min(t.end, constant_t.end)
+        };
+        if (overlap.empty()) return out;
+        double const max = std::numeric_limits<double>::max();
+        out.insert({*constant, std::nextafter(*constant, max)});
+        return out;
+    }
+
+    if (!count) return out;
+    if (!repeat) {
+        add_range_nowrap(segs, *this, t, cursor, &out);
+        return out;
+    }
+
+    // Unwrap repeats like BezierSpline::range()
+    double const begin = segs.begin_t[first];
+    double const repeat_at = begin + repeat;
+    t.begin = std::max(t.begin, begin);
+    if (t.end - t.begin > repeat) {
+        add_range_nowrap(segs, *this, {begin, repeat_at}, cursor, &out);
+        return out;
+    }
+
+    Interval wrapped;
+    wrapped.begin = begin + std::fmod(t.begin - begin, repeat);
+    wrapped.end = wrapped.begin + (t.end - t.begin);
+    if (wrapped.end <= repeat_at) {
+        add_range_nowrap(segs, *this, wrapped, cursor, &out);
+        return out;
+    }
+
+    Interval const tail{wrapped.begin, repeat_at};
+    Interval const head{begin, begin + (wrapped.end - repeat_at)};
+    add_range_nowrap(segs, *this, tail, cursor, &out);
+    add_range_nowrap(segs, *this, head, cursor, &out);
+    return out;
+}
+
+ScriptPlan compile_script(Script const& script) {
+    ScriptPlan plan = {};
+    std::map<std::string, uint32_t> media_ids;
+    for (auto const& [connector, screen] : script.screens) {
+        auto* plan_screen = &plan.screens[connector];
+        plan_screen->layers.reserve(screen.layers.size());
+        for (auto const& layer : screen.layers) {
+            auto* segs = &plan.segments;
+            auto* out = &plan_screen->layers.emplace_back();
+            auto const [it, added] =
+                media_ids.try_emplace(layer.media, plan.media.size());
+            if (added) plan.media.push_back(layer.media);
+            out->media = it->second;
+            out->play = compile_spline(layer.play, segs);
+            out->from_xy = compile_xy(layer.from_xy, segs);
+            out->from_size = compile_xy(layer.from_size, segs);
+            out->to_xy = compile_xy(layer.to_xy, segs);
+            out->to_size = compile_xy(layer.to_size, segs);
+            out->opacity = compile_spline(layer.opacity, segs);
+            out->reflect = layer.reflect;
+            out->rotate = layer.rotate;
+            out->underrun = layer.underrun;
+        }
+    }
+    return plan;
+}
+
+}  // namespace pivid
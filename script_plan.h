@@ -0,0 +1,86 @@
+// Compiled form of a play script, flattened for repeated evaluation
+// by the script runner on every main loop update.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "interval.h"
+#include "script_data.h"
+#include "xy.h"
+
+namespace pivid {
+
+// Segments of all the splines in a plan, in structure-of-arrays form
+// (segment i is begin_t[i], end_t[i], len_t[i], c0[i], ...). Each segment
+// is stored as a power-basis cubic in f = (t - begin_t) / len_t, that is
+// c0 + f * (c1 + f * (c2 + f * c3)), rather than as Bezier control points.
+struct PlanSegments {
+    std::vector<double> begin_t, end_t, len_t;
+    std::vector<double> c0, c1, c2, c3;
+};
+
+// Position in a spline's segments, kept between calls to speed up lookups
+// at nondecreasing times (as when stepping through timeline slots).
+struct PlanCursor {
+    uint32_t index = 0;  // Last segment used, relative to PlanSpline::first
+};
+
+// A spline in a plan: a run of PlanSegments, or if every segment has the
+// same value, that value (folded) and the time range where it's defined.
+struct PlanSpline {
+    uint32_t first = 0, count = 0;    // Range in PlanSegments, if not folded
+    double repeat = 0.0;              // As in BezierSpline
+    std::optional<double> constant;   // Folded value, if constant
+    Interval constant_t;              // Where the folded value is defined
+
+    // Returns the value at t, like BezierSpline::value().
+    std::optional<double> value(
+        PlanSegments const&, double t, PlanCursor* = nullptr
+    ) const;
+
+    // Evaluates at each of a series of times (fastest if nondecreasing),
+    // with NaN for times where the spline has no value.
+    void values(
+        PlanSegments const&, std::vector<double> const& t,
+        std::vector<double>* out
+    ) const;
+
+    // Returns the values taken over a time range, like BezierSpline::range().
+    IntervalSet range(
+        PlanSegments const&, Interval t, PlanCursor* = nullptr
+    ) const;
+};
+
+// A screen layer from a script, with media interned and splines compiled.
+struct PlanLayer {
+    uint32_t media = 0;  // Index into ScriptPlan::media
+    PlanSpline play;
+    XY<PlanSpline> from_xy, from_size;
+    XY<PlanSpline> to_xy, to_size;
+    PlanSpline opacity;
+    bool reflect = false;
+    int rotate = 0;
+    ScriptUnderrun underrun = ScriptUnderrun::black;
+};
+
+// Compiled layers of one screen, parallel to ScriptScreen::layers.
+struct PlanScreen {
+    std::vector<PlanLayer> layers;
+};
+
+// A whole compiled script; splines refer to the shared segment storage.
+struct ScriptPlan {
+    std::vector<std::string> media;             // Distinct media, by ID
+    std::map<std::string, PlanScreen> screens;  // By connector name
+    PlanSegments segments;                      // For all PlanSplines
+};
+
+// Returns the compiled plan for a script (parse_script() does this).
+ScriptPlan compile_script(Script const&);
+
+}  // namespace pivid
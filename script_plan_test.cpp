@@ -0,0 +1,240 @@
+#include "script_plan.h"
+
+#include <chrono>
+#include <cmath>
+
+#include <doctest/doctest.h>
+#include <fmt/core.h>
+
+#include "script_data.h"
+
+namespace pivid {
+
+TEST_CASE("compile_script") {
+    auto const text = R"**({
+      "screens": {
+        "A": {
+          "mode": [1920, 1080, 30],
+          "layers": [
+            {"media": "one", "play": {"t": 1, "rate": 2}, "opacity": 0.5},
+            {
+              "media": "two",
+              "to_xy": [10, 20],
+              "opacity": {
+                "segments": [
+                  {"t": [0, 5], "v": [0.0, 1.0]},
+                  {"t": [5, 7], "v": [1.0, 0.0]}
+                ],
+                "repeat": 10
+              }
+            }
+          ]
+        },
+        "B": {
+          "mode": [1920, 1080, 30],
+          "layers": [{"media": "one", "reflect": true, "rotate": 90}]
+        }
+      }
+    })**";
+
+    Script const script = parse_script(text, 0.0);
+    REQUIRE(script.plan);
+    auto const& plan = *script.plan;
+    auto const& segs = plan.segments;
+
+    REQUIRE(plan.media.size() == 2);
+    CHECK(plan.media[0] == "one");
+    CHECK(plan.media[1] == "two");
+
+    REQUIRE(plan.screens.size() == 2);
+    auto const& a = plan.screens.at("A").layers;
+    auto const& b = plan.screens.at("B").layers;
+    REQUIRE(a.size() == 2);
+    REQUIRE(b.size() == 1);
+    CHECK(a[0].media == 0);
+    CHECK(a[1].media == 1);
+    CHECK(b[0].media == 0);
+    CHECK(b[0].reflect);
+    CHECK(b[0].rotate == 90);
+
+    // Constants are folded; only the play ramp and opacity keep segments
+    CHECK(a[0].opacity.constant == 0.5);
+    CHECK(a[1].to_xy.x.constant == 10.0);
+    CHECK(a[1].to_xy.y.constant == 20.0);
+    CHECK(b[0].play.constant == 0.0);
+    CHECK_FALSE(a[0].play.constant);
+    CHECK_FALSE(a[1].opacity.constant);
+    CHECK(segs.begin_t.size() == 3);
+    CHECK(segs.c3.size() == 3);
+
+    auto const& script_a = script.screens.at("A").layers;
+    for (double t = -2.0; t < 30.0; t += 0.25) {
+        CAPTURE(t);
+        auto const check = [&](BezierSpline const& bz, PlanSpline const& ps) {
+            auto const want = bz.value(t);
+            auto const got = ps.value(segs, t);
+            REQUIRE(bool(got) == bool(want));
+            if (want) CHECK(*got == doctest::Approx(*want));
+        };
+
+        check(script_a[0].play, a[0].play);
+        check(script_a[0].opacity, a[0].opacity);
+        check(script_a[1].opacity, a[1].opacity);
+        check(script_a[1].to_xy.x, a[1].to_xy.x);
+        check(script_a[1].from_size.x, a[1].from_size.x);
+    }
+}
+
+TEST_CASE("PlanSpline::values") {
+    BezierSpline bz = {};
+    bz.segments.push_back({
+        .t = {1.0, 4.0},
+        .begin_v = 10.0, .p1_v = 20.0, .p2_v = 30.0, .end_v = 40.0,
+    });
+    bz.segments.push_back({
+        .t = {5.0, 8.0},
+        .begin_v = 10.0, .p1_v = 30.0, .p2_v = 50.0, .end_v = 40.0,
+    });
+    bz.segments.push_back({
+        .t = {8.0, 8.0},
+        .begin_v = 60.0, .p1_v = 60.0, .p2_v = 70.0, .end_v = 80.0,
+    });
+    bz.segments.push_back({
+        .t = {11.0, INFINITY},
+        .begin_v = 50.0, .p1_v = 60.0, .p2_v = 70.0, .end_v = 80.0,
+    });
+
+    Script script = {};
+    script.screens["A"].layers.emplace_back().play = bz;
+    script.screens["A"].layers[0].opacity = bz;
+    script.screens["A"].layers[0].opacity.repeat = 9.0;
+    auto const plan = compile_script(script);
+    auto const& layer = plan.screens.at("A").layers[0];
+
+    std::vector<double> t;
+    for (double rt = 0.0; rt < 30.0; rt += 0.125) t.push_back(rt);
+    t.push_back(2.0);  // Backwards, to exercise cursor fallback
+
+    auto const check = [&](BezierSpline const& bz, PlanSpline const& ps) {
+        std::vector<double> batch;
+        ps.values(plan.segments, t, &batch);
+        REQUIRE(batch.size() == t.size());
+
+        PlanCursor cursor = {};
+        for (size_t i = 0; i < t.size(); ++i) {
+            CAPTURE(t[i]);
+            auto const want = bz.value(t[i]);
+            auto const got = ps.value(plan.segments, t[i], &cursor);
+            REQUIRE(bool(got) == bool(want));
+            REQUIRE(std::isnan(batch[i]) == !want);
+            if (want) {
+                CHECK(*got == doctest::Approx(*want));
+                CHECK(batch[i] == doctest::Approx(*want));
+            }
+        }
+    };
+
+    auto const& source = script.screens.at("A").layers[0];
+    check(source.play, layer.play);
+    check(source.opacity, layer.opacity);
+}
+
+TEST_CASE("PlanSpline::range") {
+    BezierSpline bz = {};
+    bz.segments.push_back({
+        .t = {1.0, 4.0},
+        .begin_v = 10.0, .p1_v = 50.0, .p2_v = -20.0, .end_v = 40.0,
+    });
+    bz.segments.push_back({
+        .t = {5.0, 8.0},
+        .begin_v = 10.0, .p1_v = 30.0, .p2_v = 35.0, .end_v = 10.0,
+    });
+    bz.segments.push_back(constant_segment({8.0, 10.0}, 7.0));
+
+    Script script = {};
+    script.screens["A"].layers.emplace_back().play = bz;
+    script.screens["A"].layers[0].opacity = bz;
+    script.screens["A"].layers[0].opacity.repeat = 11.0;
+    script.screens["A"].layers[0].to_xy.x = {{constant_segment({2, 6}, 3)}};
+    auto const plan = compile_script(script);
+    auto const& layer = plan.screens.at("A").layers[0];
+
+    auto const check = [&](BezierSpline const& bz, PlanSpline const& ps) {
+        PlanCursor cursor = {};
+        for (double begin = 0.0; begin < 30.0; begin += 0.25) {
+            for (double len : {0.0, 0.1, 0.75, 2.5, 12.0}) {
+                Interval const t{begin, begin + len};
+                CAPTURE(begin);
+                CAPTURE(len);
+                auto const want = bz.range(t);
+                auto const got = ps.range(plan.segments, t, &cursor);
+                REQUIRE(got.count() == want.count());
+                auto g = got.begin();
+                for (auto const& w : want) {
+                    CHECK(g->begin == doctest::Approx(w.begin));
+                    CHECK(g->end == doctest::Approx(w.end));
+                    ++g;
+                }
+            }
+        }
+    };
+
+    auto const& source = script.screens.at("A").layers[0];
+    check(source.play, layer.play);
+    check(source.opacity, layer.opacity);
+    check(source.to_xy.x, layer.to_xy.x);
+}
+
+// Run with --no-skip to compare BezierSpline::value() with PlanSpline.
+TEST_CASE("PlanSpline throughput" * doctest::skip()) {
+    BezierSpline bz = {};
+    for (int s = 0; s < 100; ++s) {
+        bz.segments.push_back({
+            .t = {s * 1.0, s + 1.0},
+            .begin_v = s * 10.0, .p1_v = s * 10.0 + 5.0,
+            .p2_v = s * 10.0 - 5.0, .end_v = s * 10.0 + 10.0,
+        });
+    }
+
+    Script script = {};
+    script.screens["A"].layers.emplace_back().play = bz;
+    auto const plan = compile_script(script);
+    auto const& spline = plan.screens.at("A").layers[0].play;
+
+    std::vector<double> t, out(4096);
+    for (size_t i = 0; i < out.size(); ++i) t.push_back(i * 100.0 / out.size());
+
+    int const reps = 1000;
+    auto const time = [&](char const* name, auto&& eval) {
+        double sum = 0.0;
+        auto const start = std::chrono::steady_clock::now();
+        for (int r = 0; r < reps; ++r) {
+            eval();
+            sum += out[r % out.size()];
+        }
+        std::chrono::duration<double> const d =
+            std::chrono::steady_clock::now() - start;
+        MESSAGE(fmt::format(
+            "{}: {:.1f}ns/value (sum={})",
+            name, d.count() / reps / t.size() * 1e9, sum
+        ));
+    };
+
+    time("BezierSpline::value", [&] {
+        for (size_t i = 0; i < t.size(); ++i) out[i] = *bz.value(t[i]);
+    });
+    time("PlanSpline::value", [&] {
+        for (size_t i = 0; i < t.size(); ++i)
+            out[i] = *spline.value(plan.segments, t[i]);
+    });
+    time("PlanSpline::value (cursor)", [&] {
+        PlanCursor cursor = {};
+        for (size_t i = 0; i < t.size(); ++i)
+            out[i] = *spline.value(plan.segments, t[i], &cursor);
+    });
+    time("PlanSpline::values", [&] {
+        spline.values(plan.segments, t, &out);
+    });
+}
+
+}  // namespace pivid
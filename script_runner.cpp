@@ -1,12 +1,23 @@
 #include "script_runner.h"
 
+#include <pthread.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <exception>
+#include <limits>
 #include <mutex>
 #include <optional>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include "display_output.h"
 #include "frame_loader.h"
 #include "frame_player.h"
 #include "logging_policy.h"
+#include "script_plan.h"
 
 namespace pivid {
 
@@ -54,13 +65,72 @@ bool matches(ScriptMode const& sm, DisplayMode const& dm) {
     return sm.size == dm.size && sm.hz == dm.nominal_hz;
 }
 
+// Returns false if a layer with the given opacity and placement is certainly
+// invisible on a screen (of zero size if unknown). NaN values are unknown.
+bool maybe_visible(
+    XY<int> screen, double opacity, XY<double> xy, XY<double> size
+) {
+    if (opacity <= 0 || size.x <= 0 || size.y <= 0) return false;
+    if (screen.x > 0 && (xy.x >= screen.x || xy.x + size.x <= 0)) return false;
+    if (screen.y > 0 && (xy.y >= screen.y || xy.y + size.y <= 0)) return false;
+    return true;
+}
+
+// Returns false if a plan layer is certainly invisible over a time range,
+// judged from the value ranges of its opacity and placement splines.
+// Cursors (opacity, x, y, w, h) speed up calls at increasing times.
+bool maybe_visible(
+    PlanSegments const& segs, PlanLayer const& layer, XY<int> screen,
+    Interval t, std::array<PlanCursor, 5>* cursors
+) {
+    // Returns the range of a spline, or NaNs if its default may apply
+    double const nan = std::numeric_limits<double>::quiet_NaN();
+    auto const bounds = [&](PlanSpline const& z, int k) -> Interval {
+        auto* const cursor = &(*cursors)[k];
+        auto const range = z.range(segs, t, cursor);
+        if (range.empty()) return {nan, nan};
+        if (!z.value(segs, t.begin, cursor)) return {nan, nan};
+        if (!z.value(segs, t.end, cursor)) return {nan, nan};
+        return range.bounds();
+    };
+
+    // Range ends are just past constant values, so step back for maximums
+    double const inf = std::numeric_limits<double>::infinity();
+    auto const max = [inf](Interval i) { return std::nextafter(i.end, -inf); };
+    auto const opacity = bounds(layer.opacity, 0);
+    auto const x = bounds(layer.to_xy.x, 1), y = bounds(layer.to_xy.y, 2);
+    auto const w = bounds(layer.to_size.x, 3), h = bounds(layer.to_size.y, 4);
+    if (max(opacity) <= 0 || max(w) <= 0 || max(h) <= 0) return false;
+    if (screen.x > 0 && (x.begin >= screen.x || max(x) + max(w) <= 0))
+        return false;
+    if (screen.y > 0 && (y.begin >= screen.y || max(y) + max(h) <= 0))
+        return false;
+    return true;
+}
+
 class ScriptRunnerDef : public ScriptRunner {
   public:
-    virtual void update(Script const& script) final {
+    virtual ~ScriptRunnerDef() final {
+        std::unique_lock lock{pool_mutex};
+        if (workers.empty()) return;
+        DEBUG(logger, "Stopping timeline threads...");
+        shutdown = true;
+        lock.unlock();
+        for (auto& worker : workers) worker.wakeup->set();
+        for (auto& worker : workers) worker.thread.join();
+    }
+
+    virtual double update(Script const& script) final {
+        std::unique_lock const update_lock{update_mutex};
         std::unique_lock lock{mutex};
         auto const now = cx.sys->clock();
         auto const t0 = script.zero_time;
         DEBUG(logger, "UPDATE {} (t0+{:.3f}s)", abbrev_realtime(now), now - t0);
+
+        // Track how late updates run, to extend timelines to cover it
+        double const late = last_deadline ? now - last_deadline : 0.0;
+        update_lag = std::clamp(std::max(late, update_lag * 0.9), 0.0, 0.5);
+
         for (const auto& [media, tuning] : script.buffer_tuning) {
             auto const& file = find_file(lock, media);
             auto* input = &input_media[file];
@@ -87,7 +157,26 @@ class ScriptRunnerDef : public ScriptRunner {
             }
         }
 
+        // Scripts from parse_script() come compiled; others compile here.
+        auto next_plan = script.plan;
+        if (!next_plan) {
+            auto compiled = compile_script(script);
+            next_plan = std::make_shared<ScriptPlan const>(std::move(compiled));
+        }
+        bool const new_plan = (next_plan != plan);
+        plan = std::move(next_plan);
+
+        // Media are resolved once per update by ID, rather than per layer
+        std::vector<std::pair<std::string const, InputMedia>*> plan_media(
+            plan->media.size()
+        );
+
         std::vector<DisplayScreen> display_screens;
+        regroup(lock, script, &display_screens);
+
+        std::vector<ScreenJob> jobs;
+        std::map<std::string, VsyncClock> group_vsync;
+        double next_update = std::numeric_limits<double>::infinity();
         for (auto const& [connector, script_screen] : script.screens) {
             auto *output = &output_screens[connector];
             output->defined = true;
@@ -149,123 +238,188 @@ class ScriptRunnerDef : public ScriptRunner {
                 DEBUG(logger, "  [{}] + {}", connector, debug(mode));
                 if (!output->player)
                     output->player = cx.player_f(display_id);
+                output->display_id = display_id;
                 output->mode = mode;
+                output->slots.clear();  // Built for the old mode
             }
 
             if (!output->mode.nominal_hz) {
-                output->player->set_timeline({});
+                clear_timeline(output);
                 continue;
             }
 
+            // Frame times land on vblanks as predicted from actual flips
+            // (the player's clock may lag a mode change by one update).
             ASSERT(output->mode.actual_hz() > 0);
+            double const mode_period = 1.0 / output->mode.actual_hz();
+            auto vsync = output->player->vsync_clock();
+            if (vsync.nominal_period() != mode_period)
+                vsync = VsyncClock{mode_period};
+
+            // Grouped screens use the same frame times (from the group's
+            // first screen) so the player can commit their frames together.
+            if (!output->group.empty()) {
+                auto const [it, first] =
+                    group_vsync.try_emplace(output->group, vsync);
+                if (!first && it->second.nominal_period() == mode_period)
+                    vsync = it->second;
+            }
+
             double const script_hz = script_screen.update_hz;
-            double const hz = script_hz ? script_hz : output->mode.actual_hz();
+            double const hz = script_hz ? script_hz : 1.0 / vsync.period();
             double const loop_hz = script.main_loop_hz;
-            double const begin_t = std::ceil(now * hz) / hz;
-            double const end_t = now + 2.0 / std::min(hz, loop_hz);
+            double const begin_t = script_hz
+                ? std::ceil(now * hz) / hz : vsync.next_vsync(now);
+            double const end_t =
+                now + 2.0 / std::min(hz, loop_hz) + 2.0 * update_lag;
+
+            // Refresh when half of this lookahead is used up
+            double const refresh_t = now + 1.0 / std::min(hz, loop_hz);
+            next_update = std::min(next_update, refresh_t);
+
+            // Slots are kept between updates and only evaluated as needed;
+            // a different script (or zero time) invalidates all of them.
+            bool const changed = new_plan && output->script != script_screen;
+            if (changed || output->zero_time != t0) {
+                output->script = script_screen;
+                output->zero_time = t0;
+                output->slots.clear();
+            }
 
-            // Create empty timeline elements at each frame time
-            FramePlayer::Timeline timeline;
+            // Keep slots already built at each frame time's vblank (vsync
+            // estimates drift a bit between updates) and add slots for new
+            // frame times; slots now in the past are dropped.
+            std::map<double, Slot> slots;
+            auto const near = [&](std::map<double, Slot>& m, double t) {
+                auto it = m.lower_bound(t - mode_period / 4);
+                return (it != m.end() && it->first < t + mode_period / 4)
+                    ? it : m.end();
+            };
             for (double t = begin_t; t < end_t + 0.001; t += 1.0 / hz) {
-                auto* frame = &timeline[t];
-                frame->mode = output->mode;
-                frame->layers.reserve(script_screen.layers.size());
+                double const vt = vsync.next_vsync(t);
+                if (near(slots, vt) != slots.end()) continue;
+                auto const old = near(output->slots, vt);
+                if (old != output->slots.end()) {
+                    slots.insert(output->slots.extract(old));
+                } else {
+                    slots[vt].layers.resize(script_screen.layers.size());
+                }
+            }
+
+            // Past slots' underruns count once the player has shown them
+            // (future slots dropped here were never sent to be shown).
+            for (auto const& [t, slot] : output->slots) {
+                if (t >= now) continue;
+                UnderrunStats stats = {};
+                for (auto const& slot_layer : slot.layers) {
+                    if (!slot_layer.underrun) continue;
+                    switch (*slot_layer.underrun) {
+                        case ScriptUnderrun::black: ++stats.black; break;
+                        case ScriptUnderrun::nearest: ++stats.nearest; break;
+                        case ScriptUnderrun::previous: ++stats.previous; break;
+                    }
+                }
+                if (stats.black || stats.nearest || stats.previous)
+                    output->unconfirmed[t] = stats;
+            }
+
+            auto const shown = output->player->last_shown();
+            auto const confirmed = output->unconfirmed.upper_bound(shown);
+            for (auto it = output->unconfirmed.begin(); it != confirmed; ++it) {
+                output->underruns.black += it->second.black;
+                output->underruns.nearest += it->second.nearest;
+                output->underruns.previous += it->second.previous;
             }
+            output->unconfirmed.erase(output->unconfirmed.begin(), confirmed);
+            output->slots = std::move(slots);
 
+            // Take media snapshots for layers with slots still to evaluate;
+            // the slots themselves are evaluated in parallel below.
+            auto* job = &jobs.emplace_back();
+            job->output = output;
+            job->plan_screen = &plan->screens.at(connector);
+            job->now = now;
+            job->t0 = t0;
+            job->files.resize(script_screen.layers.size());
+            job->frames.resize(script_screen.layers.size());
             for (size_t li = 0; li < script_screen.layers.size(); ++li) {
                 auto const& script_layer = script_screen.layers[li];
-                auto const& file = find_file(lock, script_layer.media);
-                auto* input = &input_media[file];
+                auto const& plan_layer = job->plan_screen->layers[li];
+                auto*& media = plan_media[plan_layer.media];
+                if (!media) {
+                    auto const& spec = plan->media[plan_layer.media];
+                    auto const& file = find_file(lock, spec);
+                    media = &*input_media.try_emplace(file).first;
+                }
+
+                auto const& file = media->first;
+                auto* input = &media->second;
                 DEBUG(logger, "    \"{}\"", short_filename(file));
 
                 auto const rt = now - t0;
-                Interval const buffer_t{rt, rt + script_layer.buffer};
-                IntervalSet const want = script_layer.play.range(buffer_t);
+                auto const& segs = plan->segments;
+                double const buffer = script_layer.buffer * input->buffer_scale;
+                auto const screen = output->mode.size;
+                std::array<PlanCursor, 5> cursors = {};
+                PlanCursor play_cursor = {};
+                auto const visible = [&](Interval t) {
+                    return maybe_visible(segs, plan_layer, screen, t, &cursors);
+                };
+
+                IntervalSet want;
+                if (visible({rt, rt + buffer})) {
+                    // Skip frames for pieces of the buffer that can't be seen
+                    auto const& play = plan_layer.play;
+                    double const chunk = 0.05;
+                    for (double t = rt; t < rt + buffer; t += chunk) {
+                        double const end = std::min(t + chunk, rt + buffer);
+                        Interval const chunk_t{t, end};
+                        if (!visible(chunk_t)) continue;
+                        want.insert(play.range(segs, chunk_t, &play_cursor));
+                    }
+                }
                 TRACE(logger, "      want {}", debug(want));
                 input->req.wanted.insert(want);
 
-                if (!input->frames) {
-                    if (!input->loader) continue;
-                    input->frames = input->loader->frames();
+                Interval const scan_t{rt + buffer, rt + cx.preload_time};
+                auto const preload = preload_want(
+                    plan_layer, script_layer.buffer, screen, scan_t
+                );
+                if (!preload.empty()) {
+                    TRACE(logger, "      preload {}", debug(preload));
+                    input->req.wanted.insert(preload);
                 }
-                TRACE(logger, "      have {}", debug(input->frames->coverage));
-
-                for (auto& [t, t_frame] : timeline) {
-                    auto const media_t = script_layer.play.value(t - t0);
-                    if (!media_t) {
-                        TRACE(logger, "      {:+.3f}s inactive", t - now);
-                        continue;
-                    }
 
-                    if (*media_t < 0) {
-                        TRACE(
-                            logger, "      {:+.3f}s m{:.3f}s before start",
-                            t - now, *media_t
-                        );
-                        continue;
-                    }
-
-                    if (input->frames->eof && *media_t >= *input->frames->eof) {
-                        TRACE(
-                            logger, "      {:+.3f}s m{:.3f}s after EOF",
-                            t - now, *media_t
-                        );
-                        continue;
-                    }
+                if (!input->frames && !input->loader) continue;
 
-                    if (!input->frames->coverage.contains(*media_t)) {
-                        TRACE(
-                            logger, "      {:+.3f}s m{:.3f}s not loaded!",
-                            t - now, *media_t
-                        );
-
-                        t_frame.warnings.push_back(fmt::format(
-                            "Outran buffer (USING BLACK FRAME) @{:.3f}s \"{}\"",
-                            *media_t, file
-                        ));
-                        continue;
-                    }
+                if (!input->frames) {
+                    auto frames = input->loader->frames();
+                    TRACE(logger, "      have {}", debug(frames.coverage));
+                    input->frames =
+                        std::make_shared<LoadedFrames const>(std::move(frames));
+                }
 
-                    auto fit = input->frames->frames.upper_bound(*media_t);
-                    if (fit == input->frames->frames.begin()) {
-                        TRACE(
-                            logger, "      {:+.3f}s m{:.3f}s empty media",
-                            t - now, *media_t
-                        );
-                        continue;
-                    }
+                note_fill(input, plan_layer, script_layer.buffer, want, rt);
 
-                    auto const bez = [&](BezierSpline const& z, double def) {
-                        return z.value(t - t0).value_or(def);
-                    };
-
-                    --fit;
-                    auto const frame_t = fit->first;
-                    auto const size = fit->second->content().size;
-                    auto* layer = &t_frame.layers.emplace_back();
-                    layer->from_xy.x = bez(script_layer.from_xy.x, 0);
-                    layer->from_xy.y = bez(script_layer.from_xy.y, 0);
-                    layer->from_size.x = bez(script_layer.from_size.x, size.x);
-                    layer->from_size.y = bez(script_layer.from_size.y, size.y);
-                    layer->to_xy.x = bez(script_layer.to_xy.x, 0);
-                    layer->to_xy.y = bez(script_layer.to_xy.y, 0);
-                    layer->to_size.x = bez(script_layer.to_size.x, size.x);
-                    layer->to_size.y = bez(script_layer.to_size.y, size.y);
-                    layer->opacity = bez(script_layer.opacity, 1);
-                    layer->reflect = script_layer.reflect;
-                    layer->rotate = script_layer.rotate;
-                    TRACE(
-                        logger, "      {:+.3f}s m{:.3f} f{:.3f} {}",
-                        t - now, *media_t, frame_t, debug(*layer)
-                    );
+                bool pending = false;
+                for (auto const& [t, slot] : output->slots)
+                    pending = pending || !slot.layers[li].settled;
+                if (!pending) continue;
 
-                    layer->image = fit->second;  // Not in TRACE above
-                }
+                job->files[li] = &file;
+                job->frames[li] = input->frames;
             }
-
-            output->player->set_timeline(std::move(timeline));
         }
 
+        // Other threads may use file_info() while timelines are built
+        lock.unlock();
+        build_screens(&jobs);
+        lock.lock();
+
+        int active_inputs = 0;
+        for (auto const& [file, input] : input_media)
+            active_inputs += (input.loader && !input.req.wanted.empty());
+
         auto input_it = input_media.begin();
         while (input_it != input_media.end()) {
             auto *input = &input_it->second;
@@ -286,10 +440,18 @@ class ScriptRunnerDef : public ScriptRunner {
                     input->loader = cx.loader_f(std::move(loader_cx));
                 }
 
+                if (input->frames) {
+                    int const share_count = std::max(1, active_inputs);
+                    double const share = cx.buffer_memory / share_count;
+                    adapt_buffer(input_it->first, input, now, share);
+                }
+
                 TRACE(logger, "    request {}", debug(input->req.wanted));
+                input->req.notify = cx.notify;  // Prompt updates on load
                 input->loader->set_request(std::move(input->req));
                 input->req = {};
                 input->frames = {};
+                input->fill = {};
                 ++input_it;
             }
         }
@@ -297,13 +459,15 @@ class ScriptRunnerDef : public ScriptRunner {
         for (auto& [conn, output] : output_screens) {
             if (!output.defined) {
                 DEBUG(logger, "  [{}] unspecified, blanking", conn);
-                output.player->set_timeline({});
+                clear_timeline(&output);
             } else {
                 output.defined = false;
             }
         }
 
-        TRACE(logger, "  update done");
+        TRACE(logger, "  update done (next in {:.3f}s)", next_update - now);
+        last_deadline = next_update;
+        return next_update;
     }
 
     MediaFileInfo const& file_info(std::string const& spec) final {
@@ -335,6 +499,24 @@ class ScriptRunnerDef : public ScriptRunner {
         return cache_it->second;
     }
 
+    std::map<std::string, FramePlayerStats> screen_stats() final {
+        std::unique_lock lock{mutex};
+        std::map<std::string, FramePlayerStats> out;
+        for (auto const& [conn, output] : output_screens) {
+            if (output.player) out[conn] = output.player->stats();
+        }
+        return out;
+    }
+
+    std::map<std::string, UnderrunStats> underrun_stats() final {
+        std::unique_lock lock{mutex};
+        std::map<std::string, UnderrunStats> out;
+        for (auto const& [conn, output] : output_screens) {
+            if (output.player) out[conn] = output.underruns;
+        }
+        return out;
+    }
+
     void init(ScriptContext c) {
         cx = std::move(c);
         if (!cx.sys) cx.sys = global_system();
@@ -364,37 +546,588 @@ class ScriptRunnerDef : public ScriptRunner {
 
         if (!cx.player_f) {
             cx.player_f = [this](uint32_t id) {
-                return start_frame_player(cx.driver, id, cx.sys);
+                return start_frame_player(
+                    cx.driver, id, cx.sys, cx.player_policy
+                );
+            };
+        }
+
+        if (!cx.group_player_f) {
+            cx.group_player_f = [this](std::vector<uint32_t> const& ids) {
+                return start_frame_player_group(
+                    cx.driver, ids, cx.sys, cx.player_policy
+                );
             };
         }
+
+        int threads = cx.timeline_threads;
+        if (threads <= 0) threads = std::thread::hardware_concurrency();
+        DEBUG(logger, "Starting runner ({} timeline threads)...", threads);
+
+        pool_done = cx.sys->make_flag();
+        workers.resize(std::max(threads, 1) - 1);
+        for (auto& worker : workers) {
+            worker.wakeup = cx.sys->make_flag();
+            worker.thread = std::thread(
+                &ScriptRunnerDef::worker_thread, this, &worker
+            );
+        }
     }
 
   private:
+    // One layer of one timeline slot, as evaluated from the script.
+    struct SlotLayer {
+        std::optional<DisplayLayer> layer;  // Content to show, if any
+        std::string warning;                // Problem to report, if any
+        std::optional<ScriptUnderrun> underrun;  // Stand-in for missing frame
+        bool settled = false;               // Won't change with more media
+        bool operator==(SlotLayer const&) const = default;
+    };
+
+    // One frame time in a screen's timeline, kept between updates so
+    // only new slots (or layers still waiting on media) are evaluated.
+    struct Slot {
+        std::vector<SlotLayer> layers;  // By script layer index
+        DisplayFrame frame;             // Assembled from layers & validated
+        bool stale = true;              // Layers changed since assembly
+    };
+
+    // Cursors for a layer's geometry and opacity splines, in bez() order.
+    using LayerCursors = std::array<PlanCursor, 9>;
+
+    // How well an input's loaded frames covered its layers this update.
+    struct InputFill {
+        double fraction = 1.0;   // Lowest loaded share of a layer's want
+        bool outrun = false;     // A layer's current frame wasn't loaded
+        double buffer = 0.0;     // Longest script buffer among the layers
+    };
+
     struct InputMedia {
         std::shared_ptr<FrameLoader> loader;
-        std::optional<LoadedFrames> frames;
+        std::shared_ptr<LoadedFrames const> frames;  // Snapshot, if taken
         FrameRequest req;
+        InputFill fill;             // Measured this update
+        double buffer_scale = 1.0;  // Adapted multiplier for layer buffers
+        double adapt_time = 0.0;    // When buffer_scale was last adapted
+        double grow_time = 0.0;     // When buffer_scale last grew
     };
 
     struct OutputScreen {
         std::string name;
         XY<int> size;
+        uint32_t display_id = 0;
         DisplayMode mode;
         std::unique_ptr<FramePlayer> player;
+        FramePlayer::Timeline sent;  // Frames last given to the player
+        ScriptScreen script;         // Script the slots were built from
+        double zero_time = 0.0;      // Script zero time for the slots
+        std::map<double, Slot> slots;  // Timeline content by frame time
+        std::string group;           // Shares its player's thread if set
+        UnderrunStats underruns;     // Counted as slots are shown
+        std::map<double, UnderrunStats> unconfirmed;  // Past, not yet shown
         bool defined = false;
     };
 
+    // One screen's timeline to build on the pool, with media snapshots
+    // taken under the mutex (so builders share them without locking).
+    struct ScreenJob {
+        OutputScreen* output = nullptr;
+        PlanScreen const* plan_screen = nullptr;
+        double now = 0.0, t0 = 0.0;
+        std::vector<std::string const*> files;  // By layer, if frames
+        std::vector<std::shared_ptr<LoadedFrames const>> frames;  // By layer
+    };
+
+    struct Worker {
+        std::thread thread;
+        std::unique_ptr<SyncFlag> wakeup;
+    };
+
     // Constant from init to ~
     std::shared_ptr<log::logger> const logger = runner_logger();
     ScriptContext cx = {};
+    std::unique_ptr<SyncFlag> pool_done;
+    std::vector<Worker> workers;
+
+    // Serializes update() calls. Screens' slots and sent timelines are
+    // only used by update(), which builds each screen on one thread.
+    std::mutex update_mutex;
+    std::shared_ptr<ScriptPlan const> plan;  // From the last update
+    double last_deadline = 0.0;  // Returned by the last update
+    double update_lag = 0.0;     // Recent lateness of updates (decaying)
 
-    // Guarded by mutex
+    // Guarded by mutex (output_screens entries are only added, removed,
+    // or given new players by update(), which also holds update_mutex)
     std::mutex mutable mutex;
     std::map<std::string, InputMedia> input_media;
     std::map<std::string, OutputScreen> output_screens;
     std::map<std::string, std::string> path_cache;
     std::map<std::string, MediaFileInfo> info_cache;
 
+    // Guarded by pool_mutex
+    std::mutex pool_mutex;
+    bool shutdown = false;
+    std::vector<ScreenJob>* pool_jobs = nullptr;
+    size_t pool_next = 0;
+    size_t pool_left = 0;
+    std::exception_ptr pool_error;
+
+    // Returns media to preload for a layer: the first frames of each span
+    // in scan_t where the layer appears (is active with nonzero opacity and
+    // size) or its play position jumps, so cuts don't wait for a decoder.
+    IntervalSet preload_want(
+        PlanLayer const& plan_layer, double buffer,
+        XY<int> screen, Interval scan_t
+    ) const {
+        IntervalSet out;
+        double const step = 0.05;
+        int const steps = std::ceil((scan_t.end - scan_t.begin) / step);
+        if (steps <= 0) return out;
+
+        std::vector<double> t(steps + 1);
+        for (int k = 0; k <= steps; ++k) t[k] = scan_t.begin + k * step;
+
+        // Undefined values (NaN) are taken as possibly visible
+        std::vector<double> play, opacity, x, y, w, h;
+        auto const& segs = plan->segments;
+        plan_layer.play.values(segs, t, &play);
+        plan_layer.opacity.values(segs, t, &opacity);
+        plan_layer.to_xy.x.values(segs, t, &x);
+        plan_layer.to_xy.y.values(segs, t, &y);
+        plan_layer.to_size.x.values(segs, t, &w);
+        plan_layer.to_size.y.values(segs, t, &h);
+
+        PlanCursor play_cursor = {};
+        bool was_shown = false;
+        for (int k = 0; k <= steps; ++k) {
+            bool const shown = play[k] >= 0 && maybe_visible(
+                screen, opacity[k], {x[k], y[k]}, {w[k], h[k]}
+            );
+
+            // Moving faster than 8x playback (either way) counts as a jump
+            double const moved = was_shown ? play[k] - play[k - 1] : 0.0;
+            bool const jump = std::abs(moved) > 8 * step;
+            if (k > 0 && shown && (!was_shown || jump)) {
+                Interval const load_t{t[k - 1], t[k] + buffer};
+                out.insert(plan_layer.play.range(segs, load_t, &play_cursor));
+            }
+            was_shown = shown;
+        }
+        return out;
+    }
+
+    // Records how much of a layer's wanted range is loaded, and whether
+    // the frame for the current time is missing, for adapt_buffer().
+    void note_fill(
+        InputMedia* input, PlanLayer const& layer, double buffer,
+        IntervalSet const& want, double rt
+    ) {
+        double const inf = std::numeric_limits<double>::infinity();
+        auto const& frames = *input->frames;
+        IntervalSet missing = want;
+        missing.erase({-inf, 0.0});
+        if (frames.eof) missing.erase({*frames.eof, inf});
+        missing.erase(frames.coverage);
+
+        double want_len = 0.0, missing_len = 0.0;
+        for (auto const& i : want) want_len += i.end - i.begin;
+        for (auto const& i : missing) missing_len += i.end - i.begin;
+
+        auto* fill = &input->fill;
+        if (want_len > 0) {
+            double const fraction = 1.0 - missing_len / want_len;
+            fill->fraction = std::min(fill->fraction, fraction);
+        }
+
+        auto const media_t = layer.play.value(plan->segments, rt);
+        if (media_t && missing.contains(*media_t)) fill->outrun = true;
+        fill->buffer = std::max(fill->buffer, buffer);
+    }
+
+    // Adjusts an input's buffer scale from how well its loader keeps up:
+    // grow quickly on outruns and steadily while the buffer is under half
+    // full, and shrink slowly once it has stayed full for a while. Growth
+    // is capped by this input's share of the buffer memory limit.
+    void adapt_buffer(
+        std::string const& file, InputMedia* input, double now, double memory
+    ) {
+        auto const& fill = input->fill;
+        if (!input->adapt_time) input->grow_time = now;  // Start calm period
+        double const dt =
+            input->adapt_time ? std::clamp(now - input->adapt_time, 0.0, 1.0)
+                : 0.0;
+        input->adapt_time = now;
+
+        double scale = input->buffer_scale;
+        bool const jump = fill.outrun && now - input->grow_time >= 1.0;
+        if (jump) {
+            scale *= 1.5;
+            input->grow_time = now;
+        } else if (fill.outrun || fill.fraction < 0.5) {
+            scale *= std::pow(1.25, dt);
+            input->grow_time = now;
+        } else if (fill.fraction >= 0.99 && now - input->grow_time > 5.0) {
+            scale *= std::pow(0.9, dt);
+        }
+
+        double bytes = 0.0, loaded_t = 0.0;
+        for (auto const& [t, image] : input->frames->frames) {
+            for (auto const& chan : image->content().channels)
+                bytes += chan.size;
+        }
+        for (auto const& i : input->frames->coverage)
+            loaded_t += i.end - i.begin;
+
+        double max_scale = 8.0;
+        if (bytes > 0 && loaded_t > 0 && fill.buffer > 0) {
+            double const fit = memory / (bytes / loaded_t * fill.buffer);
+            max_scale = std::max(1.0, std::min(max_scale, fit));
+        }
+
+        scale = std::clamp(scale, 0.5, max_scale);
+        if (jump) {
+            DEBUG(
+                logger, "  \"{}\" outran, buffer x{:.2f} => x{:.2f}",
+                short_filename(file), input->buffer_scale, scale
+            );
+        } else if (scale != input->buffer_scale) {
+            TRACE(
+                logger, "    buffer x{:.2f} (filled {:.0f}%)",
+                scale, fill.fraction * 100
+            );
+        }
+        input->buffer_scale = scale;
+    }
+
+    // Starts shared players for screen groups whose membership changed
+    // (dropping players of screens that left or joined a group).
+    void regroup(
+        std::unique_lock<std::mutex> const&,
+        Script const& script, std::vector<DisplayScreen>* display_screens
+    ) {
+        std::map<std::string, std::set<std::string>> want, have;
+        for (auto const& [connector, script_screen] : script.screens) {
+            if (!script_screen.group.empty())
+                want[script_screen.group].insert(connector);
+        }
+        for (auto const& [connector, output] : output_screens) {
+            if (!output.group.empty()) have[output.group].insert(connector);
+        }
+        if (want == have) return;
+
+        auto const reset = [](OutputScreen* output) {
+            output->player.reset();
+            output->sent.clear();
+            output->slots.clear();
+            output->mode = {};  // Resolve again for the new player
+            output->group.clear();
+        };
+
+        for (auto& [connector, output] : output_screens) {
+            if (output.group.empty()) continue;
+            auto const w = want.find(output.group);
+            if (w != want.end() && w->second == have[output.group]) continue;
+            DEBUG(logger, "  [{}] leaving \"{}\"", connector, output.group);
+            reset(&output);
+        }
+
+        for (auto const& [group, connectors] : want) {
+            auto const h = have.find(group);
+            if (h != have.end() && h->second == connectors) continue;
+            if (display_screens->empty())
+                *display_screens = cx.driver->scan_screens();
+
+            std::vector<uint32_t> ids;
+            std::vector<OutputScreen*> members;
+            for (auto const& connector : connectors) {
+                auto* const output = &output_screens[connector];
+                reset(output);
+                output->group = group;  // Even if missing, to stay settled
+
+                for (auto const& display : *display_screens) {
+                    if (display.connector != connector) continue;
+                    ids.push_back(display.id);
+                    members.push_back(output);
+                }
+            }
+
+            DEBUG(logger, "  group \"{}\": {} screens", group, ids.size());
+            if (ids.empty()) continue;
+            auto players = cx.group_player_f(ids);
+            CHECK_RUNTIME(players.size() == ids.size(), "Bad group players");
+            for (size_t m = 0; m < members.size(); ++m)
+                members[m]->player = std::move(players[m]);
+        }
+    }
+
+    // Evaluates a screen's pending slots, assembles and validates frames
+    // for changed slots, and sends the resulting timeline to the player.
+    // Runs on a pool thread; only touches its own OutputScreen.
+    void build_screen(ScreenJob const& job) {
+        auto* const output = job.output;
+        std::vector<double> slot_rt, slot_media_t;
+        for (size_t li = 0; li < job.frames.size(); ++li) {
+            if (!job.frames[li]) continue;
+            auto const& plan_layer = job.plan_screen->layers[li];
+
+            // Pending slots are in time order, so media times are
+            // evaluated as one batch and other splines use cursors.
+            slot_rt.clear();
+            for (auto const& [t, slot] : output->slots) {
+                if (!slot.layers[li].settled) slot_rt.push_back(t - job.t0);
+            }
+
+            plan_layer.play.values(plan->segments, slot_rt, &slot_media_t);
+            LayerCursors cursors = {};
+            size_t pending = 0;
+            for (auto& [t, slot] : output->slots) {
+                auto* slot_layer = &slot.layers[li];
+                if (slot_layer->settled) continue;
+                auto next = make_slot_layer(
+                    plan_layer, *job.files[li], *job.frames[li],
+                    output->mode.size, slot_rt[pending], slot_media_t[pending],
+                    t - job.now, &cursors
+                );
+                ++pending;
+                if (next != *slot_layer) {
+                    *slot_layer = std::move(next);
+                    slot.stale = true;
+                }
+            }
+        }
+
+        // Check frames against the display hardware now rather than at
+        // show time; drop top layers until the hardware accepts them.
+        FramePlayer::Timeline timeline;
+        for (auto& [t, slot] : output->slots) {
+            if (slot.stale) {
+                slot.frame = {};
+                slot.frame.mode = output->mode;
+                slot.frame.layers.reserve(slot.layers.size());
+                for (auto const& slot_layer : slot.layers) {
+                    if (slot_layer.layer)
+                        slot.frame.layers.push_back(*slot_layer.layer);
+                    if (!slot_layer.warning.empty())
+                        slot.frame.warnings.push_back(slot_layer.warning);
+                }
+
+                auto& layers = slot.frame.layers;
+                auto const ok =
+                    cx.driver->validate(output->display_id, slot.frame);
+                auto const dropped = layers.size() - ok;
+                if (dropped) {
+                    layers.resize(ok);
+                    slot.frame.warnings.push_back(fmt::format(
+                        "Display rejected frame (DROPPED {} LAYERS)", dropped
+                    ));
+                }
+                slot.stale = false;
+            }
+            timeline.emplace(t, slot.frame);
+        }
+
+        send_timeline(output, std::move(timeline));
+    }
+
+    // Runs build_screen() for every job, on the caller and pool threads.
+    void build_screens(std::vector<ScreenJob>* jobs) {
+        std::unique_lock lock{pool_mutex};
+        pool_jobs = jobs;
+        pool_next = 0;
+        pool_left = jobs->size();
+        pool_error = {};
+
+        int const helpers =
+            std::min<int>(workers.size(), int(jobs->size()) - 1);
+        lock.unlock();
+        for (int w = 0; w < helpers; ++w) workers[w].wakeup->set();
+
+        run_jobs();
+        lock.lock();
+        while (pool_left > 0) {
+            lock.unlock();
+            pool_done->sleep();
+            lock.lock();
+        }
+
+        pool_jobs = nullptr;
+        if (pool_error) std::rethrow_exception(pool_error);
+    }
+
+    // Claims and builds screens from the current jobs until none are left.
+    void run_jobs() {
+        std::unique_lock lock{pool_mutex};
+        while (pool_jobs && pool_next < pool_jobs->size()) {
+            auto const* job = &(*pool_jobs)[pool_next++];
+            lock.unlock();
+
+            std::exception_ptr error;
+            try {
+                build_screen(*job);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            if (error && !pool_error) pool_error = error;
+            if (--pool_left == 0) pool_done->set();
+        }
+    }
+
+    void worker_thread(Worker* worker) {
+        pthread_setname_np(pthread_self(), "pivid:timeline");
+        std::unique_lock lock{pool_mutex};
+        while (!shutdown) {
+            lock.unlock();
+            worker->wakeup->sleep();
+            run_jobs();
+            lock.lock();
+        }
+    }
+
+    // Evaluates one script layer at one frame time (rt, relative to the
+    // script's zero time) given the play spline's media_time there (NaN if
+    // inactive); dt is relative to now, for logging.
+    SlotLayer make_slot_layer(
+        PlanLayer const& plan_layer, std::string const& file,
+        LoadedFrames const& frames, XY<int> screen, double rt,
+        double media_time, double dt, LayerCursors* cursors
+    ) const {
+        auto const& segs = plan->segments;
+        SlotLayer out = {};
+        auto const media_t = std::isnan(media_time)
+            ? std::optional<double>{} : std::optional<double>{media_time};
+        if (!media_t) {
+            TRACE(logger, "      {:+.3f}s inactive", dt);
+            out.settled = true;
+            return out;
+        }
+
+        if (*media_t < 0) {
+            TRACE(logger, "      {:+.3f}s m{:.3f}s before start", dt, *media_t);
+            out.settled = true;
+            return out;
+        }
+
+        if (frames.eof && *media_t >= *frames.eof) {
+            TRACE(logger, "      {:+.3f}s m{:.3f}s after EOF", dt, *media_t);
+            out.settled = true;
+            return out;
+        }
+
+        auto const bez = [&](PlanSpline const& z, int k, double def) {
+            return z.value(segs, rt, &(*cursors)[k]).value_or(def);
+        };
+
+        // Frames aren't requested where layers can't be seen (size may be
+        // unset (NaN) until the frame is known)
+        double const nan = std::numeric_limits<double>::quiet_NaN();
+        XY<double> const to_xy = {
+            bez(plan_layer.to_xy.x, 4, 0), bez(plan_layer.to_xy.y, 5, 0)
+        };
+        XY<double> const to_size = {
+            bez(plan_layer.to_size.x, 6, nan), bez(plan_layer.to_size.y, 7, nan)
+        };
+        double const opacity = bez(plan_layer.opacity, 8, 1);
+        if (!maybe_visible(screen, opacity, to_xy, to_size)) {
+            TRACE(logger, "      {:+.3f}s m{:.3f}s invisible", dt, *media_t);
+            out.settled = true;
+            return out;
+        }
+
+        auto fit = frames.frames.upper_bound(*media_t);
+        if (!frames.coverage.contains(*media_t)) {
+            // Stand in with a nearby frame if the layer's policy allows
+            TRACE(logger, "      {:+.3f}s m{:.3f}s not loaded!", dt, *media_t);
+            auto const& all = frames.frames;
+            auto const policy = plan_layer.underrun;
+            bool const has_prev = (fit != all.begin());
+            bool const use_next = policy == ScriptUnderrun::nearest &&
+                fit != all.end() && (!has_prev ||
+                    fit->first - *media_t < *media_t - std::prev(fit)->first);
+            if (use_next) ++fit;  // Use the frame after media_t below
+            if (policy == ScriptUnderrun::black || fit == all.begin()) {
+                out.underrun = ScriptUnderrun::black;
+                out.warning = fmt::format(
+                    "Outran buffer (USING BLACK FRAME) @{:.3f}s \"{}\"",
+                    *media_t, file
+                );
+                return out;
+            }
+
+            out.underrun = policy;
+            out.warning = fmt::format(
+                "Outran buffer (HOLDING FRAME @{:.3f}s) @{:.3f}s \"{}\"",
+                std::prev(fit)->first, *media_t, file
+            );
+        } else if (fit == frames.frames.begin()) {
+            TRACE(logger, "      {:+.3f}s m{:.3f}s empty media", dt, *media_t);
+            return out;
+        }
+
+        --fit;
+        auto const frame_t = fit->first;
+        auto const size = fit->second->content().size;
+        auto* layer = &out.layer.emplace();
+        layer->from_xy.x = bez(plan_layer.from_xy.x, 0, 0);
+        layer->from_xy.y = bez(plan_layer.from_xy.y, 1, 0);
+        layer->from_size.x = bez(plan_layer.from_size.x, 2, size.x);
+        layer->from_size.y = bez(plan_layer.from_size.y, 3, size.y);
+        layer->to_xy = to_xy.as<int>();
+        layer->to_size.x = std::isnan(to_size.x) ? size.x : to_size.x;
+        layer->to_size.y = std::isnan(to_size.y) ? size.y : to_size.y;
+        layer->opacity = opacity;
+        layer->reflect = plan_layer.reflect;
+        layer->rotate = plan_layer.rotate;
+        TRACE(
+            logger, "      {:+.3f}s m{:.3f} f{:.3f} {}",
+            dt, *media_t, frame_t, debug(*layer)
+        );
+
+        layer->image = fit->second;  // Not in TRACE above
+        out.settled = !out.underrun;  // The frame at media_t is loaded
+        return out;
+    }
+
+    // Gives the player only the frames that differ from those already sent
+    // (typically just the newly reached end of the buffer).
+    void send_timeline(OutputScreen* output, FramePlayer::Timeline timeline) {
+        auto* const sent = &output->sent;
+        auto s = timeline.empty()
+            ? sent->end() : sent->lower_bound(timeline.begin()->first);
+        auto t = timeline.begin();
+        while (s != sent->end() && t != timeline.end() && *s == *t) {
+            ++s;
+            ++t;
+        }
+
+        if (s == sent->end() && t == timeline.end()) {
+            TRACE(logger, "    {}f unchanged", timeline.size());
+        } else {
+            double const inf = std::numeric_limits<double>::infinity();
+            double const from = std::min(
+                s != sent->end() ? s->first : inf,
+                t != timeline.end() ? t->first : inf
+            );
+
+            TRACE(
+                logger, "    {}f, {}f changed from {}",
+                timeline.size(), std::distance(t, timeline.end()),
+                abbrev_realtime(from)
+            );
+            output->player->replace_timeline(from, {t, timeline.end()});
+        }
+
+        *sent = std::move(timeline);
+    }
+
+    void clear_timeline(OutputScreen* output) {
+        output->slots.clear();
+        if (output->sent.empty()) return;  // Nothing to take back
+        output->player->set_timeline({});
+        output->sent.clear();
+    }
+
     std::string const& find_file(
         std::unique_lock<std::mutex> const&, std::string const& spec
     ) {
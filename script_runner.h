@@ -4,6 +4,7 @@
 #pragma once
 
 #include <map>
+#include <vector>
 
 #include "frame_loader.h"
 #include "frame_player.h"
@@ -13,29 +14,53 @@
 
 namespace pivid {
 
+// Counts of layers in shown frames that stood in for frames not loaded in
+// time, by the layer's underrun policy (or black if no frame was loaded).
+struct UnderrunStats {
+    int64_t black = 0;     // Layer omitted
+    int64_t nearest = 0;   // Closest loaded frame shown
+    int64_t previous = 0;  // Last loaded frame before shown
+};
+
 // Interface to an asynchronous thread that executes a play script,
 // loading frames and scheduling playback per the script's contents.
 class ScriptRunner {
   public:
     virtual ~ScriptRunner() = default;
 
-    // Switch to the specified play script.
-    virtual void update(Script const&) = 0;
+    // Switch to the specified play script, and refresh frame timelines.
+    // Returns the latest (realtime) time to call again, which may be
+    // infinite if nothing is playing; call sooner on a new script or when
+    // the context's notify flag is set.
+    virtual double update(Script const&) = 0;
 
     // Returns metadata for a file (relative to the media root), with caching.
     virtual MediaFileInfo const& file_info(std::string const&) = 0;
+
+    // Returns presentation statistics for active screens, by connector.
+    virtual std::map<std::string, FramePlayerStats> screen_stats() = 0;
+
+    // Returns counts of buffer underruns for active screens, by connector.
+    virtual std::map<std::string, UnderrunStats> underrun_stats() = 0;
 };
 
 // Resources and parameters need to start a ScriptRunner.
 struct ScriptContext {
     std::shared_ptr<DisplayDriver> driver;
     std::shared_ptr<UnixSystem> sys;
-    std::shared_ptr<SyncFlag> notify;  // Flagged on any status change.
+    std::shared_ptr<SyncFlag> notify;  // Flagged when media frames load.
     std::string root_dir;              // Media root for all file references.
     std::string file_base;             // Base for relative filenames.
-    FrameLoaderContext loader_cx;
+    FrameLoaderContext loader_cx;      // Includes the loader ThreadPolicy.
+    ThreadPolicy player_policy;        // For default player_f players.
+    int timeline_threads = 0;          // Incl. caller (0 = one per CPU).
+    double buffer_memory = 256 * 1048576.0;  // Cap on buffer growth (bytes).
+    double preload_time = 5.0;         // Look ahead to preload media (s).
     std::function<std::unique_ptr<FrameLoader>(FrameLoaderContext)> loader_f;
     std::function<std::unique_ptr<FramePlayer>(uint32_t)> player_f;
+    std::function<
+        std::vector<std::unique_ptr<FramePlayer>>(std::vector<uint32_t> const&)
+    > group_player_f;                  // For screens with a "group".
 };
 
 // Creates a script runner instance for given parameters.
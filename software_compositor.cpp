@@ -0,0 +1,475 @@
+#include "software_compositor.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "logging_policy.h"
+
+namespace pivid {
+
+namespace {
+
+auto const& compositor_logger() {
+    static const auto logger = make_logger("compositor");
+    return logger;
+}
+
+// Pixel layout of a supported source format.
+struct PixelFormat {
+    int bytes;       // Bytes per pixel in the first channel (0 = unsupported)
+    int r, g, b, a;  // Byte offsets within an RGB pixel (a = -1 if opaque)
+    int chroma;      // 0 = RGB, 2 = NV12 (interleaved UV), 3 = I420 (U, V)
+};
+
+PixelFormat pixel_format(uint32_t format) {
+    // "rgb" (lowercase) marks premultiplied alpha, as produced by load_image()
+    switch (format) {
+        case fourcc("rgbA"): return {4, 0, 1, 2, 3, 0};
+        case fourcc("bgrA"): return {4, 2, 1, 0, 3, 0};
+        case fourcc("Abgr"): return {4, 3, 2, 1, 0, 0};
+        case fourcc("Argb"): return {4, 1, 2, 3, 0, 0};
+        case fourcc("RGB0"): return {4, 0, 1, 2, -1, 0};
+        case fourcc("BGR0"): return {4, 2, 1, 0, -1, 0};
+        case fourcc("0RGB"): return {4, 1, 2, 3, -1, 0};
+        case fourcc("0BGR"): return {4, 3, 2, 1, -1, 0};
+        case fourcc("RGB\x18"): return {3, 0, 1, 2, -1, 0};
+        case fourcc("BGR\x18"): return {3, 2, 1, 0, -1, 0};
+        case fourcc("NV12"): return {1, 0, 0, 0, -1, 2};
+        case fourcc("I420"): return {1, 0, 0, 0, -1, 3};
+        default: return {0, 0, 0, 0, -1, 0};
+    }
+}
+
+bool channel_fits(ImageBuffer const& im, size_t c, int row_bytes, int rows) {
+    if (c >= im.channels.size()) return false;
+    auto const& chan = im.channels[c];
+    if (!chan.memory || chan.offset < 0 || chan.stride < row_bytes)
+        return false;
+    int64_t const end = chan.offset + int64_t(chan.stride) * (rows - 1);
+    return end + row_bytes <= chan.memory->size();
+}
+
+// Converts a row of (Y, U, V, -) samples to opaque RGBA in place
+// (BT.709 limited range), as a flat loop the compiler can vectorize.
+void convert_yuv_row(uint8_t* p, int n) {
+    for (int i = 0; i < n * 4; i += 4) {
+        int const l = 298 * (p[i] - 16) + 128;
+        int const u = p[i + 1] - 128, v = p[i + 2] - 128;
+        p[i + 0] = std::clamp((l + 459 * v) >> 8, 0, 255);
+        p[i + 1] = std::clamp((l - 55 * u - 136 * v) >> 8, 0, 255);
+        p[i + 2] = std::clamp((l + 541 * u) >> 8, 0, 255);
+        p[i + 3] = 255;
+    }
+}
+
+// Mapped pixel data for one source image.
+struct Source {
+    PixelFormat format = {};
+    XY<int> size = {};
+    uint8_t const* data[3] = {};
+    int stride[3] = {};
+
+    explicit Source(ImageBuffer const& im)
+        : format(pixel_format(im.fourcc)), size(im.size) {
+        for (size_t c = 0; c < im.channels.size() && c < 3; ++c) {
+            auto const& chan = im.channels[c];
+            data[c] = chan.memory->read() + chan.offset;
+            stride[c] = chan.stride;
+        }
+    }
+
+    // True if rows are already premultiplied RGBA in memory order.
+    bool is_rgba() const {
+        return format.bytes == 4 && !format.chroma && format.r == 0 &&
+            format.g == 1 && format.b == 2 && format.a == 3;
+    }
+
+    // Reads the pixels at (xs[i], ys[i]) as premultiplied RGBA.
+    void fetch(int const* xs, int const* ys, int n, uint8_t* rgba) const {
+        if (!format.chroma) {
+            auto const [bytes, r, g, b, a, chroma] = format;
+            for (int i = 0; i < n; ++i, rgba += 4) {
+                auto const* p = data[0] + ys[i] * stride[0] + xs[i] * bytes;
+                rgba[0] = p[r];
+                rgba[1] = p[g];
+                rgba[2] = p[b];
+                rgba[3] = a >= 0 ? p[a] : 255;
+            }
+            return;
+        }
+
+        // Gather samples first, then convert the whole row at once
+        for (int i = 0; i < n; ++i) {
+            int const x = xs[i], y = ys[i];
+            uint8_t* p = rgba + i * 4;
+            p[0] = data[0][y * stride[0] + x];
+            if (format.chroma == 2) {
+                auto const* uv = data[1] + (y / 2) * stride[1] + (x / 2) * 2;
+                p[1] = uv[0];
+                p[2] = uv[1];
+            } else {
+                p[1] = data[1][(y / 2) * stride[1] + x / 2];
+                p[2] = data[2][(y / 2) * stride[2] + x / 2];
+            }
+        }
+        convert_yuv_row(rgba, n);
+    }
+};
+
+// Four RGBA pixels, and the same widened for arithmetic; GCC/Clang vector
+// extensions map these onto NEON (or SSE) registers.
+using Pixels4 = uint8_t __attribute__((vector_size(16)));
+using Wide4 = uint16_t __attribute__((vector_size(32)));
+
+// Blends premultiplied RGBA pixels "over" the output, scaled by opacity
+// (0-256). Uses x / 255 ~= (x + 128 + ((x + 128) >> 8)) >> 8 (exact for
+// the products of two bytes), and handles four pixels per vector operation.
+void blend_row(uint8_t const* from, uint8_t* to, int n, int opacity) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        Pixels4 f, t;
+        std::memcpy(&f, from + i * 4, sizeof(f));
+        std::memcpy(&t, to + i * 4, sizeof(t));
+
+        Wide4 s = __builtin_convertvector(f, Wide4);
+        if (opacity < 256) s = (s * uint16_t(opacity)) >> 8;
+        Wide4 const alpha = __builtin_shufflevector(
+            s, s, 3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15
+        );
+
+        Wide4 const k = __builtin_convertvector(t, Wide4) * (255 - alpha) + 128;
+        Wide4 v = s + ((k + (k >> 8)) >> 8);
+        Wide4 const over = (Wide4) (v > 255);  // Only if not premultiplied
+        v = (v & ~over) | (over & 255);
+
+        Pixels4 const out = __builtin_convertvector(v, Pixels4);
+        std::memcpy(to + i * 4, &out, sizeof(out));
+    }
+
+    for (; i < n; ++i) {
+        uint8_t const* f = from + i * 4;
+        uint8_t* t = to + i * 4;
+        int const keep = 255 - ((f[3] * opacity) >> 8);
+        for (int c = 0; c < 4; ++c) {
+            int const k = t[c] * keep + 128;
+            int const v = ((f[c] * opacity) >> 8) + ((k + (k >> 8)) >> 8);
+            t[c] = std::min(v, 255);
+        }
+    }
+}
+
+// Maps a screen point to source image coordinates for a layer,
+// undoing the layer's rotation and reflection.
+XY<double> source_xy(DisplayLayer const& layer, XY<double> screen) {
+    XY<double> const uv = {
+        (screen.x - layer.to_xy.x) / layer.to_size.x,
+        (screen.y - layer.to_xy.y) / layer.to_size.y,
+    };
+
+    XY<double> s = uv;
+    switch (layer.rotate) {
+        case 90: s = {uv.y, 1 - uv.x}; break;
+        case 180: s = {1 - uv.x, 1 - uv.y}; break;
+        case 270: s = {1 - uv.y, uv.x}; break;
+    }
+    if (layer.reflect) s.x = 1 - s.x;
+
+    return {
+        layer.from_xy.x + s.x * layer.from_size.x,
+        layer.from_xy.y + s.y * layer.from_size.y,
+    };
+}
+
+// Plain heap memory for rendered images.
+class HeapBuffer : public MemoryBuffer {
+  public:
+    explicit HeapBuffer(int size) : data(size) {}
+    virtual int size() const final { return data.size(); }
+    virtual uint8_t const* read() final { return data.data(); }
+    uint8_t* write() { return data.data(); }
+
+  private:
+    std::vector<uint8_t> data;
+};
+
+class SoftwareCompositorDef : public SoftwareCompositor {
+  public:
+    virtual ~SoftwareCompositorDef() final {
+        std::unique_lock lock{mutex};
+        if (workers.empty()) return;
+        DEBUG(logger, "Stopping compositor threads...");
+        shutdown = true;
+        lock.unlock();
+        for (auto& worker : workers) worker.wakeup->set();
+        for (auto& worker : workers) worker.thread.join();
+    }
+
+    virtual void composite(
+        std::vector<DisplayLayer> const& layers,
+        XY<int> origin, XY<int> size, uint8_t* out, int out_stride
+    ) final {
+        for (auto const& layer : layers) {
+            CHECK_ARG(
+                can_composite(layer), "Can't composite: {}", debug(layer)
+            );
+        }
+        if (size.x <= 0 || size.y <= 0) return;
+
+        // Small bands balance load; min_band_rows limits the overhead
+        int const threads = workers.size() + 1;
+        int const rows = std::max(
+            options.min_band_rows, (size.y + threads * 4 - 1) / (threads * 4)
+        );
+
+        std::unique_lock const job_lock{job_mutex};  // One job at a time
+        std::unique_lock lock{mutex};
+        job = {&layers, origin, size, out, out_stride, rows};
+        job_next_row = 0;
+        job_bands_left = (size.y + rows - 1) / rows;
+        job_error = {};
+
+        int const helpers = std::min<int>(workers.size(), job_bands_left - 1);
+        lock.unlock();
+        for (int w = 0; w < helpers; ++w) workers[w].wakeup->set();
+
+        run_bands();
+        lock.lock();
+        while (job_bands_left > 0) {
+            lock.unlock();
+            job_done->sleep();
+            lock.lock();
+        }
+
+        job = {};
+        if (job_error) std::rethrow_exception(job_error);
+    }
+
+    virtual ImageBuffer render(DisplayFrame const& frame) final {
+        auto const size = frame.mode.size;
+        CHECK_ARG(
+            size.x > 0 && size.y > 0, "Bad render mode: {}", debug(frame.mode)
+        );
+
+        auto mem = std::make_shared<HeapBuffer>(size.x * size.y * 4);
+        auto const layers = visible_layers(frame);
+        composite(layers, {0, 0}, size, mem->write(), size.x * 4);
+
+        ImageBuffer im = {};
+        im.fourcc = fourcc("rgbA");
+        im.size = size;
+        im.channels.resize(1);
+        im.channels[0].size = mem->size();
+        im.channels[0].stride = size.x * 4;
+        im.channels[0].memory = std::move(mem);
+        im.source_comment = fmt::format("rendered {}l", frame.layers.size());
+        return im;
+    }
+
+    void start(
+        std::shared_ptr<UnixSystem> sys,
+        SoftwareCompositorOptions const& options
+    ) {
+        int threads = options.threads;
+        if (threads <= 0) threads = std::thread::hardware_concurrency();
+        DEBUG(logger, "Starting compositor ({} threads)...", threads);
+
+        this->options = options;
+        job_done = sys->make_flag();
+        workers.resize(std::max(threads, 1) - 1);
+        for (auto& worker : workers) {
+            worker.wakeup = sys->make_flag();
+            worker.thread = std::thread(
+                &SoftwareCompositorDef::worker_thread, this, &worker
+            );
+        }
+    }
+
+  private:
+    struct Job {
+        std::vector<DisplayLayer> const* layers = nullptr;
+        XY<int> origin = {};
+        XY<int> size = {};
+        uint8_t* out = nullptr;
+        int out_stride = 0;
+        int band_rows = 0;
+    };
+
+    struct Worker {
+        std::thread thread;
+        std::unique_ptr<SyncFlag> wakeup;
+    };
+
+    // Claims and blends bands of the current job until none are left.
+    void run_bands() {
+        std::unique_lock lock{mutex};
+        while (job_next_row < job.size.y) {
+            int const y = job_next_row;
+            int const rows = std::min(job.band_rows, job.size.y - y);
+            job_next_row += rows;
+            auto const j = job;
+            lock.unlock();
+
+            std::exception_ptr error;
+            try {
+                composite_layers(
+                    *j.layers, {j.origin.x, j.origin.y + y}, {j.size.x, rows},
+                    j.out + y * j.out_stride, j.out_stride
+                );
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            if (error && !job_error) job_error = error;
+            if (--job_bands_left == 0) job_done->set();
+        }
+    }
+
+    void worker_thread(Worker* worker) {
+        pthread_setname_np(pthread_self(), "pivid:composite");
+        std::unique_lock lock{mutex};
+        while (!shutdown) {
+            lock.unlock();
+            worker->wakeup->sleep();
+            run_bands();
+            lock.lock();
+        }
+    }
+
+    // Constant from start to ~
+    std::shared_ptr<log::logger> const logger = compositor_logger();
+    SoftwareCompositorOptions options;
+    std::unique_ptr<SyncFlag> job_done;
+    std::vector<Worker> workers;
+
+    // Serializes composite() calls
+    std::mutex job_mutex;
+
+    // Guarded by mutex
+    std::mutex mutex;
+    bool shutdown = false;
+    Job job;
+    int job_next_row = 0;
+    int job_bands_left = 0;
+    std::exception_ptr job_error;
+};
+
+}  // anonymous namespace
+
+bool can_composite(DisplayLayer const& layer) {
+    if (!layer.image) return false;
+    if (layer.rotate % 90 || layer.rotate < 0 || layer.rotate >= 360)
+        return false;
+
+    auto const& im = layer.image->content();
+    auto const format = pixel_format(im.fourcc);
+    if (!format.bytes || im.modifier) return false;
+
+    auto const& [w, h] = im.size;
+    if (w <= 0 || h <= 0) return false;
+
+    int const cw = (w + 1) / 2, ch = (h + 1) / 2;
+    switch (format.chroma) {
+        case 0:
+            return im.channels.size() == 1 &&
+                channel_fits(im, 0, w * format.bytes, h);
+        case 2:
+            return im.channels.size() == 2 &&
+                channel_fits(im, 0, w, h) && channel_fits(im, 1, cw * 2, ch);
+        case 3:
+            return im.channels.size() == 3 &&
+                channel_fits(im, 0, w, h) && channel_fits(im, 1, cw, ch) &&
+                channel_fits(im, 2, cw, ch);
+        default:
+            return false;
+    }
+}
+
+void composite_layers(
+    std::vector<DisplayLayer> const& layers,
+    XY<int> origin, XY<int> size, uint8_t* out, int out_stride
+) {
+    for (int y = 0; y < size.y; ++y)
+        std::memset(out + y * out_stride, 0, size.x * 4);
+
+    std::vector<int> xs, ys;
+    std::vector<uint8_t> pixels;
+    for (auto const& layer : layers) {
+        CHECK_ARG(can_composite(layer), "Can't composite: {}", debug(layer));
+        if (layer.opacity <= 0 || !layer.to_size.x || !layer.to_size.y)
+            continue;
+
+        auto const to_end = layer.to_xy + layer.to_size - origin;
+        int const x0 = std::max(layer.to_xy.x - origin.x, 0);
+        int const y0 = std::max(layer.to_xy.y - origin.y, 0);
+        int const x1 = std::min(to_end.x, size.x);
+        int const y1 = std::min(to_end.y, size.y);
+        if (x0 >= x1 || y0 >= y1) continue;
+
+        Source const source{layer.image->content()};
+        int const opacity = std::lround(std::min(layer.opacity, 1.0) * 256);
+        bool const opaque = source.format.a < 0 && opacity >= 256;
+
+        // Unrotated (or 180) layers map screen x to source x independently
+        // of y, so the column lookup is shared by every row
+        int const n = x1 - x0;
+        xs.resize(n);
+        ys.resize(n);
+        pixels.resize(n * 4);
+        bool const straight = layer.rotate % 180 == 0;
+        bool contiguous = straight && source.is_rgba();
+        for (int x = 0; straight && x < n; ++x) {
+            XY<double> const screen = {origin.x + x0 + x + 0.5, 0.5};
+            int const sx = source_xy(layer, screen).x;
+            xs[x] = std::clamp(sx, 0, source.size.x - 1);
+            contiguous = contiguous && xs[x] == xs[0] + x;
+        }
+
+        for (int y = y0; y < y1; ++y) {
+            XY<double> const screen = {origin.x + x0 + 0.5, origin.y + y + 0.5};
+            auto const p0 = source_xy(layer, screen);
+            int const sy = std::clamp(int(p0.y), 0, source.size.y - 1);
+
+            uint8_t const* from = pixels.data();
+            if (contiguous) {
+                from = source.data[0] + sy * source.stride[0] + xs[0] * 4;
+            } else if (straight) {
+                std::fill(ys.begin(), ys.end(), sy);
+                source.fetch(xs.data(), ys.data(), n, pixels.data());
+            } else {
+                // Source coordinates are affine in screen x; step along row
+                auto const step =
+                    source_xy(layer, screen + XY<double>{1, 0}) - p0;
+                for (int x = 0; x < n; ++x) {
+                    auto const p = p0 + step * x;
+                    xs[x] = std::clamp(int(p.x), 0, source.size.x - 1);
+                    ys[x] = std::clamp(int(p.y), 0, source.size.y - 1);
+                }
+                source.fetch(xs.data(), ys.data(), n, pixels.data());
+            }
+
+            uint8_t* to = out + y * out_stride + x0 * 4;
+            if (opaque) {
+                std::memcpy(to, from, n * 4);
+            } else {
+                blend_row(from, to, n, opacity);
+            }
+        }
+    }
+}
+
+std::unique_ptr<SoftwareCompositor> start_software_compositor(
+    std::shared_ptr<UnixSystem> sys, SoftwareCompositorOptions const& options
+) {
+    auto compositor = std::make_unique<SoftwareCompositorDef>();
+    compositor->start(std::move(sys), options);
+    return compositor;
+}
+
+}  // namespace pivid
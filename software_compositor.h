@@ -0,0 +1,58 @@
+// CPU blending of display layers, used to flatten layers when the display
+// hardware would otherwise be overloaded, and to render frames for headless
+// displays and golden-image tests.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "display_output.h"
+#include "unix_system.h"
+#include "xy.h"
+
+namespace pivid {
+
+// Returns true if composite_layers() can read the layer's image
+// (linear RGB, premultiplied "rgbA", or I420/NV12 without format modifiers).
+bool can_composite(DisplayLayer const&);
+
+// Blends layers (ordered back to front) into premultiplied "rgbA" pixels
+// covering the screen rectangle at origin of the given size, starting from
+// transparent black. Throws std::invalid_argument if !can_composite(layer).
+// Runs on the calling thread; see SoftwareCompositor for multithreading.
+void composite_layers(
+    std::vector<DisplayLayer> const&,
+    XY<int> origin, XY<int> size, uint8_t* out, int out_stride
+);
+
+// Tuning parameters for start_software_compositor().
+struct SoftwareCompositorOptions {
+    int threads = 0;         // Threads including the caller (0 = one per CPU)
+    int min_band_rows = 16;  // Smallest slice of rows handed to a thread
+};
+
+// Multithreaded wrapper for composite_layers(), which splits the output
+// into bands of rows that are blended in parallel on a worker thread pool.
+// *Internally synchronized* for multithreaded access.
+class SoftwareCompositor {
+  public:
+    virtual ~SoftwareCompositor() = default;
+
+    // Like composite_layers(), but spread across worker threads.
+    virtual void composite(
+        std::vector<DisplayLayer> const&,
+        XY<int> origin, XY<int> size, uint8_t* out, int out_stride
+    ) = 0;
+
+    // Renders the visible layers of a frame at frame.mode.size into
+    // newly allocated memory as a premultiplied "rgbA" image.
+    virtual ImageBuffer render(DisplayFrame const&) = 0;
+};
+
+// Creates a compositor and starts its worker threads.
+std::unique_ptr<SoftwareCompositor> start_software_compositor(
+    std::shared_ptr<UnixSystem> sys, SoftwareCompositorOptions const& = {}
+);
+
+}  // namespace pivid
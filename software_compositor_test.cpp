@@ -0,0 +1,266 @@
+#include "software_compositor.h"
+
+#include <chrono>
+
+#include <doctest/doctest.h>
+#include <fmt/core.h>
+
+namespace pivid {
+
+namespace {
+
+class VectorBuffer : public MemoryBuffer {
+  public:
+    VectorBuffer(std::vector<uint8_t> d) : data(std::move(d)) {}
+    virtual int size() const final { return data.size(); }
+    virtual uint8_t const* read() final { return data.data(); }
+
+  private:
+    std::vector<uint8_t> data;
+};
+
+class FakeImage : public LoadedImage {
+  public:
+    FakeImage(ImageBuffer i) : im(std::move(i)) {}
+    virtual uint32_t drm_id() const final { return 1; }
+    virtual ImageBuffer const& content() const final { return im; }
+
+  private:
+    ImageBuffer im;
+};
+
+// Makes an unscaled layer from packed pixel data.
+DisplayLayer make_layer(
+    uint32_t format, XY<int> size, int bpp, std::vector<uint8_t> pixels
+) {
+    ImageBuffer im = {};
+    im.fourcc = format;
+    im.size = size;
+    im.channels.resize(1);
+    im.channels[0].size = pixels.size();
+    im.channels[0].stride = size.x * bpp;
+    im.channels[0].memory = std::make_shared<VectorBuffer>(std::move(pixels));
+
+    DisplayLayer layer = {};
+    layer.image = std::make_shared<FakeImage>(std::move(im));
+    layer.from_size = size.as<double>();
+    layer.to_size = size;
+    return layer;
+}
+
+// Makes a test pattern image of a given format, scaled to a screen area.
+DisplayLayer make_pattern(uint32_t format, XY<int> size, XY<int> to_size) {
+    auto const [w, h] = size;
+    int const cw = (w + 1) / 2, ch = (h + 1) / 2;
+    std::vector<ImageBuffer::Channel> channels;
+    if (format == fourcc("NV12")) {
+        channels = {
+            {nullptr, 0, w * h, w},
+            {nullptr, w * h, cw * ch * 2, cw * 2},
+        };
+    } else if (format == fourcc("I420")) {
+        channels = {
+            {nullptr, 0, w * h, w},
+            {nullptr, w * h, cw * ch, cw},
+            {nullptr, w * h + cw * ch, cw * ch, cw},
+        };
+    } else {
+        int const bpp = (format == fourcc("RGB\x18")) ? 3 : 4;
+        channels = {{nullptr, 0, w * h * bpp, w * bpp}};
+    }
+
+    auto const& last = channels.back();
+    std::vector<uint8_t> pixels(last.offset + last.size);
+    for (size_t i = 0; i < pixels.size(); ++i) pixels[i] = (i * 7) % 251;
+    if (format == fourcc("rgbA")) {
+        for (size_t i = 0; i + 3 < pixels.size(); i += 4) {
+            for (int c = 0; c < 3; ++c)
+                pixels[i + c] = std::min(pixels[i + c], pixels[i + 3]);
+        }
+    }
+
+    ImageBuffer im = {};
+    im.fourcc = format;
+    im.size = size;
+    auto const mem = std::make_shared<VectorBuffer>(std::move(pixels));
+    for (auto& chan : channels) chan.memory = mem;
+    im.channels = std::move(channels);
+
+    DisplayLayer layer = {};
+    layer.image = std::make_shared<FakeImage>(std::move(im));
+    layer.from_size = size.as<double>();
+    layer.to_size = to_size;
+    return layer;
+}
+
+std::vector<uint8_t> run(
+    std::vector<DisplayLayer> const& layers, XY<int> origin, XY<int> size
+) {
+    std::vector<uint8_t> out(size.x * size.y * 4, 0xEE);
+    composite_layers(layers, origin, size, out.data(), size.x * 4);
+    return out;
+}
+
+}  // anonymous namespace
+
+TEST_CASE("can_composite") {
+    auto layer = make_layer(fourcc("RGB0"), {1, 1}, 4, {1, 2, 3, 4});
+    CHECK(can_composite(layer));
+
+    auto short_layer = make_layer(fourcc("RGB0"), {2, 1}, 4, {1, 2, 3, 4});
+    CHECK_FALSE(can_composite(short_layer));
+
+    auto odd_layer = make_layer(fourcc("YUYV"), {1, 1}, 4, {1, 2, 3, 4});
+    CHECK_FALSE(can_composite(odd_layer));
+
+    ImageBuffer tiled = layer.image->content();
+    tiled.modifier = 1;
+    layer.image = std::make_shared<FakeImage>(tiled);
+    CHECK_FALSE(can_composite(layer));
+}
+
+TEST_CASE("composite_layers") {
+    SUBCASE("Opaque and offset") {
+        auto layer = make_layer(
+            fourcc("BGR0"), {2, 1}, 4, {30, 20, 10, 0, 60, 50, 40, 0}
+        );
+        layer.to_xy = {1, 0};
+        auto const out = run({layer}, {0, 0}, {3, 1});
+        CHECK(out == std::vector<uint8_t>{
+            0, 0, 0, 0, 10, 20, 30, 255, 40, 50, 60, 255
+        });
+    }
+
+    SUBCASE("Origin and scaling") {
+        auto layer = make_layer(
+            fourcc("rgbA"), {2, 1}, 4, {1, 2, 3, 255, 4, 5, 6, 255}
+        );
+        layer.to_size = {4, 2};
+        auto const out = run({layer}, {2, 1}, {2, 1});
+        CHECK(out == std::vector<uint8_t>{4, 5, 6, 255, 4, 5, 6, 255});
+    }
+
+    SUBCASE("Alpha blending") {
+        auto const back = make_layer(fourcc("RGB0"), {1, 1}, 4, {200, 0, 0, 0});
+        auto front = make_layer(fourcc("rgbA"), {1, 1}, 4, {0, 0, 100, 128});
+        CHECK(run({back, front}, {0, 0}, {1, 1}) == std::vector<uint8_t>{
+            100, 0, 100, 255
+        });
+
+        front.opacity = 0.5;
+        CHECK(run({back, front}, {0, 0}, {1, 1}) == std::vector<uint8_t>{
+            150, 0, 50, 255
+        });
+    }
+
+    SUBCASE("Rotation") {
+        auto layer = make_layer(
+            fourcc("RGB\x18"), {2, 1}, 3, {1, 1, 1, 2, 2, 2}
+        );
+        layer.rotate = 90;
+        layer.to_size = {1, 2};
+        CHECK(run({layer}, {0, 0}, {1, 2}) == std::vector<uint8_t>{
+            1, 1, 1, 255, 2, 2, 2, 255
+        });
+
+        layer.reflect = true;
+        CHECK(run({layer}, {0, 0}, {1, 2}) == std::vector<uint8_t>{
+            2, 2, 2, 255, 1, 1, 1, 255
+        });
+    }
+
+    SUBCASE("I420") {
+        ImageBuffer im = {};
+        im.fourcc = fourcc("I420");
+        im.size = {2, 2};
+        auto const mem = std::make_shared<VectorBuffer>(
+            std::vector<uint8_t>{235, 16, 126, 126, 128, 128}
+        );
+        for (int c = 0; c < 3; ++c) {
+            im.channels.push_back({mem, c ? 3 + c : 0, c ? 1 : 4, c ? 1 : 2});
+        }
+
+        DisplayLayer layer = {};
+        layer.image = std::make_shared<FakeImage>(std::move(im));
+        layer.from_size = {2, 2};
+        layer.to_size = {2, 2};
+        REQUIRE(can_composite(layer));
+
+        auto const out = run({layer}, {0, 0}, {2, 1});
+        CHECK(out == std::vector<uint8_t>{255, 255, 255, 255, 0, 0, 0, 255});
+    }
+}
+
+TEST_CASE("SoftwareCompositor") {
+    SoftwareCompositorOptions options = {};
+    options.threads = 3;
+    options.min_band_rows = 1;
+    auto const compositor = start_software_compositor(global_system(), options);
+
+    auto back = make_pattern(fourcc("NV12"), {64, 48}, {100, 75});
+    auto front = make_pattern(fourcc("rgbA"), {30, 20}, {45, 50});
+    front.to_xy = {7, 9};
+    front.opacity = 0.7;
+    auto side = make_pattern(fourcc("RGB\x18"), {10, 20}, {20, 10});
+    side.to_xy = {80, 60};
+    side.rotate = 270;
+    std::vector<DisplayLayer> const layers = {back, front, side};
+
+    XY<int> const size = {100, 75};
+    auto const expected = run(layers, {0, 0}, size);
+    std::vector<uint8_t> out(size.x * size.y * 4, 0xEE);
+    compositor->composite(layers, {0, 0}, size, out.data(), size.x * 4);
+    CHECK(out == expected);
+
+    DisplayFrame frame = {};
+    frame.mode.size = size;
+    frame.layers = layers;
+    auto const image = compositor->render(frame);
+    REQUIRE(image.channels.size() == 1);
+    CHECK(image.fourcc == fourcc("rgbA"));
+    CHECK(image.size == size);
+    auto const* data = image.channels[0].memory->read();
+    CHECK(std::vector<uint8_t>(data, data + out.size()) == expected);
+
+    auto const bad = make_layer(fourcc("YUYV"), {1, 1}, 4, {1, 2, 3, 4});
+    CHECK_THROWS_AS(
+        compositor->composite({bad}, {0, 0}, {1, 1}, out.data(), 4),
+        std::invalid_argument
+    );
+}
+
+// Run with --no-skip to report compositing speed for each source format.
+TEST_CASE("SoftwareCompositor throughput" * doctest::skip()) {
+    auto const compositor = start_software_compositor(global_system());
+    XY<int> const size = {1920, 1080};
+    std::vector<uint8_t> out(size.x * size.y * 4);
+
+    for (auto const* name : {"rgbA", "BGR0", "RGB\x18", "NV12", "I420"}) {
+        auto const format = fourcc(name);
+        for (auto const& [from, opacity] : {
+            std::pair<XY<int>, double>{size, 1.0},
+            std::pair<XY<int>, double>{{1280, 720}, 0.5},
+        }) {
+            auto layer = make_pattern(format, from, size);
+            layer.opacity = opacity;
+
+            int const reps = 10;
+            auto const start = std::chrono::steady_clock::now();
+            for (int r = 0; r < reps; ++r) {
+                compositor->composite(
+                    {layer}, {0, 0}, size, out.data(), size.x * 4
+                );
+            }
+            std::chrono::duration<double> const t =
+                std::chrono::steady_clock::now() - start;
+            MESSAGE(fmt::format(
+                "{} {}x{} a={:.1f}: {:.1f}ms/frame, {:.0f}Mpix/s",
+                debug_fourcc(format), from.x, from.y, opacity,
+                t.count() / reps * 1e3,
+                reps * double(size.x) * size.y / t.count() * 1e-6
+            ));
+        }
+    }
+}
+
+}  // namespace pivid
@@ -0,0 +1,53 @@
+// Lock-free queue for handing data from one thread to another.
+
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <vector>
+
+namespace pivid {
+
+// Bounded ring buffer with one producer thread and one consumer thread.
+// Neither side ever blocks, so a realtime consumer can poll it freely.
+// *Not internally synchronized* beyond that; multiple producers (or
+// consumers) must serialize among themselves.
+template <typename T>
+class SpscQueue {
+  public:
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+    // Producer: adds an item, or returns false (leaving it alone) if full.
+    bool try_push(T&& item) {
+        auto const t = tail.load(std::memory_order_relaxed);
+        auto const next = (t + 1) % slots.size();
+        if (next == head.load(std::memory_order_acquire)) return false;
+        slots[t] = std::move(item);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: removes the oldest item, or returns nullopt if empty.
+    std::optional<T> try_pop() {
+        auto const h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return {};
+        std::optional<T> item{std::move(slots[h])};
+        slots[h] = T{};  // Release resources held by the moved-from slot
+        head.store((h + 1) % slots.size(), std::memory_order_release);
+        return item;
+    }
+
+    // Either side: true if nothing is queued (may be stale immediately).
+    bool empty() const {
+        return
+            head.load(std::memory_order_acquire) ==
+            tail.load(std::memory_order_acquire);
+    }
+
+  private:
+    std::vector<T> slots;  // One slot always stays free to mark "full"
+    alignas(64) std::atomic<size_t> head = 0;  // Next to pop (consumer)
+    alignas(64) std::atomic<size_t> tail = 0;  // Next to push (producer)
+};
+
+}  // namespace pivid
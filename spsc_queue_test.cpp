@@ -0,0 +1,64 @@
+#include "spsc_queue.h"
+
+#include <memory>
+#include <thread>
+
+#include <doctest/doctest.h>
+
+namespace pivid {
+
+TEST_CASE("SpscQueue") {
+    SpscQueue<std::unique_ptr<int>> queue(3);
+    CHECK(queue.empty());
+    CHECK(!queue.try_pop());
+
+    for (int i = 0; i < 3; ++i)
+        CHECK(queue.try_push(std::make_unique<int>(i)));
+    auto extra = std::make_unique<int>(99);
+    CHECK(!queue.try_push(std::move(extra)));
+    CHECK(extra);  // Not consumed when full
+    CHECK(!queue.empty());
+
+    for (int i = 0; i < 3; ++i) {
+        auto item = queue.try_pop();
+        REQUIRE(item);
+        CHECK(**item == i);
+    }
+    CHECK(queue.empty());
+
+    // Wrap around the ring
+    for (int i = 0; i < 10; ++i) {
+        CHECK(queue.try_push(std::make_unique<int>(i)));
+        CHECK(queue.try_push(std::make_unique<int>(i + 100)));
+        CHECK(**queue.try_pop() == i);
+        CHECK(**queue.try_pop() == i + 100);
+    }
+    CHECK(queue.empty());
+}
+
+TEST_CASE("SpscQueue threads") {
+    SpscQueue<int> queue(16);
+    int const count = 100000;
+    std::thread producer([&] {
+        for (int i = 0; i < count; ++i) {
+            while (!queue.try_push(int{i})) std::this_thread::yield();
+        }
+    });
+
+    int expected = 0;
+    while (expected < count) {
+        auto const item = queue.try_pop();
+        if (!item) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (*item != expected) break;
+        ++expected;
+    }
+
+    producer.join();
+    CHECK(expected == count);
+    CHECK(queue.empty());
+}
+
+}  // namespace pivid
@@ -2,15 +2,20 @@
 
 #include <dirent.h>
 #include <limits.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <cmath>
 #include <condition_variable>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <mutex>
 #include <sstream>
 
@@ -56,6 +61,13 @@ class FileDescriptorDef : public FileDescriptor {
         return {0, {mem, [len](void* m) {::munmap(m, len);}}};
     }
 
+    virtual ErrnoOr<short> poll(short events, double timeout) final {
+        pollfd pfd = {.fd = fd, .events = events, .revents = 0};
+        int const ms = timeout < 0 ? -1 : std::ceil(timeout * 1e3);
+        auto const ret = run_sys([&] {return ::poll(&pfd, 1, ms);});
+        return {ret.err, ret.err ? short(0) : pfd.revents};
+    }
+
   private:
     int fd = -1;
 };
@@ -142,6 +154,12 @@ class UnixSystemDef : public UnixSystem {
         return ret;
     }
 
+    virtual ErrnoOr<struct stat> fstat(int raw_fd) const final {
+        ErrnoOr<struct stat> ret;
+        ret.err = run_sys([&] {return ::fstat(raw_fd, &ret.value);}).err;
+        return ret;
+    }
+
     virtual ErrnoOr<std::string> realpath(std::string const& path) const final {
         char buf[PATH_MAX];
         if (!::realpath(path.c_str(), buf)) return {errno, {}};
@@ -189,6 +207,34 @@ class UnixSystemDef : public UnixSystem {
         auto const r = run_sys([&] { return ::waitid(idtype, id, &s, flags); });
         return {r.err, s};
     }
+
+    virtual ErrnoOr<int> set_thread_policy(ThreadPolicy const& policy) final {
+        if (!policy.cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int const cpu : policy.cpus) {
+                if (cpu < 0 || cpu >= CPU_SETSIZE) return {EINVAL};
+                CPU_SET(cpu, &set);
+            }
+            auto const me = pthread_self();
+            int const err = pthread_setaffinity_np(me, sizeof(set), &set);
+            if (err) return {err};
+        }
+
+        if (policy.realtime_priority) {
+            sched_param param = {};
+            param.sched_priority = policy.realtime_priority;
+            auto const me = pthread_self();
+            int const err = pthread_setschedparam(me, SCHED_FIFO, &param);
+            if (err) return {err};
+        }
+
+        return {};
+    }
+
+    virtual ErrnoOr<int> lock_memory() final {
+        return run_sys([&] { return ::mlockall(MCL_CURRENT | MCL_FUTURE); });
+    }
 };
 
 }  // namespace
@@ -267,4 +313,14 @@ std::string abbrev_realtime(double t) {
     );
 }
 
+std::string read_text(std::string const& filename) {
+    std::ifstream ifs;
+    ifs.exceptions(~std::ifstream::goodbit);
+    ifs.open(filename, std::ios::binary);
+    return std::string(
+        (std::istreambuf_iterator<char>(ifs)),
+        (std::istreambuf_iterator<char>())
+    );
+}
+
 }  // namespace pivid
@@ -53,6 +53,10 @@ class FileDescriptor {
     virtual ErrnoOr<int> ioctl(uint32_t nr, void* data) = 0;
     virtual ErrnoOr<std::shared_ptr<void>> mmap(size_t, int, int, off_t) = 0;
 
+    // Waits up to timeout seconds (forever if negative) for poll() events;
+    // returns the events that occurred (0 on timeout).
+    virtual ErrnoOr<short> poll(short events, double timeout) = 0;
+
     // Executes a no-parameter ioctl, checking ioctl type.
     template <uint32_t nr>
     ErrnoOr<int> ioc() {
@@ -87,6 +91,13 @@ class SyncFlag {
     virtual bool sleep_until(double) = 0;  // Deadline wait (true if woken).
 };
 
+// Scheduling for a thread, as set by UnixSystem::set_thread_policy().
+// Default values leave the thread as it is (inherited from its creator).
+struct ThreadPolicy {
+    int realtime_priority = 0;  // SCHED_FIFO priority (1-99) if nonzero
+    std::vector<int> cpus;      // CPU numbers to run on, if not empty
+};
+
 // Interface to the Unix OS, typically a singleton returned by global_system().
 // *Internally synchronized* (by the OS, mainly) for multithreaded access.
 class UnixSystem {
@@ -101,6 +112,7 @@ class UnixSystem {
 
     // Filesystem operations
     virtual ErrnoOr<struct stat> stat(std::string const&) const = 0;
+    virtual ErrnoOr<struct stat> fstat(int raw_fd) const = 0;
     virtual ErrnoOr<std::string> realpath(std::string const&) const = 0;
     virtual ErrnoOr<std::vector<std::string>> ls(std::string const&) const = 0;
 
@@ -121,6 +133,14 @@ class UnixSystem {
         std::optional<std::vector<std::string>> const& environ = {}
     ) = 0;
     virtual ErrnoOr<siginfo_t> wait(idtype_t, id_t, int flags) = 0;
+
+    // Applies scheduling priority and CPU affinity to the *calling* thread.
+    // Realtime priority needs privileges (root, CAP_SYS_NICE or RLIMIT_RTPRIO).
+    virtual ErrnoOr<int> set_thread_policy(ThreadPolicy const&) = 0;
+
+    // Locks all current and future process memory in RAM, like mlockall().
+    // Needs privileges or an RLIMIT_MEMLOCK covering all video buffers.
+    virtual ErrnoOr<int> lock_memory() = 0;
 };
 
 // Returns the singleton Unix access interface.
@@ -131,4 +151,7 @@ double parse_realtime(std::string const&);
 std::string format_realtime(double);
 std::string abbrev_realtime(double);
 
+// Returns a whole file's contents. Throws std::ios_base::failure on error.
+std::string read_text(std::string const& filename);
+
 }  // namespace pivid
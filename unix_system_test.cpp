@@ -1,5 +1,9 @@
 #include "unix_system.h"
 
+#include <sched.h>
+
+#include <thread>
+
 #include <doctest/doctest.h>
 
 namespace pivid {
@@ -35,6 +39,23 @@ TEST_CASE("format_realtime") {
     );
 }
 
+TEST_CASE("set_thread_policy") {
+    auto const sys = global_system();
+    std::thread([&] {
+        CHECK(sys->set_thread_policy({}).err == 0);
+        CHECK(sys->set_thread_policy({0, {-1}}).err == EINVAL);
+
+        int const cpu = sched_getcpu();
+        REQUIRE(cpu >= 0);
+        CHECK(sys->set_thread_policy({0, {cpu}}).err == 0);
+
+        cpu_set_t set;
+        REQUIRE(sched_getaffinity(0, sizeof(set), &set) == 0);
+        CHECK(CPU_COUNT(&set) == 1);
+        CHECK(CPU_ISSET(cpu, &set));
+    }).join();
+}
+
 TEST_CASE("abbrev_realtime") {
     CHECK(abbrev_realtime(1649808363.086814454) == "00:06:03.087Z");
 }
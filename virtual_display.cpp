@@ -0,0 +1,350 @@
+#include "virtual_display.h"
+
+#include <pthread.h>
+
+#include <cmath>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "logging_policy.h"
+#include "software_compositor.h"
+
+namespace pivid {
+
+namespace {
+
+auto const& virtual_logger() {
+    static const auto logger = make_logger("virtual");
+    return logger;
+}
+
+class VirtualImage : public LoadedImage {
+  public:
+    VirtualImage(uint32_t id, ImageBuffer image)
+        : id(id), im(std::move(image)) {}
+
+    virtual uint32_t drm_id() const final { return id; }
+    virtual ImageBuffer const& content() const final { return im; }
+
+  private:
+    uint32_t id;
+    ImageBuffer im;
+};
+
+class VirtualDisplayDriverDef : public VirtualDisplayDriver {
+  public:
+    virtual ~VirtualDisplayDriverDef() {
+        std::unique_lock lock{mutex};
+        if (thread.joinable()) {
+            DEBUG(logger, "Stopping virtual display...");
+            shutdown = true;
+            lock.unlock();
+            wakeup->set();
+            thread.join();
+            lock.lock();
+        }
+
+        for (auto& [id, screen] : screens) {
+            for (auto& flip : screen.flips) {
+                flip.promise.set_exception(std::make_exception_ptr(
+                    std::runtime_error("Virtual display closed")
+                ));
+            }
+
+            if (screen.shown_count > 0) {
+                logger->info(
+                    "{} {} frames, {} late, latency avg={:.1f}ms max={:.1f}ms",
+                    screen.name, screen.shown_count, screen.late_count,
+                    screen.total_latency / screen.shown_count * 1e3,
+                    screen.max_latency * 1e3
+                );
+            }
+        }
+    }
+
+    virtual std::vector<DisplayScreen> scan_screens() final {
+        std::unique_lock const lock{mutex};
+        std::vector<DisplayScreen> out;
+        for (auto const& [id, screen] : screens) {
+            DisplayScreen s = {};
+            s.id = id;
+            s.connector = screen.name;
+            s.display_detected = true;
+            s.active_mode = screen.mode;
+            s.modes = modes;
+            out.push_back(std::move(s));
+        }
+        return out;
+    }
+
+    virtual std::unique_ptr<LoadedImage> load_image(ImageBuffer im) final {
+        CHECK_ARG(im.size.x > 0 && im.size.y > 0, "Bad size: {}", debug(im));
+        std::unique_lock const lock{mutex};
+        TRACE(logger, "Loading i{} {}", next_image_id, debug(im));
+        return std::make_unique<VirtualImage>(next_image_id++, std::move(im));
+    }
+
+    virtual std::future<DisplayUpdated> request_update(
+        uint32_t screen_id, DisplayFrame const& frame
+    ) final {
+        auto const now = sys->clock();
+        std::unique_lock const lock{mutex};
+        auto* const flip = add_flip(lock, screen_id, frame, now);
+        wakeup->set();
+        return flip->promise.get_future();
+    }
+
+    virtual std::future<std::map<uint32_t, DisplayUpdated>>
+    request_group_update(
+        std::map<uint32_t, DisplayFrame> const& frames
+    ) final {
+        auto const now = sys->clock();
+        auto group = std::make_shared<GroupWait>();
+        auto future = group->promise.get_future();
+
+        std::unique_lock const lock{mutex};
+        for (auto const& [screen_id, frame] : frames) {
+            CHECK_ARG(
+                screens.at(screen_id).flips.size() < 2,
+                "Update requested before prev done"
+            );
+        }
+
+        for (auto const& [screen_id, frame] : frames) {
+            add_flip(lock, screen_id, frame, now)->group = group;
+            ++group->pending;
+        }
+
+        if (!group->pending) group->promise.set_value({});
+        wakeup->set();
+        return future;
+    }
+
+    virtual size_t validate(uint32_t, DisplayFrame const& frame) final {
+        DisplayFrame accepted = frame;
+        while (visible_layers(accepted).size() > options.max_planes)
+            accepted.layers.pop_back();
+        return accepted.layers.size();
+    }
+
+    virtual DisplayCost predict_cost(DisplayFrame const& frame) const final {
+        return estimate_cost(options.cost_model, frame);
+    }
+
+    virtual std::vector<VirtualFrameRecord> history() const final {
+        std::unique_lock const lock{mutex};
+        return {records.begin(), records.end()};
+    }
+
+    virtual ImageBuffer capture(uint32_t screen_id) final {
+        std::unique_lock lock{mutex};
+        auto const frame = screens.at(screen_id).shown;
+        lock.unlock();
+        return compositor->render(frame);
+    }
+
+    void start(
+        std::shared_ptr<UnixSystem> sys, VirtualDisplayOptions const& options
+    ) {
+        logger->info("Starting virtual display...");
+        this->sys = std::move(sys);
+        this->options = options;
+
+        uint32_t id = 0;
+        for (auto const& name : options.connectors)
+            screens[++id].name = name;
+
+        // List 1080p60 first as the "best" mode, then all CTA-861 modes.
+        for (auto const& mode : cta_861_modes) {
+            bool const best = mode.size == XY<int>{1920, 1080} &&
+                mode.nominal_hz == 60 && mode.doubling.y == 0;
+            modes.insert(best ? modes.begin() : modes.end(), mode);
+        }
+
+        compositor = start_software_compositor(this->sys);
+        wakeup = this->sys->make_flag();
+        thread = std::thread(&VirtualDisplayDriverDef::flip_thread, this);
+    }
+
+  private:
+    // Completion of a request_group_update(), once all its screens flip
+    struct GroupWait {
+        std::promise<std::map<uint32_t, DisplayUpdated>> promise;
+        std::map<uint32_t, DisplayUpdated> flips;
+        size_t pending = 0;
+    };
+
+    struct Flip {
+        double time = 0.0;
+        int64_t vsync = 0;  // Index in the screen's vsync grid
+        DisplayFrame frame;
+        std::promise<DisplayUpdated> promise;  // Unless part of a group
+        std::shared_ptr<GroupWait> group;
+        VirtualFrameRecord record;
+    };
+
+    struct Screen {
+        std::string name;
+        DisplayMode mode = {};
+        double epoch = 0.0;        // Start of vsync grid for the mode
+        std::deque<Flip> flips;    // Pending (front) and queued updates
+        DisplayFrame shown;        // Holds images while visible
+        double shown_time = 0.0;
+        int shown_count = 0;
+        int late_count = 0;        // Vsyncs missed between updates
+        double total_latency = 0.0;
+        double max_latency = 0.0;
+    };
+
+    // Schedules a screen update at the next vsync after any pending flip.
+    Flip* add_flip(
+        std::unique_lock<std::mutex> const& lock,
+        uint32_t screen_id, DisplayFrame const& frame, double now
+    ) {
+        ASSERT(lock.owns_lock());
+        auto* const screen = &screens.at(screen_id);
+        CHECK_ARG(
+            screen->flips.size() < 2, "Update requested before prev done"
+        );
+
+        VirtualFrameRecord record = {};
+        record.screen_id = screen_id;
+        record.request_time = now;
+        for (auto const& layer : visible_layers(frame)) {
+            ++record.layers;
+            record.layer_pixels += double(layer.to_size.x) * layer.to_size.y;
+        }
+
+        // Vsyncs fall on a grid from the last mode change
+        auto const* prev =
+            screen->flips.empty() ? nullptr : &screen->flips.back();
+        auto const& mode = prev ? prev->frame.mode : screen->mode;
+        double const after = prev ? std::max(now, prev->time) : now;
+
+        Flip flip = {};
+        flip.frame = frame;
+        if (!frame.mode.nominal_hz) {
+            flip.time = after;
+        } else {
+            if (mode != frame.mode || !screen->epoch) {
+                screen->epoch = after;
+                prev = nullptr;
+            }
+
+            double const period = 1.0 / frame.mode.actual_hz();
+            flip.vsync = std::floor((after - screen->epoch) / period) + 1;
+            if (prev) flip.vsync = std::max(flip.vsync, prev->vsync + 1);
+            flip.time = screen->epoch + flip.vsync * period;
+        }
+
+        TRACE(
+            logger, "UPDATE {} {}l flip {}",
+            screen->name, record.layers, abbrev_realtime(flip.time)
+        );
+
+        flip.record = record;
+        screen->flips.push_back(std::move(flip));
+        return &screen->flips.back();
+    }
+
+    void flip_thread() {
+        pthread_setname_np(pthread_self(), "pivid:virtual");
+        DEBUG(logger, "Virtual display thread running...");
+
+        std::unique_lock lock{mutex};
+        while (!shutdown) {
+            Screen* next = nullptr;
+            for (auto& [id, screen] : screens) {
+                if (screen.flips.empty()) continue;
+                auto const t = screen.flips.front().time;
+                if (!next || t < next->flips.front().time) next = &screen;
+            }
+
+            if (!next) {
+                lock.unlock();
+                wakeup->sleep();
+                lock.lock();
+                continue;
+            }
+
+            double const flip_time = next->flips.front().time;
+            if (sys->clock() < flip_time) {
+                lock.unlock();
+                wakeup->sleep_until(flip_time);
+                lock.lock();
+                continue;
+            }
+
+            auto flip = std::move(next->flips.front());
+            next->flips.pop_front();
+
+            if (next->shown_count > 0 && next->mode.nominal_hz) {
+                double const period = 1.0 / next->mode.actual_hz();
+                if (flip.time - next->shown_time > 1.5 * period)
+                    ++next->late_count;
+            }
+
+            flip.record.flip_time = flip.time;
+            next->shown_time = flip.time;
+            auto const latency = flip.time - flip.record.request_time;
+            next->mode = flip.frame.mode;
+            next->shown = std::move(flip.frame);
+            next->total_latency += latency;
+            next->max_latency = std::max(next->max_latency, latency);
+            ++next->shown_count;
+
+            records.push_back(flip.record);
+            while (records.size() > options.history_size) records.pop_front();
+
+            DEBUG(
+                logger, "{} {}l done! {} ({:.1f}ms)",
+                next->name, flip.record.layers,
+                abbrev_realtime(flip.time), latency * 1e3
+            );
+
+            DisplayUpdated done = {};
+            done.flip_time = flip.time;
+            if (flip.group) {
+                auto* const group = flip.group.get();
+                group->flips[flip.record.screen_id] = done;
+                if (--group->pending == 0)
+                    group->promise.set_value(std::move(group->flips));
+            } else {
+                flip.promise.set_value(std::move(done));
+            }
+        }
+
+        DEBUG(logger, "Virtual display thread ending...");
+    }
+
+    // Constant from start to ~
+    std::shared_ptr<log::logger> const logger = virtual_logger();
+    std::shared_ptr<UnixSystem> sys;
+    VirtualDisplayOptions options;
+    std::vector<DisplayMode> modes;
+    std::unique_ptr<SoftwareCompositor> compositor;
+    std::thread thread;
+    std::unique_ptr<SyncFlag> wakeup;
+
+    // Guarded by mutex
+    std::mutex mutable mutex;
+    bool shutdown = false;
+    uint32_t next_image_id = 1;
+    std::map<uint32_t, Screen> screens;
+    std::deque<VirtualFrameRecord> records;
+};
+
+}  // anonymous namespace
+
+std::unique_ptr<VirtualDisplayDriver> open_virtual_display_driver(
+    std::shared_ptr<UnixSystem> sys, VirtualDisplayOptions const& options
+) {
+    auto driver = std::make_unique<VirtualDisplayDriverDef>();
+    driver->start(std::move(sys), options);
+    return driver;
+}
+
+}  // namespace pivid
@@ -0,0 +1,53 @@
+// Headless DisplayDriver that simulates screens and vsync timing,
+// for testing and benchmarking without display hardware.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "display_output.h"
+#include "unix_system.h"
+
+namespace pivid {
+
+// Record of one update completed by a virtual display.
+struct VirtualFrameRecord {
+    uint32_t screen_id = 0;
+    double request_time = 0.0;  // When request_update() was called
+    double flip_time = 0.0;     // Simulated vsync when the frame was shown
+    int layers = 0;             // Visible layers (after culling)
+    double layer_pixels = 0.0;  // Total on-screen area of visible layers
+};
+
+// Tuning parameters for open_virtual_display_driver().
+struct VirtualDisplayOptions {
+    std::vector<std::string> connectors = {"HDMI-1", "HDMI-2"};
+    size_t history_size = 10000;  // Frame records to keep for history()
+    DisplayCostModel cost_model;  // For predict_cost(); unlimited by default
+    size_t max_planes = SIZE_MAX;  // Visible layers validate() accepts
+};
+
+// A DisplayDriver with no hardware, which accepts any image (validating
+// frames only against VirtualDisplayOptions::max_planes), completes
+// updates at simulated vsync times (per DisplayMode::actual_hz()),
+// and records what was shown.
+// *Internally synchronized* for multithreaded access.
+class VirtualDisplayDriver : public DisplayDriver {
+  public:
+    // Returns records of recently shown frames, oldest first.
+    virtual std::vector<VirtualFrameRecord> history() const = 0;
+
+    // Renders the frame currently shown on a screen (see SoftwareCompositor).
+    // Throws std::invalid_argument if the screen is off.
+    virtual ImageBuffer capture(uint32_t screen_id) = 0;
+};
+
+// Creates a virtual display driver with simulated screens (initially off).
+std::unique_ptr<VirtualDisplayDriver> open_virtual_display_driver(
+    std::shared_ptr<UnixSystem> sys, VirtualDisplayOptions const& = {}
+);
+
+}  // namespace pivid
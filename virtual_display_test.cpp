@@ -0,0 +1,132 @@
+#include "virtual_display.h"
+
+#include <algorithm>
+#include <map>
+
+#include <doctest/doctest.h>
+
+namespace pivid {
+
+TEST_CASE("VirtualDisplayDriver") {
+    VirtualDisplayOptions options = {};
+    options.connectors = {"Test-1"};
+    auto const driver = open_virtual_display_driver(global_system(), options);
+
+    auto const screens = driver->scan_screens();
+    REQUIRE(screens.size() == 1);
+    CHECK(screens[0].connector == "Test-1");
+    CHECK_FALSE(screens[0].active_mode.nominal_hz);
+    REQUIRE(!screens[0].modes.empty());
+
+    auto const mode = screens[0].modes[0];
+    CHECK(mode.size == XY<int>{1920, 1080});
+    CHECK(mode.nominal_hz == 60);
+
+    ImageBuffer im = {};
+    im.fourcc = fourcc("I420");
+    im.size = {320, 240};
+
+    DisplayFrame frame = {};
+    frame.mode = mode;
+    auto* layer = &frame.layers.emplace_back();
+    layer->image = driver->load_image(im);
+    layer->from_size = {320, 240};
+    layer->to_size = {640, 480};
+
+    auto first = driver->request_update(screens[0].id, frame);
+    auto second = driver->request_update(screens[0].id, frame);
+    CHECK_THROWS_AS(
+        driver->request_update(screens[0].id, frame), std::invalid_argument
+    );
+
+    auto const first_time = first.get().flip_time;
+    auto const second_time = second.get().flip_time;
+    auto const period = 1.0 / mode.actual_hz();
+    CHECK(second_time - first_time == doctest::Approx(period).epsilon(1e-4));
+    CHECK(driver->scan_screens()[0].active_mode.nominal_hz == 60);
+
+    auto const history = driver->history();
+    REQUIRE(history.size() == 2);
+    CHECK(history[1].flip_time == second_time);
+    CHECK(history[1].layers == 1);
+    CHECK(history[1].layer_pixels == 640 * 480);
+
+    DisplayFrame blank = {};
+    blank.mode = mode;
+    driver->request_update(screens[0].id, blank).get();
+    auto const image = driver->capture(screens[0].id);
+    REQUIRE(image.channels.size() == 1);
+    CHECK(image.fourcc == fourcc("rgbA"));
+    CHECK(image.size == mode.size);
+    auto const* data = image.channels[0].memory->read();
+    CHECK(std::all_of(data, data + mode.size.x * mode.size.y * 4, [](auto b) {
+        return b == 0;
+    }));
+}
+
+TEST_CASE("VirtualDisplayDriver validate") {
+    VirtualDisplayOptions options = {};
+    options.connectors = {"Test-1"};
+    options.max_planes = 2;
+    auto const driver = open_virtual_display_driver(global_system(), options);
+    auto const screen = driver->scan_screens().at(0);
+
+    ImageBuffer im = {};
+    im.fourcc = fourcc("I420");
+    im.size = {320, 240};
+    std::shared_ptr<LoadedImage> const image = driver->load_image(im);
+
+    DisplayFrame frame = {};
+    frame.mode = screen.modes.at(0);
+    for (int l = 0; l < 4; ++l) {
+        auto* layer = &frame.layers.emplace_back();
+        layer->image = image;
+        layer->from_size = {320, 240};
+        layer->to_xy = {l * 100, 0};
+        layer->to_size = {320, 240};
+        layer->opacity = 0.5;
+    }
+    CHECK(driver->validate(screen.id, frame) == 2);
+
+    frame.layers[1].opacity = 0.0;  // Invisible layers need no plane
+    CHECK(driver->validate(screen.id, frame) == 3);
+
+    frame.layers.resize(2);
+    CHECK(driver->validate(screen.id, frame) == 2);
+}
+
+TEST_CASE("VirtualDisplayDriver group update") {
+    VirtualDisplayOptions options = {};
+    options.connectors = {"Test-1", "Test-2"};
+    auto const driver = open_virtual_display_driver(global_system(), options);
+    auto const screens = driver->scan_screens();
+    REQUIRE(screens.size() == 2);
+
+    std::map<uint32_t, DisplayFrame> frames;
+    for (auto const& screen : screens) frames[screen.id].mode = screen.modes[0];
+
+    auto first = driver->request_group_update(frames);
+    auto second = driver->request_group_update(frames);
+    frames.erase(screens[0].id);
+    CHECK_THROWS_AS(
+        driver->request_group_update(frames), std::invalid_argument
+    );
+    CHECK(driver->history().empty());  // Nothing queued by the failed call
+
+    auto const first_flips = first.get();
+    auto const second_flips = second.get();
+    REQUIRE(first_flips.size() == 2);
+    REQUIRE(second_flips.size() == 2);
+    for (auto const& screen : screens) {
+        CHECK(first_flips.at(screen.id).flip_time > 0);
+        CHECK(
+            second_flips.at(screen.id).flip_time >
+            first_flips.at(screen.id).flip_time
+        );
+    }
+
+    CHECK(driver->history().size() == 4);
+    CHECK(driver->request_group_update({}).get().empty());
+}
+
+}  // namespace pivid
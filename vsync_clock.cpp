@@ -0,0 +1,75 @@
+#include "vsync_clock.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "logging_policy.h"
+
+namespace pivid {
+
+namespace {
+
+size_t const max_flips = 120;     // History used for the fit
+double const max_drift = 0.002;   // Fit period limit relative to nominal
+double const max_offset = 0.25;   // Tolerated error in periods, else restart
+
+}  // anonymous namespace
+
+VsyncClock::VsyncClock(double nominal_period)
+    : nominal(nominal_period), fit_period(nominal_period) {
+    CHECK_ARG(nominal_period >= 0, "Bad vsync period: {}", nominal_period);
+}
+
+void VsyncClock::add_flip(double flip_time) {
+    if (!flips.empty() && fit_period > 0) {
+        // fit_origin is the predicted vblank for index 0 (near ref_time)
+        double const periods = (flip_time - fit_origin) / fit_period;
+        auto const index = std::llround(periods);
+        if (std::abs(periods - index) <= max_offset) {
+            Flip const flip = {index, flip_time - ref_time};
+            if (flip.index <= flips.back().index) return;  // Not a new vblank
+            flips.push_back(flip);
+            if (flips.size() > max_flips) flips.pop_front();
+            refit();
+            return;
+        }
+    }
+
+    // First flip, or off the grid: restart history at this flip
+    ref_time = flip_time;
+    flips.assign(1, {0, 0.0});
+    refit();
+}
+
+double VsyncClock::next_vsync(double t) const {
+    if (fit_period <= 0) return t;
+    double const periods = std::ceil((t - fit_origin) / fit_period - 1e-6);
+    return fit_origin + periods * fit_period;
+}
+
+void VsyncClock::refit() {
+    double mean_index = 0.0, mean_time = 0.0;
+    for (auto const& flip : flips) {
+        mean_index += flip.index;
+        mean_time += flip.time;
+    }
+    mean_index /= flips.size();
+    mean_time /= flips.size();
+
+    double cov = 0.0, var = 0.0;
+    for (auto const& flip : flips) {
+        double const di = flip.index - mean_index;
+        cov += di * (flip.time - mean_time);
+        var += di * di;
+    }
+
+    fit_period = var > 0 ? cov / var : nominal;
+    if (nominal > 0) {
+        fit_period = std::clamp(
+            fit_period, nominal * (1 - max_drift), nominal * (1 + max_drift)
+        );
+    }
+    fit_origin = ref_time + mean_time - fit_period * mean_index;
+}
+
+}  // namespace pivid
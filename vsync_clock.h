@@ -0,0 +1,45 @@
+// Prediction of display refresh timing from observed page flips.
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+namespace pivid {
+
+// Model of a screen's vblank schedule, fit by least squares to recent flip
+// times (which fall a whole number of refresh periods apart). Until flips
+// are observed, assumes the nominal period with vblanks at multiples of it.
+// *Not synchronized*; owners hand out copies for use on other threads.
+class VsyncClock {
+  public:
+    VsyncClock() = default;
+    explicit VsyncClock(double nominal_period);
+
+    // Adds the time of a completed flip. A flip well off the predicted
+    // grid (mode change, clock step) discards earlier history.
+    void add_flip(double flip_time);
+
+    // Returns the first predicted vblank at or after a time.
+    double next_vsync(double) const;
+
+    double nominal_period() const { return nominal; }
+    double period() const { return fit_period; }
+    int flip_count() const { return flips.size(); }
+
+  private:
+    struct Flip {
+        int64_t index;  // Refresh periods since ref_time
+        double time;    // Seconds since ref_time
+    };
+
+    void refit();
+
+    double nominal = 0.0;
+    double ref_time = 0.0;     // First flip of the current history
+    std::deque<Flip> flips;    // Recent flips, oldest first
+    double fit_origin = 0.0;   // Predicted vblank time (absolute)
+    double fit_period = 0.0;
+};
+
+}  // namespace pivid
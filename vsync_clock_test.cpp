@@ -0,0 +1,44 @@
+#include "vsync_clock.h"
+
+#include <cmath>
+
+#include <doctest/doctest.h>
+
+namespace pivid {
+
+TEST_CASE("VsyncClock") {
+    double const nominal = 1.0 / 60;
+    VsyncClock clock{nominal};
+    CHECK(clock.period() == nominal);
+    CHECK(clock.next_vsync(1.001) == doctest::Approx(61 * nominal));
+
+    // Flips from a display running slightly fast, with skips and jitter
+    double const start = 1.7e9 + 0.0042, actual = nominal * 0.9995;
+    for (int i = 0; i < 100; ++i) {
+        if (i % 7 == 3) continue;
+        double const jitter = ((i * 37) % 11 - 5) * 1e-5;
+        clock.add_flip(start + i * actual + jitter);
+    }
+    CHECK(clock.flip_count() == 86);
+    CHECK(clock.period() == doctest::Approx(actual).epsilon(1e-4));
+
+    double const vblank = start + 150 * actual;
+    double const next = clock.next_vsync(vblank - actual * 0.3);
+    CHECK(std::abs(next - vblank) < 5e-5);
+    CHECK(clock.next_vsync(next) == next);
+
+    SUBCASE("Repeated flip") {
+        clock.add_flip(start + 99 * actual);
+        CHECK(clock.flip_count() == 86);
+    }
+
+    SUBCASE("Phase jump") {
+        double const shifted = start + 200.5 * actual;
+        clock.add_flip(shifted);
+        CHECK(clock.flip_count() == 1);
+        CHECK(clock.next_vsync(shifted + 0.1 * nominal) ==
+            doctest::Approx(shifted + nominal));
+    }
+}
+
+}  // namespace pivid